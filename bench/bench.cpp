@@ -0,0 +1,630 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "allocations.h"
+#include "fakebackend.h"
+#include "utf.h"
+
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Microbenchmarks of the platform independent hot paths, run against FakeBackend.
+// Results are written as JSON in the same shape as Google Benchmark's output.
+//
+// Usage: WinToast_bench [--filter=<substring>] [--min-time=<seconds>] [--out=<file>]
+
+namespace WinToastLib::Bench {
+    namespace {
+        template<class T>
+        inline void DoNotOptimize(const T& Value)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            asm volatile("" : : "r,m"(Value) : "memory");
+#else
+            static const void* volatile Sink;
+            Sink = &Value;
+#endif
+        }
+
+        struct Result {
+            std::string Name;
+            uint64_t Iterations;
+            double NsPerOp;
+            double BytesPerSecond;
+            double AllocsPerOp;
+        };
+
+        class Runner {
+        public:
+            Runner(std::string_view Filter, double MinTime) :
+                Filter(Filter),
+                MinTime(MinTime)
+            {
+
+            }
+
+            // Body(Iterations) runs the measured operation Iterations times.
+            // The count keeps growing until one run takes at least MinTime.
+            // Allocations made on any thread meanwhile are counted against it.
+            template<class F>
+            void Run(std::string Name, F&& Body, uint64_t BytesPerOp = 0)
+            {
+                if (Name.find(Filter) == std::string::npos) {
+                    return;
+                }
+
+                Body(1);
+                uint64_t Iterations = 1;
+                while (true) {
+                    auto AllocationsBefore = GetAllocationCount();
+                    auto Start = std::chrono::steady_clock::now();
+                    Body(Iterations);
+                    double Elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+                    if (Elapsed >= MinTime || Iterations >= (uint64_t(1) << 40)) {
+                        double NsPerOp = Elapsed * 1e9 / Iterations;
+                        double AllocsPerOp = double(GetAllocationCount() - AllocationsBefore) / Iterations;
+                        Results.push_back({ std::move(Name), Iterations, NsPerOp, BytesPerOp ? BytesPerOp * Iterations / Elapsed : 0, AllocsPerOp });
+                        fprintf(stderr, "%-40s %12.1f ns/op %8.2f allocs/op %12llu iterations\n", Results.back().Name.c_str(), NsPerOp, AllocsPerOp, (unsigned long long)Iterations);
+                        return;
+                    }
+
+                    double Scale = Elapsed > 0 ? MinTime * 1.4 / Elapsed : 10;
+                    Iterations = uint64_t(Iterations * (Scale < 2 ? 2 : Scale > 10 ? 10 : Scale));
+                }
+            }
+
+            void WriteJson(FILE* Out) const
+            {
+                fprintf(Out, "{\n  \"context\": {\n    \"library\": \"WinToast\",\n    \"num_cpus\": %u,\n    \"min_time\": %g\n  },\n  \"benchmarks\": [", std::thread::hardware_concurrency(), MinTime);
+                for (size_t Idx = 0; Idx < Results.size(); ++Idx) {
+                    auto& Entry = Results[Idx];
+                    fprintf(Out, "%s\n    {\n      \"name\": \"%s\",\n      \"iterations\": %llu,\n      \"real_time\": %.3f,\n      \"time_unit\": \"ns\"", Idx ? "," : "", Entry.Name.c_str(), (unsigned long long)Entry.Iterations, Entry.NsPerOp);
+                    if (Entry.BytesPerSecond) {
+                        fprintf(Out, ",\n      \"bytes_per_second\": %.0f", Entry.BytesPerSecond);
+                    }
+                    fprintf(Out, ",\n      \"allocs_per_op\": %.3f", Entry.AllocsPerOp);
+                    fprintf(Out, "\n    }");
+                }
+                fprintf(Out, "\n  ]\n}\n");
+            }
+
+        private:
+            std::string Filter;
+            double MinTime;
+            std::vector<Result> Results;
+        };
+
+        constexpr std::pair<TemplateType, const char*> TemplateTypes[] = {
+            { TemplateType::ImageAndText01, "ImageAndText01" },
+            { TemplateType::ImageAndText02, "ImageAndText02" },
+            { TemplateType::ImageAndText03, "ImageAndText03" },
+            { TemplateType::ImageAndText04, "ImageAndText04" },
+            { TemplateType::Text01, "Text01" },
+            { TemplateType::Text02, "Text02" },
+            { TemplateType::Text03, "Text03" },
+            { TemplateType::Text04, "Text04" }
+        };
+
+        // Fire and forget coroutine, enough to drive ShowToastAsync
+        struct Workflow {
+            struct promise_type {
+                Workflow get_return_object() noexcept
+                {
+                    return {};
+                }
+
+                std::suspend_never initial_suspend() noexcept
+                {
+                    return {};
+                }
+
+                std::suspend_never final_suspend() noexcept
+                {
+                    return {};
+                }
+
+                void return_void() noexcept
+                {
+
+                }
+
+                void unhandled_exception() noexcept
+                {
+                    std::terminate();
+                }
+            };
+        };
+
+        Workflow RunWorkflow(WinToast& Instance, const Template& Toast, uint64_t& Clicked)
+        {
+            auto Outcome = co_await Instance.ShowToastAsync(Toast);
+            Clicked += std::holds_alternative<ToastClicked>(Outcome);
+        }
+
+        // A typical toast: every text field used, two actions, an attribution and audio
+        Template CreateTemplate(TemplateType Type)
+        {
+            Template Toast;
+            Toast.Type = Type;
+            const char* Lines[] = { "Download finished", "report-2024-final.pdf is ready", "12.4 MB from files.example.com" };
+            for (size_t Idx = 0; Idx < Detail::GetTextFieldCount(Type); ++Idx) {
+                Toast.TextFields.push_back(Lines[Idx]);
+            }
+            if (Detail::HasImageField(Type)) {
+                Toast.ImagePath = "C:\\Users\\User\\AppData\\Local\\App\\icon.png";
+            }
+            Toast.Actions = { "Open", "Show in folder" };
+            Toast.AttributionText = "via App & Co";
+            Toast.AudioOption = AudioOption::Silent;
+            return Toast;
+        }
+
+        void RunPayloadBenchmarks(Runner& Runner)
+        {
+            for (auto [Type, Name] : TemplateTypes) {
+                auto Toast = CreateTemplate(Type);
+                Detail::PayloadBuilder Builder;
+                Runner.Run(std::string("payload/") + Name, [&](uint64_t Iterations) {
+                    for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                        Builder.Build(Toast, true);
+                        DoNotOptimize(Builder.GetPayload().data());
+                    }
+                });
+            }
+
+            // Without either cache: the skeleton is built again (at runtime, from a type the compiler can't see)
+            // and a new builder has to grow its buffer, like every toast would without them
+            for (auto [Type, Name] : TemplateTypes) {
+                auto Toast = CreateTemplate(Type);
+                volatile TemplateType Opaque = Type;
+                Runner.Run(std::string("payload/cold_") + Name, [&](uint64_t Iterations) {
+                    for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                        auto Layout = Detail::CreateSkeleton(Opaque);
+                        DoNotOptimize(Layout);
+                        Detail::PayloadBuilder Builder;
+                        Builder.Build(Toast, true);
+                        DoNotOptimize(Builder.GetPayload().data());
+                    }
+                });
+            }
+        }
+
+        void RunUtfBenchmarks(Runner& Runner)
+        {
+            std::string Ascii64(64, 'a');
+            std::string Ascii1k;
+            while (Ascii1k.size() < 1024) {
+                Ascii1k += "<text id=\"1\">Download finished</text>";
+            }
+            std::string Mixed1k;
+            while (Mixed1k.size() < 1024) {
+                Mixed1k += "T\xc3\xa9l\xc3\xa9" "chargement termin\xc3\xa9 \xe2\x9c\x93 \xf0\x9f\x93\x81 ";
+            }
+
+            std::vector<char16_t> Output(4096);
+            for (auto& [Name, Input] : { std::pair<const char*, std::string*>{ "utf8_to_utf16/ascii_64", &Ascii64 }, { "utf8_to_utf16/ascii_1k", &Ascii1k }, { "utf8_to_utf16/mixed_1k", &Mixed1k } }) {
+                Runner.Run(Name, [&](uint64_t Iterations) {
+                    for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                        DoNotOptimize(Detail::Utf8ToUtf16(*Input, Output.data()));
+                    }
+                }, Input->size());
+            }
+        }
+
+        void RunSlotMapBenchmarks(Runner& Runner)
+        {
+            Detail::SlotMap<uint64_t> Map;
+            Runner.Run("slotmap/insert_erase", [&](uint64_t Iterations) {
+                uint64_t Erased = 0;
+                for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                    auto Id = Map.Insert(uint64_t(Idx));
+                    Map.Erase(Id, Erased);
+                }
+                DoNotOptimize(Erased);
+            });
+
+            std::vector<int64_t> Ids;
+            for (uint64_t Idx = 0; Idx < 1024; ++Idx) {
+                Ids.push_back(Map.Insert(uint64_t(Idx)));
+            }
+            Runner.Run("slotmap/find_1k", [&](uint64_t Iterations) {
+                for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                    DoNotOptimize(Map.Find(Ids[(Idx * 7919) & 1023]));
+                }
+            });
+            Runner.Run("slotmap/touch_1k", [&](uint64_t Iterations) {
+                for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                    Map.Touch(Ids[(Idx * 7919) & 1023]);
+                }
+            });
+
+            // Against the unordered_map Buffer used to be, with as many live toasts as a large deployment keeps:
+            // lookups in a random order, and churn that replaces the oldest toast with a new one
+            for (auto [Size, Name] : { std::pair<uint64_t, const char*>{ 10000, "10k" }, { 100000, "100k" }, { 1000000, "1m" } }) {
+                {
+                    Detail::SlotMap<uint64_t> Live;
+                    std::vector<int64_t> LiveIds;
+                    LiveIds.reserve(Size);
+                    for (uint64_t Idx = 0; Idx < Size; ++Idx) {
+                        LiveIds.push_back(Live.Insert(uint64_t(Idx)));
+                    }
+                    Runner.Run(std::string("slotmap/find_") + Name, [&](uint64_t Iterations) {
+                        for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                            DoNotOptimize(Live.Find(LiveIds[(Idx * 2654435761) % Size]));
+                        }
+                    });
+                    uint64_t Next = 0;
+                    Runner.Run(std::string("slotmap/churn_") + Name, [&](uint64_t Iterations) {
+                        uint64_t Erased = 0;
+                        for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                            auto& Slot = LiveIds[Next++ % Size];
+                            Live.Erase(Slot, Erased);
+                            Slot = Live.Insert(uint64_t(Idx));
+                        }
+                        DoNotOptimize(Erased);
+                    });
+                }
+
+                {
+                    std::unordered_map<int64_t, uint64_t> Live;
+                    std::vector<int64_t> LiveIds;
+                    LiveIds.reserve(Size);
+                    int64_t NextId = 1;
+                    for (uint64_t Idx = 0; Idx < Size; ++Idx) {
+                        LiveIds.push_back(NextId);
+                        Live.emplace(NextId++, Idx);
+                    }
+                    Runner.Run(std::string("unordered_map/find_") + Name, [&](uint64_t Iterations) {
+                        for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                            DoNotOptimize(Live.find(LiveIds[(Idx * 2654435761) % Size]));
+                        }
+                    });
+                    uint64_t Next = 0;
+                    Runner.Run(std::string("unordered_map/churn_") + Name, [&](uint64_t Iterations) {
+                        for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                            auto& Slot = LiveIds[Next++ % Size];
+                            Live.erase(Slot);
+                            Slot = NextId++;
+                            Live.emplace(Slot, Idx);
+                        }
+                    });
+                }
+            }
+        }
+
+        // With 256k entries pending over the next few days, like a large reminder backlog
+        void RunTimingWheelBenchmarks(Runner& Runner)
+        {
+            constexpr uint64_t Day = 86400000;
+            Detail::TimingWheel<uint64_t> Wheel(0);
+            for (uint64_t Idx = 0; Idx < 256 * 1024; ++Idx) {
+                Wheel.Insert(1000 + (Idx * 2654435761) % (3 * Day), uint64_t(Idx));
+            }
+
+            Runner.Run("timingwheel/insert_cancel_256k", [&](uint64_t Iterations) {
+                uint64_t Cancelled = 0;
+                for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                    auto Id = Wheel.Insert(1000 + (Idx * 40503) % (3 * Day), uint64_t(Idx));
+                    Wheel.Erase(Id, Cancelled);
+                }
+                DoNotOptimize(Cancelled);
+            });
+
+            // Each pass moves a minute on, firing whatever became due and scheduling as many again
+            uint64_t Now = 0;
+            Runner.Run("timingwheel/advance_minute_256k", [&](uint64_t Iterations) {
+                for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                    Now += 60000;
+                    Wheel.Advance(Now, [&Wheel, Now](int64_t, uint64_t&& Value) {
+                        Wheel.Insert(Now + 1000 + (Value * 2654435761) % (3 * Day), std::move(Value));
+                    });
+                }
+            });
+        }
+
+        void RunWinToastBenchmarks(Runner& Runner)
+        {
+            auto Toast = CreateTemplate(TemplateType::ImageAndText02);
+            Handler Handler;
+            int Clicks = 0;
+            Handler.OnClicked = [&Clicks](int) { ++Clicks; };
+
+            {
+                auto Platform = std::make_unique<FakeBackend>();
+                WinToast Instance("WinToast.Bench", std::move(Platform));
+                Instance.Initialize();
+                Runner.Run("wintoast/show_hide", [&](uint64_t Iterations) {
+                    for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                        int64_t Id;
+                        Instance.ShowToast(Toast, Handler, &Id);
+                        Instance.HideToast(Id);
+                    }
+                });
+            }
+
+            // Same with a tagged toast written to the journal and its removal appended after, compacting as it fills up
+            auto JournalPath = std::filesystem::temp_directory_path() / "WinToast_bench.journal";
+            std::filesystem::remove(JournalPath);
+            {
+                Options Journaled;
+                Journaled.JournalPath = JournalPath.string();
+                auto Tagged = Toast;
+                Tagged.Tag = "bench";
+                Tagged.Group = "journal";
+
+                auto Platform = std::make_unique<FakeBackend>();
+                WinToast Instance("WinToast.Bench", std::move(Platform), Journaled);
+                Instance.Initialize();
+                Runner.Run("wintoast/show_hide_journaled", [&](uint64_t Iterations) {
+                    for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                        int64_t Id;
+                        Instance.ShowToast(Tagged, Handler, &Id);
+                        Instance.HideToast(Id);
+                    }
+                });
+            }
+            std::filesystem::remove(JournalPath);
+
+            // Same with grouped toasts, which are also kept in the group index
+            {
+                auto Grouped = Toast;
+                Grouped.Tag = "bench";
+                Grouped.Group = "bench";
+
+                auto Platform = std::make_unique<FakeBackend>();
+                WinToast Instance("WinToast.Bench", std::move(Platform));
+                Instance.Initialize();
+                Runner.Run("wintoast/show_hide_grouped", [&](uint64_t Iterations) {
+                    for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                        int64_t Id;
+                        Instance.ShowToast(Grouped, Handler, &Id);
+                        Instance.HideToast(Id);
+                    }
+                });
+            }
+
+            // Show 1k grouped toasts, then clear them one by one or with one call for the whole group
+            {
+                std::vector<Template> Grouped(1000, Toast);
+                for (size_t Idx = 0; Idx < Grouped.size(); ++Idx) {
+                    Grouped[Idx].Tag = std::to_string(Idx);
+                    Grouped[Idx].Group = "bench";
+                }
+
+                auto Platform = std::make_unique<FakeBackend>();
+                WinToast Instance("WinToast.Bench", std::move(Platform));
+                Instance.Initialize();
+                for (bool ByGroup : { false, true }) {
+                    Runner.Run(ByGroup ? "wintoast/show_1k_clear_group" : "wintoast/show_1k_clear_toasts", [&](uint64_t Iterations) {
+                        for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                            for (auto& Member : Grouped) {
+                                Instance.ShowToast(Member, Handler);
+                            }
+                            if (ByGroup) {
+                                Instance.ClearGroup("bench");
+                            }
+                            else {
+                                Instance.ClearToasts();
+                            }
+                        }
+                    });
+                }
+            }
+
+            // Show, then raise a click on it: registers the tracked handler and dispatches through it
+            {
+                auto Platform = std::make_unique<FakeBackend>();
+                auto& Fake = *Platform;
+                WinToast Instance("WinToast.Bench", std::move(Platform));
+                Instance.Initialize();
+                Runner.Run("handler/register_dispatch", [&](uint64_t Iterations) {
+                    for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                        Instance.ShowToast(Toast, Handler);
+                        Fake.LastShown->Handler.OnClicked(0);
+                    }
+                });
+            }
+
+            // What registering used to cost: the whole Handler, three std::functions, captured by value
+            // once per event sink, then dispatching the click through one of the copies
+            {
+                struct FunctionHandler {
+                    std::function<void(int ActionIdx)> OnClicked;
+                    std::function<void(DismissalReason Reason)> OnDismissed;
+                    std::function<void()> OnFailed;
+                };
+
+                FunctionHandler Legacy{ [&Clicks](int) { ++Clicks; }, [](DismissalReason) {}, []() {} };
+                Runner.Run("handler/register_dispatch_std_function", [&](uint64_t Iterations) {
+                    for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                        std::function<void(int)> Activated = [Legacy](int ActionIdx) { Legacy.OnClicked(ActionIdx); };
+                        std::function<void(DismissalReason)> Dismissed = [Legacy](DismissalReason Reason) { Legacy.OnDismissed(Reason); };
+                        std::function<void()> Failed = [Legacy]() { Legacy.OnFailed(); };
+                        DoNotOptimize(Dismissed);
+                        DoNotOptimize(Failed);
+                        Activated(0);
+                    }
+                });
+            }
+
+            // Same, awaited by a coroutine that's resumed by the click
+            {
+                auto Platform = std::make_unique<FakeBackend>();
+                auto& Fake = *Platform;
+                WinToast Instance("WinToast.Bench", std::move(Platform));
+                Instance.Initialize();
+                uint64_t Clicked = 0;
+                Runner.Run("handler/async_show_click", [&](uint64_t Iterations) {
+                    for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                        RunWorkflow(Instance, Toast, Clicked);
+                        Fake.LastShown->Handler.OnClicked(0);
+                    }
+                });
+                DoNotOptimize(Clicked);
+            }
+
+            // Same, but delivered through an executor and the event ring, drained in batches
+            {
+                std::vector<Detail::InlineFunction<void()>> Posted;
+                Options Options;
+                Options.EventQueueSize = 256;
+                Options.CallbackExecutor = [&Posted](Detail::InlineFunction<void()>&& Callback) { Posted.push_back(std::move(Callback)); };
+                auto Platform = std::make_unique<FakeBackend>();
+                auto& Fake = *Platform;
+                WinToast Instance("WinToast.Bench", std::move(Platform), Options);
+                Instance.Initialize();
+                Event Events[64];
+                Runner.Run("handler/dispatch_executor_poll", [&](uint64_t Iterations) {
+                    for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                        Instance.ShowToast(Toast, Handler);
+                        Fake.LastShown->Handler.OnClicked(0);
+                        if ((Idx & 63) == 63) {
+                            for (auto& Callback : Posted) {
+                                Callback();
+                            }
+                            Posted.clear();
+                            DoNotOptimize(Instance.PollEvents(Events));
+                        }
+                    }
+                    Posted.clear();
+                    while (Instance.PollEvents(Events)) {}
+                });
+            }
+
+            // A producer updating a progress bar in a tight loop, sent straight through or merged by the worker
+            auto Progress = CreateTemplate(TemplateType::Text02);
+            Progress.Tag = "download";
+            Progress.Progress.Value = "{progressValue}";
+            Progress.Progress.Status = "{progressStatus}";
+            Progress.Data = { { "progressValue", "0" }, { "progressStatus", "Downloading" } };
+            const std::string_view Values[] = { "0.25", "0.5" };
+            for (bool Throttled : { false, true }) {
+                Options Options;
+                Options.UseWorkerThread = Throttled;
+                Options.MinUpdateInterval = Throttled ? 100 : 0;
+                WinToast Instance("WinToast.Bench", std::make_unique<FakeBackend>(), Options);
+                Instance.Initialize();
+                int64_t Id;
+                Instance.ShowToast(Progress, Handler, &Id);
+                Runner.Run(Throttled ? "update/throttled" : "update/direct", [&](uint64_t Iterations) {
+                    for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                        Instance.UpdateToast(Id, { { "progressValue", Values[Idx & 1] } });
+                    }
+                });
+            }
+
+            DoNotOptimize(Clicks);
+        }
+
+        void RunHistogramBenchmarks(Runner& Runner)
+        {
+            Detail::LatencyHistogram Histogram;
+            Runner.Run("histogram/record", [&](uint64_t Iterations) {
+                for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                    Histogram.Record(Idx & 0xFFFFF);
+                }
+            });
+
+            // What each stage of ShowToast pays: reading the clock at its end and recording the difference
+            Runner.Run("histogram/clock_and_record", [&](uint64_t Iterations) {
+                auto Last = std::chrono::steady_clock::now();
+                for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                    auto Now = std::chrono::steady_clock::now();
+                    Histogram.Record(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(Now - Last).count()));
+                    Last = Now;
+                }
+            });
+
+            // Four threads recording into the same histogram at once, per record on each thread
+            Runner.Run("histogram/record_4_threads", [&](uint64_t Iterations) {
+                std::vector<std::thread> Threads;
+                for (int Thread = 0; Thread < 4; ++Thread) {
+                    Threads.emplace_back([&Histogram, Iterations]() {
+                        for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                            Histogram.Record(Idx & 0xFFFFF);
+                        }
+                    });
+                }
+                for (auto& Thread : Threads) {
+                    Thread.join();
+                }
+            });
+
+            Runner.Run("histogram/get_stats", [&](uint64_t Iterations) {
+                for (uint64_t Idx = 0; Idx < Iterations; ++Idx) {
+                    DoNotOptimize(Histogram.GetStats());
+                }
+            });
+        }
+    }
+}
+
+int main(int Argc, char** Argv)
+{
+    using namespace WinToastLib::Bench;
+
+    std::string_view Filter;
+    double MinTime = 0.2;
+    const char* OutPath = nullptr;
+    for (int Idx = 1; Idx < Argc; ++Idx) {
+        std::string_view Arg = Argv[Idx];
+        if (Arg.starts_with("--filter=")) {
+            Filter = Arg.substr(9);
+        }
+        else if (Arg.starts_with("--min-time=")) {
+            MinTime = atof(Argv[Idx] + 11);
+        }
+        else if (Arg.starts_with("--out=")) {
+            OutPath = Argv[Idx] + 6;
+        }
+        else {
+            fprintf(stderr, "Usage: %s [--filter=<substring>] [--min-time=<seconds>] [--out=<file>]\n", Argv[0]);
+            return 1;
+        }
+    }
+
+    Runner Runner(Filter, MinTime);
+    RunPayloadBenchmarks(Runner);
+    RunUtfBenchmarks(Runner);
+    RunSlotMapBenchmarks(Runner);
+    RunTimingWheelBenchmarks(Runner);
+    RunWinToastBenchmarks(Runner);
+    RunHistogramBenchmarks(Runner);
+
+    FILE* Out = OutPath ? fopen(OutPath, "w") : stdout;
+    if (!Out) {
+        fprintf(stderr, "Could not open %s\n", OutPath);
+        return 1;
+    }
+    Runner.WriteJson(Out);
+    if (Out != stdout) {
+        fclose(Out);
+    }
+    return 0;
+}
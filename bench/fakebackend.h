@@ -0,0 +1,240 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "wintoastlib.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <queue>
+#include <random>
+
+namespace WinToastLib::Bench {
+    // What FakeBackend should simulate, everything is off by default
+    struct FakeBackendConfig {
+        // Added to CreateNotification, Show, Hide, Update, RemoveGroup and RemoveAll
+        std::chrono::microseconds Latency{ 0 };
+        // Chance of Show failing
+        double FailureRate = 0;
+        // Chance of a shown toast later being clicked, dismissed or failing on its own,
+        // at a random point within MaxEventDelay
+        double EventRate = 0;
+        std::chrono::milliseconds MaxEventDelay{ 1000 };
+        uint32_t Seed = 1;
+    };
+
+    // In-process stand-in for the WinRT notifier. Notifications just hold on to their handler,
+    // so events can be raised on them directly. When configured to raise events itself, a copy of
+    // the handler is kept until the event fires, like the platform keeps its event sinks.
+    class FakeBackend : public Backend {
+    public:
+        class FakeNotification : public Notification {
+        public:
+            WinToastLib::Handler Handler;
+        };
+
+        FakeBackend(const FakeBackendConfig& Config = {}) :
+            Config(Config),
+            Random(Config.Seed),
+            StopEvents(false)
+        {
+            if (Config.EventRate > 0) {
+                EventThread = std::thread(&FakeBackend::RunEvents, this);
+            }
+        }
+
+        ~FakeBackend()
+        {
+            if (EventThread.joinable()) {
+                {
+                    std::lock_guard Lock(Mutex);
+                    StopEvents = true;
+                }
+                EventsChanged.notify_one();
+                EventThread.join();
+            }
+        }
+
+        Error Initialize(const std::string& /*Aumi*/, const TimeSource& /*TimeSource*/) override
+        {
+            Initializations.fetch_add(1, std::memory_order_relaxed);
+            return Error::Success;
+        }
+
+        bool SupportsModernFeatures() const override
+        {
+            return true;
+        }
+
+        int32_t CreateNotification(const Template& /*Toast*/, std::string_view /*Payload*/, std::unique_ptr<Notification>& Notification) override
+        {
+            Simulate();
+            Notification = std::make_unique<FakeNotification>();
+            return 0;
+        }
+
+        int32_t RegisterHandler(Notification& Notification, Handler&& Handler) override
+        {
+            static_cast<FakeNotification&>(Notification).Handler = std::move(Handler);
+            return 0;
+        }
+
+        int32_t Show(Notification& Notification) override
+        {
+            Simulate();
+            auto& Target = static_cast<FakeNotification&>(Notification);
+            if (Config.FailureRate > 0 || Config.EventRate > 0) {
+                std::lock_guard Lock(Mutex);
+                if (Chance(Config.FailureRate)) {
+                    ShowFailures.fetch_add(1, std::memory_order_relaxed);
+                    // WPN_E_NOTIFICATION_HIDDEN, any failure will do
+                    return int32_t(0x803E0107);
+                }
+                if (Chance(Config.EventRate)) {
+                    std::uniform_int_distribution<int64_t> Delay(0, Config.MaxEventDelay.count());
+                    std::uniform_int_distribution<int> Type(0, 9);
+                    auto Kind = Type(Random);
+                    Pending.push({
+                        std::chrono::steady_clock::now() + std::chrono::milliseconds(Delay(Random)),
+                        Kind < 4 ? EventType::Clicked : Kind < 9 ? EventType::Dismissed : EventType::Failed,
+                        Target.Handler
+                    });
+                    EventsChanged.notify_one();
+                }
+            }
+
+            LastShown = &Target;
+            Shown.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+
+        int32_t Hide(Notification& /*Notification*/) override
+        {
+            Simulate();
+            Hidden.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+
+        int32_t Update(std::string_view /*Tag*/, std::string_view /*Group*/, std::span<const DataField> /*Data*/, uint32_t /*SequenceNumber*/) override
+        {
+            Simulate();
+            Updated.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+
+        std::unique_ptr<Notification> Recover(std::string_view /*Tag*/, std::string_view /*Group*/) override
+        {
+            return std::make_unique<FakeNotification>();
+        }
+
+        int32_t RemoveGroup(std::string_view /*Group*/) override
+        {
+            Simulate();
+            Cleared.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+
+        int32_t RemoveAll() override
+        {
+            Simulate();
+            Cleared.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+
+        // Only valid until that toast finishes or is hidden
+        FakeNotification* LastShown = nullptr;
+        // Initialize calls, where a real backend resolves its platform objects
+        std::atomic<uint64_t> Initializations = 0;
+        std::atomic<uint64_t> Shown = 0;
+        std::atomic<uint64_t> Hidden = 0;
+        std::atomic<uint64_t> Updated = 0;
+        // RemoveGroup and RemoveAll calls
+        std::atomic<uint64_t> Cleared = 0;
+        std::atomic<uint64_t> ShowFailures = 0;
+        std::atomic<uint64_t> EventsRaised = 0;
+
+    private:
+        struct PendingEvent {
+            std::chrono::steady_clock::time_point Due;
+            EventType Type;
+            WinToastLib::Handler Handler;
+
+            bool operator>(const PendingEvent& Other) const
+            {
+                return Due > Other.Due;
+            }
+        };
+
+        void Simulate()
+        {
+            if (Config.Latency.count()) {
+                std::this_thread::sleep_for(Config.Latency);
+            }
+        }
+
+        // Expects Mutex to be held
+        bool Chance(double Rate)
+        {
+            return Rate > 0 && std::uniform_real_distribution<double>(0, 1)(Random) < Rate;
+        }
+
+        void RunEvents()
+        {
+            std::unique_lock Lock(Mutex);
+            while (!StopEvents) {
+                if (Pending.empty()) {
+                    EventsChanged.wait(Lock);
+                    continue;
+                }
+                if (Pending.top().Due > std::chrono::steady_clock::now()) {
+                    EventsChanged.wait_until(Lock, Pending.top().Due);
+                    continue;
+                }
+
+                auto Raised = std::move(const_cast<PendingEvent&>(Pending.top()));
+                Pending.pop();
+                Lock.unlock();
+                switch (Raised.Type) {
+                case EventType::Clicked:
+                    Raised.Handler.OnClicked(0);
+                    break;
+                case EventType::Dismissed:
+                    Raised.Handler.OnDismissed(DismissalReason::UserCanceled);
+                    break;
+                case EventType::Failed:
+                    Raised.Handler.OnFailed();
+                    break;
+                }
+                EventsRaised.fetch_add(1, std::memory_order_relaxed);
+                Raised = {};
+                Lock.lock();
+            }
+        }
+
+        FakeBackendConfig Config;
+        std::mutex Mutex;
+        std::mt19937 Random;
+        std::priority_queue<PendingEvent, std::vector<PendingEvent>, std::greater<>> Pending;
+        std::condition_variable EventsChanged;
+        bool StopEvents;
+        std::thread EventThread;
+    };
+}
@@ -0,0 +1,299 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "fakebackend.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+// Drives sustained toast traffic through WinToast against FakeBackend, which can inject latency,
+// failures and user events. Prints one JSON object per report interval (JSON Lines) with throughput,
+// latency percentiles, RSS, buffer size and how many handler closures are alive, then a summary.
+// Runs headless, so it can be left going for hours on a Linux box.
+//
+// With --max-in-flight, admission control is on and --high-share of the toasts are sent as Priority::High
+// (the rest Normal), so overloading it shows whether high priority toasts still get through quickly.
+//
+// Usage: WinToast_soak [--duration=<s>] [--rate=<toasts/s>] [--report-every=<s>] [--latency-us=<us>]
+//     [--failure-rate=<0..1>] [--event-rate=<0..1>] [--hide-rate=<0..1>] [--clear-every=<s>]
+//     [--max-buffer=<toasts>] [--max-in-flight=<toasts>] [--policy=drop-lowest|drop-oldest|block]
+//     [--high-share=<0..1>] [--worker]
+
+namespace WinToastLib::Bench {
+    namespace {
+        struct SoakOptions {
+            double Duration = 60;
+            double Rate = 100;
+            double ReportEvery = 5;
+            double HideRate = 0.2;
+            double ClearEvery = 0;
+            size_t MaxBuffer = 0;
+            size_t MaxInFlight = 0;
+            AdmissionPolicy Policy = AdmissionPolicy::DropLowest;
+            double HighShare = 0.1;
+            bool UseWorker = false;
+            FakeBackendConfig Backend{ .EventRate = 0.5 };
+        };
+
+        // Counts copies of the handlers' closures that are still alive, to catch leaked or pinned handlers
+        class ClosureCanary {
+        public:
+            static inline std::atomic<int64_t> Live = 0;
+
+            ClosureCanary() noexcept
+            {
+                Live.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            ClosureCanary(const ClosureCanary&) noexcept :
+                ClosureCanary()
+            {
+
+            }
+
+            ~ClosureCanary()
+            {
+                Live.fetch_sub(1, std::memory_order_relaxed);
+            }
+        };
+
+        struct EventCounts {
+            std::atomic<uint64_t> Clicked = 0;
+            std::atomic<uint64_t> Dismissed = 0;
+            std::atomic<uint64_t> Failed = 0;
+        };
+
+        uint64_t GetResidentKb()
+        {
+#ifdef __linux__
+            FILE* Statm = fopen("/proc/self/statm", "r");
+            if (!Statm) {
+                return 0;
+            }
+            unsigned long long Size = 0, Resident = 0;
+            auto Read = fscanf(Statm, "%llu %llu", &Size, &Resident);
+            fclose(Statm);
+            return Read == 2 ? Resident * (uint64_t(sysconf(_SC_PAGESIZE)) / 1024) : 0;
+#else
+            return 0;
+#endif
+        }
+
+        bool ParseOption(std::string_view Arg, SoakOptions& Options)
+        {
+            auto Value = [&Arg](std::string_view Name, double& Out) {
+                if (!Arg.starts_with(Name)) {
+                    return false;
+                }
+                Out = atof(std::string(Arg.substr(Name.size())).c_str());
+                return true;
+            };
+
+            double Number;
+            if (Value("--duration=", Options.Duration) || Value("--rate=", Options.Rate) || Value("--report-every=", Options.ReportEvery) ||
+                Value("--hide-rate=", Options.HideRate) || Value("--clear-every=", Options.ClearEvery) || Value("--high-share=", Options.HighShare) ||
+                Value("--failure-rate=", Options.Backend.FailureRate) || Value("--event-rate=", Options.Backend.EventRate)) {
+                return true;
+            }
+            if (Value("--latency-us=", Number)) {
+                Options.Backend.Latency = std::chrono::microseconds(int64_t(Number));
+                return true;
+            }
+            if (Value("--max-buffer=", Number)) {
+                Options.MaxBuffer = size_t(Number);
+                return true;
+            }
+            if (Value("--max-in-flight=", Number)) {
+                Options.MaxInFlight = size_t(Number);
+                return true;
+            }
+            if (Arg.starts_with("--policy=")) {
+                auto Policy = Arg.substr(9);
+                Options.Policy = Policy == "block" ? AdmissionPolicy::Block : Policy == "drop-oldest" ? AdmissionPolicy::DropOldest : AdmissionPolicy::DropLowest;
+                return Policy == "block" || Policy == "drop-oldest" || Policy == "drop-lowest";
+            }
+            if (Arg == "--worker") {
+                Options.UseWorker = true;
+                return true;
+            }
+            return false;
+        }
+
+        int RunSoak(const SoakOptions& Config)
+        {
+            EventCounts Events;
+            auto Platform = std::make_unique<FakeBackend>(Config.Backend);
+            auto& Fake = *Platform;
+            Options Options;
+            Options.UseWorkerThread = Config.UseWorker;
+            Options.MaxBufferSize = Config.MaxBuffer;
+            Options.MaxInFlight = Config.MaxInFlight;
+            Options.AdmissionPolicy = Config.Policy;
+            auto Instance = std::make_unique<WinToast>("WinToast.Soak", std::move(Platform), Options);
+            if (Instance->Initialize() != Error::Success) {
+                fprintf(stderr, "Could not initialize\n");
+                return 1;
+            }
+
+            auto ShowLatency = std::make_unique<Detail::LatencyHistogram>();
+            auto HideLatency = std::make_unique<Detail::LatencyHistogram>();
+            auto TotalShowLatency = std::make_unique<Detail::LatencyHistogram>();
+            auto HighShowLatency = std::make_unique<Detail::LatencyHistogram>();
+            std::vector<int64_t> RecentIds(256);
+            std::mt19937 Random(Config.Backend.Seed + 1);
+            std::uniform_real_distribution<double> Chance(0, 1);
+
+            auto Start = std::chrono::steady_clock::now();
+            auto End = Start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(Config.Duration));
+            auto ReportEvery = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(Config.ReportEvery));
+            auto ClearEvery = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(Config.ClearEvery));
+            auto NextReport = Start + ReportEvery;
+            auto NextClear = Start + ClearEvery;
+            uint64_t Sent = 0, SentAtReport = 0, Failures = 0, Hides = 0, Clears = 0, PeakResident = 0;
+            auto LastReport = Start;
+
+            while (true) {
+                auto Due = Start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(Sent / Config.Rate));
+                // Also checked against the clock, since a blocking admission policy can hold ShowToast up
+                if (Due >= End || std::chrono::steady_clock::now() >= End) {
+                    break;
+                }
+                std::this_thread::sleep_until(Due);
+
+                Template Toast;
+                Toast.Type = TemplateType::Text02;
+                Toast.TextFields = { "Soak", std::to_string(Sent) };
+                bool High = Config.MaxInFlight && Chance(Random) < Config.HighShare;
+                Toast.Priority = High ? Priority::High : Priority::Normal;
+                Handler Handler{
+                    .OnClicked = [Canary = ClosureCanary(), &Events](int) { Events.Clicked.fetch_add(1, std::memory_order_relaxed); },
+                    .OnDismissed = [Canary = ClosureCanary(), &Events](DismissalReason) { Events.Dismissed.fetch_add(1, std::memory_order_relaxed); },
+                    .OnFailed = [Canary = ClosureCanary(), &Events]() { Events.Failed.fetch_add(1, std::memory_order_relaxed); }
+                };
+
+                int64_t Id = 0;
+                auto Before = std::chrono::steady_clock::now();
+                auto Result = Instance->ShowToast(Toast, Handler, &Id);
+                auto After = std::chrono::steady_clock::now();
+                uint64_t Ns = std::chrono::duration_cast<std::chrono::nanoseconds>(After - Before).count();
+                ShowLatency->Record(Ns);
+                TotalShowLatency->Record(Ns);
+                if (High) {
+                    HighShowLatency->Record(Ns);
+                }
+                if (Result == Error::Success) {
+                    RecentIds[Sent % RecentIds.size()] = Id;
+                }
+                else {
+                    ++Failures;
+                }
+                ++Sent;
+
+                if (Chance(Random) < Config.HideRate) {
+                    if (auto Victim = RecentIds[Random() % RecentIds.size()]) {
+                        Before = std::chrono::steady_clock::now();
+                        Instance->HideToast(Victim);
+                        After = std::chrono::steady_clock::now();
+                        HideLatency->Record(std::chrono::duration_cast<std::chrono::nanoseconds>(After - Before).count());
+                        ++Hides;
+                    }
+                }
+
+                if (Config.ClearEvery > 0 && After >= NextClear) {
+                    Instance->ClearToasts();
+                    NextClear += ClearEvery;
+                    ++Clears;
+                }
+
+                if (After >= NextReport) {
+                    auto Show = ShowLatency->GetStats();
+                    auto Hide = HideLatency->GetStats();
+                    auto Buffer = Instance->GetBufferStats();
+                    auto Resident = GetResidentKb();
+                    PeakResident = Resident > PeakResident ? Resident : PeakResident;
+                    double Elapsed = std::chrono::duration<double>(After - LastReport).count();
+                    printf("{\"t\": %.1f, \"sent\": %llu, \"throughput\": %.1f, \"show_p50_ns\": %llu, \"show_p99_ns\": %llu, \"show_p999_ns\": %llu, \"show_max_ns\": %llu, "
+                        "\"hide_p99_ns\": %llu, \"rss_kb\": %llu, \"live\": %zu, \"live_bytes\": %zu, \"live_closures\": %lld, "
+                        "\"failures\": %llu, \"hides\": %llu, \"clears\": %llu, \"clicked\": %llu, \"dismissed\": %llu, \"failed\": %llu}\n",
+                        std::chrono::duration<double>(After - Start).count(), (unsigned long long)Sent, (Sent - SentAtReport) / Elapsed,
+                        (unsigned long long)Show.P50Ns, (unsigned long long)Show.P99Ns, (unsigned long long)Show.P999Ns, (unsigned long long)Show.MaxNs,
+                        (unsigned long long)Hide.P99Ns, (unsigned long long)Resident, Buffer.Live, Buffer.LiveBytes, (long long)ClosureCanary::Live.load(),
+                        (unsigned long long)Failures, (unsigned long long)Hides, (unsigned long long)Clears, (unsigned long long)Events.Clicked.load(),
+                        (unsigned long long)Events.Dismissed.load(), (unsigned long long)Events.Failed.load());
+                    fflush(stdout);
+
+                    ShowLatency = std::make_unique<Detail::LatencyHistogram>();
+                    HideLatency = std::make_unique<Detail::LatencyHistogram>();
+                    SentAtReport = Sent;
+                    LastReport = After;
+                    NextReport += ReportEvery;
+                }
+            }
+
+            double Elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+            auto Total = TotalShowLatency->GetStats();
+            auto HighTotal = HighShowLatency->GetStats();
+            auto Admission = Instance->GetStats().Admission;
+            auto Raised = Fake.EventsRaised.load();
+            auto ShowFailures = Fake.ShowFailures.load();
+
+            // Everything the instance and the backend held on to should be gone once they are
+            Instance.reset();
+            PeakResident = GetResidentKb() > PeakResident ? GetResidentKb() : PeakResident;
+            printf("{\"summary\": true, \"seconds\": %.1f, \"sent\": %llu, \"throughput\": %.1f, \"show_p50_ns\": %llu, \"show_p99_ns\": %llu, \"show_p999_ns\": %llu, "
+                "\"show_max_ns\": %llu, \"high_show_p99_ns\": %llu, \"high_show_max_ns\": %llu, \"peak_rss_kb\": %llu, \"failures\": %llu, \"backend_show_failures\": %llu, "
+                "\"events_raised\": %llu, \"admitted\": %llu, \"queued\": %llu, \"shed\": %llu, \"displaced\": %llu, \"leaked_closures\": %lld}\n",
+                Elapsed, (unsigned long long)Sent, Sent / Elapsed, (unsigned long long)Total.P50Ns, (unsigned long long)Total.P99Ns, (unsigned long long)Total.P999Ns,
+                (unsigned long long)Total.MaxNs, (unsigned long long)HighTotal.P99Ns, (unsigned long long)HighTotal.MaxNs, (unsigned long long)PeakResident,
+                (unsigned long long)Failures, (unsigned long long)ShowFailures, (unsigned long long)Raised, (unsigned long long)Admission.Admitted,
+                (unsigned long long)Admission.Queued, (unsigned long long)Admission.Shed, (unsigned long long)Admission.Displaced, (long long)ClosureCanary::Live.load());
+            return ClosureCanary::Live.load() == 0 ? 0 : 2;
+        }
+    }
+}
+
+int main(int Argc, char** Argv)
+{
+    using namespace WinToastLib::Bench;
+
+    SoakOptions Options;
+    for (int Idx = 1; Idx < Argc; ++Idx) {
+        if (!ParseOption(Argv[Idx], Options)) {
+            fprintf(stderr, "Usage: %s [--duration=<s>] [--rate=<toasts/s>] [--report-every=<s>] [--latency-us=<us>]\n"
+                "    [--failure-rate=<0..1>] [--event-rate=<0..1>] [--hide-rate=<0..1>] [--clear-every=<s>] [--max-buffer=<toasts>]\n"
+                "    [--max-in-flight=<toasts>] [--policy=drop-lowest|drop-oldest|block] [--high-share=<0..1>] [--worker]\n", Argv[0]);
+            return 1;
+        }
+    }
+    if (Options.Rate <= 0 || Options.ReportEvery <= 0) {
+        fprintf(stderr, "--rate and --report-every must be positive\n");
+        return 1;
+    }
+
+    return RunSoak(Options);
+}
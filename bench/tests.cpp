@@ -0,0 +1,1984 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "allocations.h"
+#include "fakebackend.h"
+#include "resolvedobjects.h"
+#include "utf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+// Behavior tests of the platform independent parts, run against FakeBackend.
+// Every test runs, a failed check is printed and fails the run without stopping it.
+//
+// Usage: WinToast_test [--filter=<substring>]
+
+#define CHECK(Condition) ::WinToastLib::Bench::Check((Condition), #Condition, __FILE__, __LINE__)
+
+namespace WinToastLib::Bench {
+    namespace {
+        int FailedChecks = 0;
+
+        bool Check(bool Passed, const char* Condition, const char* File, int Line)
+        {
+            if (!Passed) {
+                fprintf(stderr, "%s:%d: check failed: %s\n", File, Line, Condition);
+                ++FailedChecks;
+            }
+            return Passed;
+        }
+
+        std::string BuildPayload(const Template& Toast, bool ModernFeatures)
+        {
+            Detail::PayloadBuilder Builder;
+            if (!Builder.Build(Toast, ModernFeatures)) {
+                return "<failed>";
+            }
+            return std::string(Builder.GetPayload());
+        }
+
+        // What the legacy template looks like once its fields are set through the XML DOM
+        void TestPayloadLegacy()
+        {
+            Template Toast;
+            Toast.Type = TemplateType::Text02;
+            Toast.TextFields = { "Tom & Jerry", "<b>\"quoted\" 'single'</b>" };
+            CHECK(BuildPayload(Toast, false) ==
+                "<toast><visual><binding template=\"ToastText02\">"
+                "<text id=\"1\">Tom &amp; Jerry</text>"
+                "<text id=\"2\">&lt;b&gt;&quot;quoted&quot; &apos;single&apos;&lt;/b&gt;</text>"
+                "</binding></visual></toast>");
+
+            // Fields left out stay empty, like the template's own elements
+            Toast.Type = TemplateType::ImageAndText04;
+            Toast.TextFields = { "One" };
+            CHECK(BuildPayload(Toast, false) ==
+                "<toast><visual><binding template=\"ToastImageAndText04\">"
+                "<image id=\"1\" src=\"\"/>"
+                "<text id=\"1\">One</text><text id=\"2\"></text><text id=\"3\"></text>"
+                "</binding></visual></toast>");
+        }
+
+        // Actions, attribution, progress, duration and audio need modern features, and are dropped without them
+        void TestPayloadModern()
+        {
+            Template Toast;
+            Toast.Type = TemplateType::ImageAndText02;
+            Toast.TextFields = { "Download finished", "report.pdf" };
+            Toast.ImagePath = "C:\\a&b.png";
+            Toast.Actions = { "Open", "Show <all>" };
+            Toast.AttributionText = "via App";
+            Toast.Progress.Value = "0.5";
+            Toast.Progress.Status = "Downloading";
+            Toast.AudioPath = "ms-winsoundevent:Notification.IM";
+            Toast.AudioOption = AudioOption::Loop;
+            Toast.Duration = Duration::Long;
+            CHECK(BuildPayload(Toast, true) ==
+                "<toast template=\"ToastGeneric\" duration=\"long\"><visual><binding template=\"ToastImageAndText02\">"
+                "<image id=\"1\" src=\"C:\\a&amp;b.png\"/>"
+                "<text id=\"1\">Download finished</text><text id=\"2\">report.pdf</text>"
+                "<text placement=\"attribution\">via App</text>"
+                "<progress value=\"0.5\" status=\"Downloading\"/>"
+                "</binding></visual>"
+                "<actions><action content=\"Open\" arguments=\"0\"/><action content=\"Show &lt;all&gt;\" arguments=\"1\"/></actions>"
+                "<audio src=\"ms-winsoundevent:Notification.IM\" loop=\"true\"/></toast>");
+            CHECK(BuildPayload(Toast, false) ==
+                "<toast><visual><binding template=\"ToastImageAndText02\">"
+                "<image id=\"1\" src=\"C:\\a&amp;b.png\"/>"
+                "<text id=\"1\">Download finished</text><text id=\"2\">report.pdf</text>"
+                "</binding></visual></toast>");
+        }
+
+        void TestPayloadRejected()
+        {
+            Detail::PayloadBuilder Builder;
+            Template Toast;
+            Toast.Type = TemplateType::Text02;
+            Toast.TextFields = { "One", "Two", "Three" };
+            CHECK(!Builder.Build(Toast, true));
+            CHECK(Builder.GetFailedField() == FieldType::Text);
+            CHECK(Builder.GetFailedFieldIdx() == 2);
+
+            Toast.TextFields = { "One" };
+            Toast.Data = { { "progressValue", "0" } };
+            CHECK(!Builder.Build(Toast, true));
+            CHECK(Builder.GetFailedField() == FieldType::Tag);
+
+            Toast.Type = TemplateType(42);
+            CHECK(!Builder.Build(Toast, true));
+            CHECK(Builder.GetFailedField() == FieldType::Type);
+        }
+
+        // Toast<Type> only takes what its template has room for. These are checked when this file compiles.
+        template<class T>
+        concept AcceptsImage = requires(T& Value) { Value.SetImage(std::string()); };
+
+        template<class T, size_t Idx>
+        concept AcceptsText = requires(T& Value) { Value.template SetText<Idx>(std::string()); };
+
+        template<class T, class... Names>
+        concept AcceptsActions = requires(T& Value, Names... Actions) { Value.SetActions(Actions...); };
+
+        using Text01Toast = Toast<TemplateType::Text01>;
+        static_assert(std::is_constructible_v<Text01Toast, const char*>);
+        static_assert(!std::is_constructible_v<Text01Toast, const char*, const char*>);
+        static_assert(!std::is_constructible_v<Text01Toast>);
+        static_assert(AcceptsText<Text01Toast, 0>);
+        static_assert(!AcceptsText<Text01Toast, 1>);
+        static_assert(!AcceptsImage<Text01Toast>);
+
+        using ImageAndText04Toast = Toast<TemplateType::ImageAndText04>;
+        static_assert(std::is_constructible_v<ImageAndText04Toast, const char*, std::string, std::string_view>);
+        static_assert(!std::is_constructible_v<ImageAndText04Toast, const char*, const char*>);
+        static_assert(!std::is_constructible_v<ImageAndText04Toast, const char*, const char*, int>);
+        static_assert(AcceptsText<ImageAndText04Toast, 2>);
+        static_assert(!AcceptsText<ImageAndText04Toast, 3>);
+        static_assert(AcceptsImage<ImageAndText04Toast>);
+        static_assert(AcceptsActions<ImageAndText04Toast, const char*, const char*, const char*, const char*, const char*>);
+        static_assert(!AcceptsActions<ImageAndText04Toast, const char*, const char*, const char*, const char*, const char*, const char*>);
+
+        // A Toast builds the same payload as the Template it stands for
+        void TestSchemaToast()
+        {
+            ImageAndText04Toast Schema("One", "Two", "Three");
+            Schema.SetImage("C:\\a.png").SetActions("Open");
+            Template Toast;
+            Toast.Type = TemplateType::ImageAndText04;
+            Toast.TextFields = { "One", "Two", "Three" };
+            Toast.ImagePath = "C:\\a.png";
+            Toast.Actions = { "Open" };
+            CHECK(BuildPayload(Schema, true) == BuildPayload(Toast, true));
+            CHECK(BuildPayload(Schema, false) == BuildPayload(Toast, false));
+            CHECK(Schema.Get().TextFields.size() == ImageAndText04Toast::TextFieldCount);
+        }
+
+        // The buffer is reused, nothing of a longer payload may be left behind
+        void TestPayloadReused()
+        {
+            Detail::PayloadBuilder Builder;
+            Template Long;
+            Long.Type = TemplateType::Text04;
+            Long.TextFields = { std::string(300, 'a'), std::string(300, 'b'), std::string(300, 'c') };
+            CHECK(Builder.Build(Long, true));
+
+            Template Short;
+            Short.TextFields = { "Hi" };
+            CHECK(Builder.Build(Short, true));
+            CHECK(Builder.GetPayload() == "<toast><visual><binding template=\"ToastText01\"><text id=\"1\">Hi</text></binding></visual></toast>");
+            CHECK(Builder.GetFailedField() == FieldType::None);
+        }
+
+        constexpr int32_t Disconnected = int32_t(0x80010108); // RPC_E_DISCONNECTED
+        constexpr int32_t Unavailable = int32_t(0x800706BA); // HRESULT_FROM_WIN32(RPC_S_SERVER_UNAVAILABLE)
+
+        // Stands in for the notification platform. Objects resolved from it are its generation at the time,
+        // calls through them fail with RPC_E_DISCONNECTED once it has restarted since.
+        struct FakeActivator {
+            int Generation = 1;
+            bool Available = true;
+            int Activations = 0;
+            // Calls that got null objects
+            int NullCalls = 0;
+
+            Detail::ResolvedObjects<std::unique_ptr<int>> Create()
+            {
+                return Detail::ResolvedObjects<std::unique_ptr<int>>([this](std::unique_ptr<int>& Objects) {
+                    ++Activations;
+                    if (!Available) {
+                        return Unavailable;
+                    }
+                    Objects = std::make_unique<int>(Generation);
+                    return 0;
+                });
+            }
+
+            int32_t Use(std::unique_ptr<int>& Objects)
+            {
+                if (!Objects) {
+                    ++NullCalls;
+                    return int32_t(0x80004003); // E_POINTER
+                }
+                return *Objects == Generation ? 0 : Disconnected;
+            }
+        };
+
+        void TestResolvedOnce()
+        {
+            FakeActivator Platform;
+            auto Objects = Platform.Create();
+            CHECK(Objects.Resolve() == 0);
+            for (int Idx = 0; Idx < 100; ++Idx) {
+                CHECK(Objects.Call([&](std::unique_ptr<int>& Resolved) { return Platform.Use(Resolved); }) == 0);
+            }
+            CHECK(Platform.Activations == 1);
+
+            // Other failures don't mean the objects are dead
+            CHECK(Objects.Call([](std::unique_ptr<int>&) { return int32_t(0x80004005); }) == int32_t(0x80004005)); // E_FAIL
+            CHECK(Platform.Activations == 1);
+
+            // Neither does the backend being initialized again
+            auto Platform2 = std::make_unique<FakeBackend>();
+            auto& Fake = *Platform2;
+            WinToast Instance("WinToast.Test", std::move(Platform2));
+            CHECK(Instance.Initialize() == Error::Success);
+            CHECK(Instance.Initialize() == Error::Success);
+            Template Toast;
+            Toast.TextFields = { "Hello" };
+            for (int Idx = 0; Idx < 10; ++Idx) {
+                int64_t Id;
+                CHECK(Instance.ShowToast(Toast, {}, &Id) == Error::Success);
+                CHECK(Instance.HideToast(Id) == Error::Success);
+            }
+            CHECK(Fake.Initializations == 1);
+        }
+
+        void TestResolvedAfterDisconnect()
+        {
+            FakeActivator Platform;
+            auto Objects = Platform.Create();
+            auto Use = [&](std::unique_ptr<int>& Resolved) { return Platform.Use(Resolved); };
+            CHECK(Objects.Resolve() == 0);
+
+            // Resolved again once, and the call retried on the new objects
+            ++Platform.Generation;
+            CHECK(Objects.Call(Use) == 0);
+            CHECK(Platform.Activations == 2);
+            CHECK(Objects.Call(Use) == 0);
+            CHECK(Platform.Activations == 2);
+
+            // While the platform can't be reached the old objects stay, so calls fail rather than getting null ones
+            ++Platform.Generation;
+            Platform.Available = false;
+            CHECK(Objects.Call(Use) == Disconnected);
+            CHECK(Objects.Call(Use) == Disconnected);
+            CHECK(Platform.Activations == 4);
+            CHECK(Platform.NullCalls == 0);
+            CHECK(Objects.IsResolved());
+
+            Platform.Available = true;
+            CHECK(Objects.Call(Use) == 0);
+            CHECK(Platform.Activations == 5);
+
+            // Never resolved, the call isn't made at all
+            FakeActivator Down;
+            Down.Available = false;
+            auto Unresolved = Down.Create();
+            CHECK(Unresolved.Resolve() == Unavailable);
+            CHECK(Unresolved.Call([&](std::unique_ptr<int>& Resolved) { return Down.Use(Resolved); }) == Unavailable);
+            CHECK(Down.NullCalls == 0);
+        }
+
+        // Remembers which threads the platform was called from
+        class ThreadCheckingBackend : public FakeBackend {
+        public:
+            using FakeBackend::FakeBackend;
+
+            Error Initialize(const std::string& Aumi, const TimeSource& TimeSource) override
+            {
+                Record();
+                return FakeBackend::Initialize(Aumi, TimeSource);
+            }
+
+            int32_t Show(Notification& Notification) override
+            {
+                Record();
+                return FakeBackend::Show(Notification);
+            }
+
+            std::set<std::thread::id> GetThreads()
+            {
+                std::lock_guard Lock(Mutex);
+                return Threads;
+            }
+
+        private:
+            void Record()
+            {
+                std::lock_guard Lock(Mutex);
+                Threads.insert(std::this_thread::get_id());
+            }
+
+            std::mutex Mutex;
+            std::set<std::thread::id> Threads;
+        };
+
+        // Producers on several threads, the platform only ever called from the worker
+        void TestWorkerSubmit()
+        {
+            constexpr int Producers = 4;
+            constexpr int PerProducer = 1000;
+            Options Options;
+            Options.UseWorkerThread = true;
+            auto Platform = std::make_unique<ThreadCheckingBackend>();
+            auto& Fake = *Platform;
+            WinToast Instance("WinToast.Test", std::move(Platform), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+
+            std::atomic<int> Failed = 0;
+            Handler Handler;
+            Handler.OnFailed = [&Failed]() { ++Failed; };
+            std::vector<std::thread> Threads;
+            for (int Producer = 0; Producer < Producers; ++Producer) {
+                Threads.emplace_back([&]() {
+                    Template Toast;
+                    Toast.TextFields = { "Hello" };
+                    for (int Idx = 0; Idx < PerProducer; ++Idx) {
+                        CHECK(Instance.SubmitToast(Toast, Handler) == Error::Success);
+                    }
+                });
+            }
+            for (auto& Thread : Threads) {
+                Thread.join();
+            }
+
+            // Marshalled onto the worker behind everything submitted
+            CHECK(Instance.ClearToasts() == Error::Success);
+            CHECK(Fake.Shown == Producers * PerProducer);
+            CHECK(Failed == 0);
+            auto Callers = Fake.GetThreads();
+            CHECK(Callers.size() == 1);
+            CHECK(!Callers.contains(std::this_thread::get_id()));
+
+            auto Stats = Instance.GetWorkerStats();
+            CHECK(Stats.Submitted >= uint64_t(Producers * PerProducer));
+            CHECK(Stats.Completed + 1 >= Stats.Submitted);
+            CHECK(Stats.MaxLatencyNs >= Stats.AverageLatencyNs);
+        }
+
+        // Submitted toasts that fail to show are reported through their handler
+        void TestWorkerFailure()
+        {
+            Options Options;
+            Options.UseWorkerThread = true;
+            WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(FakeBackendConfig{ .FailureRate = 1 }), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+
+            std::atomic<int> Failed = 0;
+            Handler Handler;
+            Handler.OnFailed = [&Failed]() { ++Failed; };
+            Template Toast;
+            Toast.TextFields = { "Hello" };
+            for (int Idx = 0; Idx < 10; ++Idx) {
+                CHECK(Instance.SubmitToast(Toast, Handler) == Error::Success);
+            }
+            CHECK(Instance.ClearToasts() == Error::Success);
+            CHECK(Failed == 10);
+            CHECK(Instance.GetBufferStats().Live == 0);
+        }
+
+        // The ring keeps the last 64 failures oldest first, every third one here being a template that doesn't fit
+        void TestRecentFailures()
+        {
+            constexpr size_t Count = 70;
+            WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(FakeBackendConfig{ .FailureRate = 1 }));
+            CHECK(Instance.Initialize() == Error::Success);
+
+            Template Fits;
+            Fits.TextFields = { "Hello" };
+            Template Rejected;
+            Rejected.Type = TemplateType::Text01;
+            Rejected.TextFields = { "One", "Two" };
+            for (size_t Idx = 0; Idx < Count; ++Idx) {
+                CHECK(Instance.ShowToast(Idx % 3 ? Fits : Rejected, {}) != Error::Success);
+            }
+
+            FailureRecord Records[100];
+            auto Recent = Instance.GetRecentFailures(Records);
+            CHECK(Recent == 64);
+            for (size_t Idx = 0; Idx < Recent; ++Idx) {
+                auto& Record = Records[Idx];
+                if ((Count - Recent + Idx) % 3) {
+                    CHECK(Record.Error == Error::NotDisplayed);
+                    CHECK(Record.Failure.Stage == Stage::Show);
+                    CHECK(GetHResultName(Record.Failure.HResult) == "WPN_E_NOTIFICATION_HIDDEN");
+                }
+                else {
+                    CHECK(Record.Error == Error::ComError);
+                    CHECK(Record.Failure.Stage == Stage::Serialize);
+                    CHECK(Record.Failure.HResult == 0);
+                    CHECK(Record.Failure.Field == FieldType::Text);
+                    CHECK(Record.Failure.FieldIdx == 1);
+                }
+                CHECK(Idx == 0 || Records[Idx - 1].Time <= Record.Time);
+            }
+
+            // A shorter span gets the newest ones
+            FailureRecord Newest[2];
+            CHECK(Instance.GetRecentFailures(Newest) == 2);
+            CHECK(Newest[0].Failure.Stage == Stage::Show);
+            CHECK(Newest[1].Failure.Stage == Stage::Serialize);
+
+            auto Failures = Instance.GetStats().Failures;
+            CHECK(Failures.ByStage[size_t(Stage::Show)] == Count - Count / 3 - 1);
+            CHECK(Failures.ByStage[size_t(Stage::Serialize)] == Count / 3 + 1);
+            CHECK(Failures.ByHResultCount == 1);
+            CHECK(Failures.ByHResult[0].HResult == int32_t(0x803E0107));
+            CHECK(Failures.ByHResult[0].Count == Count - Count / 3 - 1);
+            CHECK(GetHResultName(0x12345678).empty());
+        }
+
+        // With an executor posting callbacks to a polling loop, handlers only run on that loop's thread while it
+        // drains them, never on the platform's event thread. PollEvents sees the same events.
+        void TestExecutorPollEvents()
+        {
+            constexpr size_t Count = 20;
+            std::mutex Mutex;
+            std::vector<Detail::InlineFunction<void()>> Posted;
+            Options Options;
+            Options.CallbackExecutor = [&](Detail::InlineFunction<void()>&& Callback) {
+                std::lock_guard Lock(Mutex);
+                Posted.push_back(std::move(Callback));
+            };
+            Options.EventQueueSize = Count;
+            WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(FakeBackendConfig{ .EventRate = 1, .MaxEventDelay = std::chrono::milliseconds(5) }), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+
+            std::atomic<bool> Polling = false;
+            std::thread::id Poller;
+            std::atomic<size_t> Handled = 0;
+            std::atomic<size_t> Misplaced = 0;
+            auto CheckPlacement = [&]() {
+                if (!Polling || std::this_thread::get_id() != Poller) {
+                    ++Misplaced;
+                }
+                ++Handled;
+            };
+            Handler Handler;
+            Handler.OnClicked = [&](int) { CheckPlacement(); };
+            Handler.OnDismissed = [&](DismissalReason) { CheckPlacement(); };
+            Handler.OnFailed = [&]() { CheckPlacement(); };
+
+            Template Toast;
+            Toast.TextFields = { "Hello" };
+            std::set<int64_t> Ids;
+            for (size_t Idx = 0; Idx < Count; ++Idx) {
+                int64_t Id = 0;
+                CHECK(Instance.ShowToast(Toast, Handler, &Id) == Error::Success);
+                Ids.insert(Id);
+            }
+
+            std::set<int64_t> Polled;
+            std::thread Thread([&]() {
+                Poller = std::this_thread::get_id();
+                auto Deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+                while ((Handled < Count || Polled.size() < Count) && std::chrono::steady_clock::now() < Deadline) {
+                    Event Events[8];
+                    for (auto Polls = Instance.PollEvents(Events); Polls--;) {
+                        Polled.insert(Events[Polls].Id);
+                    }
+
+                    std::vector<Detail::InlineFunction<void()>> Callbacks;
+                    {
+                        std::lock_guard Lock(Mutex);
+                        Callbacks.swap(Posted);
+                    }
+                    Polling = true;
+                    for (auto& Callback : Callbacks) {
+                        Callback();
+                    }
+                    Polling = false;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            });
+            Thread.join();
+
+            CHECK(Handled == Count);
+            CHECK(Misplaced == 0);
+            CHECK(Polled == Ids);
+            CHECK(Instance.GetDroppedEventCount() == 0);
+            CHECK(Instance.GetBufferStats().Live == 0);
+        }
+
+        // Toasts sharing only a group stack up, even within a CoalesceWindow, while a tag replaces
+        void TestGroupOnly()
+        {
+            auto Platform = std::make_unique<FakeBackend>();
+            auto& Fake = *Platform;
+            WinToast Instance("WinToast.Test", std::move(Platform));
+            CHECK(Instance.Initialize() == Error::Success);
+
+            Template Toast;
+            Toast.TextFields = { "Hello" };
+            Toast.Group = "downloads";
+            Toast.CoalesceWindow = 60000;
+            int64_t Ids[3] = {};
+            for (auto& Id : Ids) {
+                CHECK(Instance.ShowToast(Toast, {}, &Id) == Error::Success);
+            }
+            CHECK(Ids[0] != Ids[1] && Ids[1] != Ids[2] && Ids[0] != Ids[2]);
+            CHECK(Fake.Shown == 3);
+            auto Stats = Instance.GetBufferStats();
+            CHECK(Stats.Live == 3);
+            CHECK(Stats.Replaced == 0);
+            CHECK(Stats.Suppressed == 0);
+            CHECK(Instance.HideToast(Ids[0]) == Error::Success);
+            CHECK(Instance.GetBufferStats().Live == 2);
+
+            Toast.Tag = "report";
+            Toast.CoalesceWindow = 0;
+            CHECK(Instance.ShowToast(Toast, {}) == Error::Success);
+            CHECK(Instance.ShowToast(Toast, {}) == Error::Success);
+            Stats = Instance.GetBufferStats();
+            CHECK(Stats.Live == 3);
+            CHECK(Stats.Replaced == 1);
+        }
+
+        // Removed strings keep their capacity for the next element stored in their place
+        void TestFixedVectorReuse()
+        {
+            Detail::FixedVector<std::string, 2> Strings;
+            CHECK(Strings.push_back(std::string(100, 'x')));
+            auto Capacity = Strings[0].capacity();
+            Strings.clear();
+            CHECK(Strings.empty());
+
+            auto Slot = Strings.extend();
+            CHECK(Slot && Strings.size() == 1);
+            Slot->assign("short");
+            CHECK(Strings[0].capacity() == Capacity);
+            CHECK(Strings.push_back("second"));
+            CHECK(!Strings.extend() && Strings.overflowed());
+
+            Strings.pop_back();
+            auto Copy = Strings;
+            CHECK(Copy.size() == 1 && Copy[0] == "short");
+        }
+
+        // Whether Value is within the histogram's precision of Expected, half a bucket or 1/32 of the value
+        bool IsNear(uint64_t Value, uint64_t Expected)
+        {
+            auto Distance = Value > Expected ? Value - Expected : Expected - Value;
+            return Distance <= Expected / 32;
+        }
+
+        void TestHistogramBuckets()
+        {
+            using Detail::LatencyHistogram;
+            for (uint64_t Value = 0; Value < 16; ++Value) {
+                CHECK(LatencyHistogram::GetBucket(Value) == Value);
+                CHECK(LatencyHistogram::GetBucketValue(Value) == Value);
+            }
+            // Each power of two starts 16 new buckets
+            CHECK(LatencyHistogram::GetBucket(31) == 31);
+            CHECK(LatencyHistogram::GetBucket(32) == 32);
+            CHECK(LatencyHistogram::GetBucket(33) == 32);
+            CHECK(LatencyHistogram::GetBucket(34) == 33);
+            CHECK(LatencyHistogram::GetBucket(63) == 47);
+            CHECK(LatencyHistogram::GetBucket(64) == 48);
+            CHECK(LatencyHistogram::GetBucketValue(32) == 33);
+            CHECK(LatencyHistogram::GetBucketValue(48) == 66);
+
+            for (uint64_t Value = 16; Value < (uint64_t(1) << 36); Value += Value / 7 + 1) {
+                auto Bucket = LatencyHistogram::GetBucket(Value);
+                CHECK(LatencyHistogram::GetBucket(Value - 1) + 1 >= Bucket);
+                CHECK(IsNear(LatencyHistogram::GetBucketValue(Bucket), Value));
+            }
+            // Everything past ~68 seconds shares the last bucket
+            CHECK(LatencyHistogram::GetBucket(UINT64_MAX) == LatencyHistogram::GetBucket((uint64_t(1) << 36) - 1));
+            CHECK(LatencyHistogram::GetBucket(uint64_t(1) << 40) == LatencyHistogram::GetBucket(UINT64_MAX));
+        }
+
+        // Values 1 to 10000 recorded once on each of four threads merge into the same percentiles as on one
+        void TestHistogramPercentiles()
+        {
+            constexpr uint64_t Count = 10000;
+            auto Single = std::make_unique<Detail::LatencyHistogram>();
+            for (uint64_t Value = 1; Value <= Count; ++Value) {
+                Single->Record(Value);
+            }
+            auto Stats = Single->GetStats();
+            CHECK(Stats.Count == Count);
+            CHECK(Stats.MaxNs == Count);
+            CHECK(IsNear(Stats.MeanNs, Count / 2));
+            CHECK(IsNear(Stats.P50Ns, Count / 2));
+            CHECK(IsNear(Stats.P90Ns, Count * 9 / 10));
+            CHECK(IsNear(Stats.P99Ns, Count * 99 / 100));
+            CHECK(IsNear(Stats.P999Ns, Count * 999 / 1000));
+
+            auto Sharded = std::make_unique<Detail::LatencyHistogram>();
+            std::vector<std::thread> Threads;
+            for (int Idx = 0; Idx < 4; ++Idx) {
+                Threads.emplace_back([&Sharded]() {
+                    for (uint64_t Value = 1; Value <= Count; ++Value) {
+                        Sharded->Record(Value);
+                    }
+                });
+            }
+            for (auto& Thread : Threads) {
+                Thread.join();
+            }
+            auto Merged = Sharded->GetStats();
+            CHECK(Merged.Count == Count * 4);
+            CHECK(Merged.MaxNs == Stats.MaxNs);
+            CHECK(Merged.MeanNs == Stats.MeanNs);
+            CHECK(Merged.P50Ns == Stats.P50Ns);
+            CHECK(Merged.P90Ns == Stats.P90Ns);
+            CHECK(Merged.P99Ns == Stats.P99Ns);
+            CHECK(Merged.P999Ns == Stats.P999Ns);
+        }
+
+        // Byte at a time decoder to check Utf8ToUtf16 against, following the same rules
+        bool DecodeUtf8(std::string_view Input, std::u16string& Output)
+        {
+            Output.clear();
+            for (size_t Idx = 0; Idx < Input.size();) {
+                auto Lead = uint8_t(Input[Idx]);
+                size_t Count = Lead < 0x80 ? 0 : Lead >= 0xC2 && Lead < 0xE0 ? 1 : Lead >= 0xE0 && Lead < 0xF0 ? 2 : Lead >= 0xF0 && Lead < 0xF5 ? 3 : size_t(-1);
+                if (Count == size_t(-1) || Idx + Count >= Input.size() + (Count == 0)) {
+                    return false;
+                }
+                uint32_t CodePoint = Count == 0 ? Lead : Lead & (0x3F >> Count);
+                for (size_t Next = 1; Next <= Count; ++Next) {
+                    auto Byte = uint8_t(Input[Idx + Next]);
+                    if ((Byte & 0xC0) != 0x80) {
+                        return false;
+                    }
+                    CodePoint = CodePoint << 6 | (Byte & 0x3F);
+                }
+                constexpr uint32_t Smallest[] = { 0, 0x80, 0x800, 0x10000 };
+                if (CodePoint < Smallest[Count] || CodePoint > 0x10FFFF || (CodePoint >= 0xD800 && CodePoint < 0xE000)) {
+                    return false;
+                }
+                if (CodePoint >= 0x10000) {
+                    Output.push_back(char16_t(0xD800 + ((CodePoint - 0x10000) >> 10)));
+                    Output.push_back(char16_t(0xDC00 + ((CodePoint - 0x10000) & 0x3FF)));
+                }
+                else {
+                    Output.push_back(char16_t(CodePoint));
+                }
+                Idx += Count + 1;
+            }
+            return true;
+        }
+
+        // Checks both Utf8ToUtf16 overloads and GetUtf16Length against DecodeUtf8
+        void CheckUtf8(std::string_view Input)
+        {
+            std::u16string Expected;
+            bool Valid = DecodeUtf8(Input, Expected);
+            std::u16string Output(Input.size() + 1, u'\xFFFF');
+            auto Written = Detail::Utf8ToUtf16(Input, Output.data());
+            std::u16string Converted;
+            bool Converts = Detail::Utf8ToUtf16(Input, Converted);
+            if (Valid) {
+                CHECK(Written == Expected.size());
+                CHECK(Output.compare(0, Expected.size(), Expected) == 0);
+                CHECK(Output[Expected.size()] == u'\xFFFF');
+                CHECK(Converts && Converted == Expected);
+                CHECK(Detail::GetUtf16Length(Input) == Expected.size());
+            }
+            else {
+                CHECK(Written == Detail::InvalidUtf8);
+                CHECK(!Converts && Converted.empty());
+            }
+        }
+
+        // Malformed sequences are rejected wherever they appear
+        void TestUtfInvalid()
+        {
+            const std::string_view Cases[] = {
+                "\xC0\xAF",             // Overlong '/'
+                "\xC1\xBF",
+                "\xE0\x80\xAF",
+                "\xE0\x9F\xBF",         // Overlong U+07FF
+                "\xF0\x80\x80\xAF",
+                "\xF0\x8F\xBF\xBF",     // Overlong U+FFFF
+                "\xED\xA0\x80",         // U+D800
+                "\xED\xBF\xBF",         // U+DFFF
+                "\xED\xA0\xBD\xED\xB2\x81", // A surrogate pair encoded as two code points (CESU-8)
+                "\xF4\x90\x80\x80",     // U+110000
+                "\xF5\x80\x80\x80",
+                "\xFF",
+                "\xFE",
+                "\xC3",                 // Truncated
+                "\xE2\x82",
+                "\xF0\x9F\x93",
+                "\xC3\x28",             // Continuation replaced by ASCII
+                "\xE2\x28\xA1",
+                "\xF0\x9F\x28\x81",
+                "\x80",                 // Lone continuations
+                "\xBF",
+                "a\x80" "b",
+                "\xC3\xA9\xA9"
+            };
+            for (auto Case : Cases) {
+                std::u16string Unused;
+                CHECK(!DecodeUtf8(Case, Unused));
+                CheckUtf8(Case);
+                CheckUtf8(std::string("ascii before ") + std::string(Case));
+                CheckUtf8(std::string(Case) + " ascii after");
+            }
+        }
+
+        // Code points past the BMP become surrogate pairs, up to U+10FFFF
+        void TestUtfSurrogatePairs()
+        {
+            std::u16string Output;
+            CHECK(Detail::Utf8ToUtf16("\xF0\x9F\x93\x81", Output));
+            CHECK(Output == u"\U0001F4C1");
+            CHECK(Detail::Utf8ToUtf16("\xF0\x90\x80\x80" "x" "\xF4\x8F\xBF\xBF", Output));
+            CHECK(Output == u"\U00010000x\U0010FFFF");
+            CHECK(Detail::GetUtf16Length("\xF0\x9F\x93\x81\xF0\x9F\x93\x81") == 4);
+            CheckUtf8("\xF0\x9F\x93\x81 folder \xF0\x9F\x8E\x89");
+            CheckUtf8("\xEF\xBF\xBF\xF0\x90\x80\x80\xED\x9F\xBF\xEE\x80\x80");
+        }
+
+        // Nothing but continuation bytes counts as no code units, but still isn't valid
+        void TestUtfContinuationOnly()
+        {
+            for (size_t Size = 1; Size <= 40; ++Size) {
+                std::string Input(Size, '\x80');
+                CHECK(Detail::GetUtf16Length(Input) == 0);
+                CheckUtf8(Input);
+                Input.assign(Size, '\xBF');
+                CheckUtf8(Input);
+            }
+        }
+
+        // Non-ASCII just before, at and after the 16 byte blocks widened at once
+        void TestUtfBoundaries()
+        {
+            const std::string_view Inserted[] = { "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x93\x81", "\x80", "\xE2\x82" };
+            for (size_t Size : { 0, 1, 7, 8, 9, 15, 16, 17, 31, 32, 33, 47, 48, 49, 64 }) {
+                std::string Ascii;
+                for (size_t Idx = 0; Idx < Size; ++Idx) {
+                    Ascii.push_back(char('A' + Idx % 26));
+                }
+                CheckUtf8(Ascii);
+                for (auto Sequence : Inserted) {
+                    for (size_t At : { size_t(0), Size / 2, Size ? Size - 1 : 0, Size }) {
+                        auto Input = Ascii;
+                        Input.insert(At, Sequence);
+                        CheckUtf8(Input);
+                    }
+                }
+            }
+        }
+
+        // A typical toast whose strings all fit in their small buffer
+        Template CreateShortTemplate()
+        {
+            Template Toast;
+            Toast.Type = TemplateType::Text02;
+            Toast.TextFields = { "Saved", "report.pdf" };
+            Toast.Actions = { "Open", "Folder" };
+            Toast.Tag = "save";
+            return Toast;
+        }
+
+        // Holds Show back until opened, so the worker's queue can be filled up
+        class GatedBackend : public FakeBackend {
+        public:
+            int32_t Show(Notification& Notification) override
+            {
+                Open.wait(false);
+                return FakeBackend::Show(Notification);
+            }
+
+            void Release()
+            {
+                Open = true;
+                Open.notify_all();
+            }
+
+        private:
+            std::atomic<bool> Open = false;
+        };
+
+        // Building a toast and handing it to the worker doesn't allocate once the queue is warm
+        void TestAllocationSubmit()
+        {
+            constexpr int Count = 100;
+            auto Before = GetThreadAllocationCount();
+            auto Toast = CreateShortTemplate();
+            Handler Handler;
+            CHECK(GetThreadAllocationCount() == Before);
+
+            Options Options;
+            Options.UseWorkerThread = true;
+            auto Platform = std::make_unique<GatedBackend>();
+            auto& Gated = *Platform;
+            WinToast Instance("WinToast.Test", std::move(Platform), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+
+            // Warms the queue up to more than Count toasts waiting at once
+            for (int Idx = 0; Idx <= Count; ++Idx) {
+                CHECK(Instance.SubmitToast(CreateShortTemplate(), Handler) == Error::Success);
+            }
+            Gated.Release();
+            CHECK(Instance.ClearToasts() == Error::Success);
+
+            Before = GetThreadAllocationCount();
+            for (int Idx = 0; Idx < Count; ++Idx) {
+                auto Next = CreateShortTemplate();
+                CHECK(Instance.SubmitToast(std::move(Next), Handler) == Error::Success);
+            }
+            CHECK(GetThreadAllocationCount() == Before);
+            CHECK(Instance.ClearToasts() == Error::Success);
+        }
+
+        // ShowToast serializes straight from the caller's Template. Once the buffer has room, the only
+        // allocations left are the platform's notification and the block the handler's callbacks share.
+        void TestAllocationShow()
+        {
+            WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>());
+            CHECK(Instance.Initialize() == Error::Success);
+            auto Toast = CreateShortTemplate();
+            Toast.Tag.clear();
+            Handler Handler;
+            int64_t Ids[8] = {};
+            for (auto& Id : Ids) {
+                CHECK(Instance.ShowToast(Toast, Handler, &Id) == Error::Success);
+            }
+            for (auto Id : Ids) {
+                CHECK(Instance.HideToast(Id) == Error::Success);
+            }
+
+            for (auto& Id : Ids) {
+                auto Before = GetThreadAllocationCount();
+                CHECK(Instance.ShowToast(Toast, Handler, &Id) == Error::Success);
+                CHECK(GetThreadAllocationCount() - Before == 2);
+            }
+        }
+
+        // Wall clock that only moves when told to, for Options.TimeSource
+        class FakeClock {
+        public:
+            TimeSource GetSource()
+            {
+                return [this]() { return Now.load(); };
+            }
+
+            void Advance(std::chrono::milliseconds By)
+            {
+                Now = Now.load() + By;
+            }
+
+        private:
+            std::atomic<std::chrono::system_clock::time_point> Now = std::chrono::system_clock::time_point(std::chrono::hours(24 * 365 * 50));
+        };
+
+        // A handler scheduling and delivering more toasts from within DeliverScheduled
+        void TestScheduleReentrant()
+        {
+            FakeClock Clock;
+            Options Options;
+            Options.TimeSource = Clock.GetSource();
+            auto Platform = std::make_unique<FakeBackend>(FakeBackendConfig{ .FailureRate = 1 });
+            auto& Fake = *Platform;
+            WinToast Instance("WinToast.Test", std::move(Platform), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+
+            Template Toast;
+            Toast.TextFields = { "Hello" };
+            auto Now = Options.TimeSource();
+            int NestedFailed = 0;
+            Handler Nested;
+            Nested.OnFailed = [&NestedFailed]() { ++NestedFailed; };
+            int Failed = 0;
+            size_t NestedShown = 0;
+            Handler Outer;
+            Outer.OnFailed = [&]() {
+                if (++Failed == 1) {
+                    for (int Idx = 0; Idx < 8; ++Idx) {
+                        CHECK(Instance.ScheduleToast(Toast, Nested, Now) == Error::Success);
+                    }
+                    NestedShown = Instance.DeliverScheduled();
+                }
+            };
+            for (int Idx = 0; Idx < 4; ++Idx) {
+                CHECK(Instance.ScheduleToast(Toast, Outer, Now) == Error::Success);
+            }
+
+            CHECK(Instance.DeliverScheduled() == 0);
+            CHECK(NestedShown == 0);
+            CHECK(Failed == 4);
+            CHECK(NestedFailed == 8);
+            CHECK(Fake.ShowFailures == 12);
+            CHECK(Instance.DeliverScheduled() == 0);
+            CHECK(Fake.ShowFailures == 12);
+        }
+
+        // Expiration is read from Options.TimeSource, and the toast ends exactly once when it passes
+        void TestExpiryFakeClock()
+        {
+            FakeClock Clock;
+            Options Options;
+            Options.TimeSource = Clock.GetSource();
+            auto Platform = std::make_unique<FakeBackend>();
+            auto& Fake = *Platform;
+            WinToast Instance("WinToast.Test", std::move(Platform), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+
+            int TimedOut = 0;
+            int Other = 0;
+            Handler Handler;
+            Handler.OnClicked = [&Other](int) { ++Other; };
+            Handler.OnDismissed = [&](DismissalReason Reason) { ++(Reason == DismissalReason::TimedOut ? TimedOut : Other); };
+            Handler.OnFailed = [&Other]() { ++Other; };
+            Template Toast;
+            Toast.TextFields = { "Hello" };
+            Toast.Expiration = 1000;
+            int64_t Id = 0;
+            CHECK(Instance.ShowToast(Toast, Handler, &Id) == Error::Success);
+            // The platform's copy of the handler, which outlives the toast
+            auto Events = Fake.LastShown->Handler;
+
+            Clock.Advance(std::chrono::milliseconds(999));
+            CHECK(Instance.SweepExpired() == 0);
+            CHECK(Instance.GetBufferStats().Live == 1);
+            CHECK(TimedOut == 0);
+
+            Clock.Advance(std::chrono::milliseconds(1));
+            CHECK(Instance.SweepExpired() == 1);
+            CHECK(TimedOut == 1);
+            CHECK(Fake.Hidden == 1);
+            auto Stats = Instance.GetBufferStats();
+            CHECK(Stats.Live == 0);
+            CHECK(Stats.Expired == 1);
+
+            // Whatever the platform raises afterwards, including the dismissal for the hide, is dropped
+            Events.OnDismissed(DismissalReason::ApplicationHidden);
+            Events.OnClicked(0);
+            Clock.Advance(std::chrono::milliseconds(60000));
+            CHECK(Instance.SweepExpired() == 0);
+            CHECK(TimedOut == 1);
+            CHECK(Other == 0);
+            CHECK(Instance.HideToast(Id) == Error::IdNotFound);
+        }
+
+        // Normal toasts flood the instance from several threads while the main thread shows a high
+        // priority toast every few milliseconds, returning the slowest of those. Needs the worker thread.
+        std::chrono::nanoseconds FloodWithHighPriority(WinToast& Instance, int& HighFailed)
+        {
+            std::atomic<bool> Stop = false;
+            std::vector<std::thread> Producers;
+            for (int Producer = 0; Producer < 3; ++Producer) {
+                Producers.emplace_back([&]() {
+                    Template Toast;
+                    Toast.TextFields = { "Normal" };
+                    while (!Stop) {
+                        Instance.ShowToast(Toast, {});
+                    }
+                });
+            }
+
+            Template Urgent;
+            Urgent.TextFields = { "High" };
+            Urgent.Priority = Priority::High;
+            std::chrono::nanoseconds Slowest{ 0 };
+            for (int Idx = 0; Idx < 50; ++Idx) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(4));
+                auto Start = std::chrono::steady_clock::now();
+                HighFailed += Instance.ShowToast(Urgent, {}) != Error::Success;
+                Slowest = std::max(Slowest, std::chrono::steady_clock::now() - Start);
+            }
+
+            Stop = true;
+            for (auto& Producer : Producers) {
+                Producer.join();
+            }
+            return Slowest;
+        }
+
+        // Past MaxInFlight, normal toasts are shed while high priority ones displace them and are never refused
+        void TestAdmissionDropLowest()
+        {
+            Options Options;
+            Options.UseWorkerThread = true;
+            Options.MaxInFlight = 16;
+            Options.AdmissionPolicy = AdmissionPolicy::DropLowest;
+            // Every toast finishes on its own within 5ms, so the high priority ones don't pile up
+            WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(FakeBackendConfig{ .EventRate = 1, .MaxEventDelay = std::chrono::milliseconds(5) }), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+
+            int HighFailed = 0;
+            auto Slowest = FloodWithHighPriority(Instance, HighFailed);
+            CHECK(HighFailed == 0);
+            CHECK(Slowest < std::chrono::milliseconds(250));
+
+            auto Stats = Instance.GetStats();
+            CHECK(Stats.Buffer.Live <= Options.MaxInFlight);
+            CHECK(Stats.Admission.Shed > 0);
+            CHECK(Stats.Admission.Displaced > 0);
+            CHECK(Stats.Admission.Queued == 0);
+            CHECK(Stats.Admission.Waiting == 0);
+        }
+
+        // Waiting producers of normal toasts don't hold back a high priority one, which takes the next free slot
+        void TestAdmissionBlock()
+        {
+            Options Options;
+            Options.UseWorkerThread = true;
+            Options.MaxInFlight = 4;
+            Options.AdmissionPolicy = AdmissionPolicy::Block;
+            Options.AdmissionTimeout = 5000;
+            // Every toast finishes on its own within 5ms, freeing its slot
+            WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(FakeBackendConfig{ .EventRate = 1, .MaxEventDelay = std::chrono::milliseconds(5) }), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+
+            int HighFailed = 0;
+            auto Slowest = FloodWithHighPriority(Instance, HighFailed);
+            CHECK(HighFailed == 0);
+            // Far below the 5s a normal toast may wait
+            CHECK(Slowest < std::chrono::milliseconds(250));
+
+            auto Stats = Instance.GetStats();
+            CHECK(Stats.Admission.Queued > 0);
+            CHECK(Stats.Admission.Shed == 0);
+            CHECK(Stats.Admission.Displaced == 0);
+            CHECK(Stats.Admission.Waiting == 0);
+            CHECK(Stats.Admission.Admitted >= 50);
+        }
+
+        // A toast that fails to show in a batch gets its own error, and leaves neither an entry nor a slot behind
+        void TestBatchPartialFailure()
+        {
+            Options Options;
+            Options.MaxInFlight = 16;
+            Options.AdmissionPolicy = AdmissionPolicy::Block;
+            auto Platform = std::make_unique<FakeBackend>(FakeBackendConfig{ .FailureRate = 0.5, .Seed = 7 });
+            auto& Fake = *Platform;
+            WinToast Instance("WinToast.Test", std::move(Platform), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+
+            std::vector<Template> Toasts(Options.MaxInFlight);
+            for (auto& Toast : Toasts) {
+                Toast.TextFields = { "Hello" };
+            }
+            std::vector<ToastResult> Results(Toasts.size());
+            CHECK(Instance.ShowToasts(Toasts, Handler{}, Results) == Error::Success);
+
+            size_t Shown = 0;
+            std::set<int64_t> Ids;
+            for (auto& Result : Results) {
+                if (Result.Error == Error::Success) {
+                    ++Shown;
+                    CHECK(Result.Id != 0);
+                    Ids.insert(Result.Id);
+                }
+                else {
+                    CHECK(Result.Error == Error::NotDisplayed);
+                    CHECK(Result.Id == 0);
+                    CHECK(Result.Failure.Stage == Stage::Show);
+                    CHECK(GetHResultName(Result.Failure.HResult) == "WPN_E_NOTIFICATION_HIDDEN");
+                }
+            }
+            CHECK(Shown > 0 && Shown < Toasts.size());
+            CHECK(Ids.size() == Shown);
+            CHECK(Fake.Shown == Shown);
+            CHECK(Fake.ShowFailures == Toasts.size() - Shown);
+
+            auto Stats = Instance.GetStats();
+            CHECK(Stats.Buffer.Live == Shown);
+            CHECK(Stats.Admission.Admitted == Toasts.size());
+            CHECK(Stats.Admission.Shed == 0);
+            CHECK(Stats.Failures.ByStage[size_t(Stage::Show)] == Toasts.size() - Shown);
+            CHECK(Stats.Stages[size_t(Stage::ShowToast)].Count == Toasts.size());
+
+            // Only the shown toasts hold slots, so exactly the rest can still be admitted
+            size_t Admitted = 0;
+            while (Instance.GetBufferStats().Live < Options.MaxInFlight && Admitted < 1000) {
+                ToastResult Result;
+                Instance.ShowToast(Toasts[0], Handler{}, Result);
+                CHECK(Result.Error != Error::Overloaded);
+                ++Admitted;
+            }
+            ToastResult Refused;
+            CHECK(Instance.ShowToast(Toasts[0], Handler{}, Refused) == Error::Overloaded);
+        }
+
+        // A journal file in the temp directory, removed along with what compacting it leaves behind
+        class TempJournal {
+        public:
+            TempJournal(const char* Name) :
+                Path(std::filesystem::temp_directory_path() / Name)
+            {
+                Remove();
+            }
+
+            ~TempJournal()
+            {
+                Remove();
+            }
+
+            std::string GetPath() const
+            {
+                return Path.string();
+            }
+
+            std::string GetTempPath() const
+            {
+                return Path.string() + ".tmp";
+            }
+
+            std::string Read() const
+            {
+                std::ifstream File(Path, std::ios::binary);
+                return std::string(std::istreambuf_iterator<char>(File), {});
+            }
+
+            void Write(std::string_view Contents) const
+            {
+                std::ofstream File(Path, std::ios::binary | std::ios::trunc);
+                File.write(Contents.data(), std::streamsize(Contents.size()));
+            }
+
+        private:
+            void Remove()
+            {
+                std::error_code Ignored;
+                std::filesystem::remove(Path, Ignored);
+                std::filesystem::remove_all(GetTempPath(), Ignored);
+            }
+
+            std::filesystem::path Path;
+        };
+
+        Template CreateTaggedTemplate(std::string Tag, std::string Group)
+        {
+            Template Toast;
+            Toast.TextFields = { "Hello" };
+            Toast.Tag = std::move(Tag);
+            Toast.Group = std::move(Group);
+            return Toast;
+        }
+
+        // Tagged toasts still displayed when an instance goes away come back under their ids in the next one
+        void TestJournalRecovery()
+        {
+            TempJournal Journal("WinToast_test_recovery.journal");
+            Options Options;
+            Options.JournalPath = Journal.GetPath();
+            int64_t First = 0, Second = 0, Third = 0, Untagged = 0;
+            {
+                WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(), Options);
+                CHECK(Instance.Initialize() == Error::Success);
+                CHECK(Instance.ShowToast(CreateTaggedTemplate("first", "inbox"), {}, &First) == Error::Success);
+                CHECK(Instance.ShowToast(CreateTaggedTemplate("second", "inbox"), {}, &Second) == Error::Success);
+                CHECK(Instance.ShowToast(CreateTaggedTemplate("third", ""), {}, &Third) == Error::Success);
+                CHECK(Instance.ShowToast(CreateTaggedTemplate("", "inbox"), {}, &Untagged) == Error::Success);
+                CHECK(Instance.HideToast(Second) == Error::Success);
+            }
+
+            {
+                auto Platform = std::make_unique<FakeBackend>();
+                auto& Fake = *Platform;
+                WinToast Instance("WinToast.Test", std::move(Platform), Options);
+                CHECK(Instance.Initialize() == Error::Success);
+                RecoveredToast Recovered[4];
+                CHECK(Instance.GetRecoveredToasts(Recovered) == 2);
+                CHECK(Recovered[0].Id == First && Recovered[0].Tag == "first" && Recovered[0].Group == "inbox");
+                CHECK(Recovered[1].Id == Third && Recovered[1].Tag == "third" && Recovered[1].Group.empty());
+                CHECK(Instance.GetBufferStats().Live == 2);
+
+                // New ids don't collide with the recovered ones
+                int64_t Fourth = 0;
+                CHECK(Instance.ShowToast(CreateTaggedTemplate("fourth", ""), {}, &Fourth) == Error::Success);
+                CHECK(Fourth != First && Fourth != Third);
+                CHECK(Instance.HideToast(First) == Error::Success);
+                CHECK(Fake.Hidden == 1);
+                CHECK(Instance.HideToast(Untagged) == Error::IdNotFound);
+            }
+
+            WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+            RecoveredToast Recovered[4];
+            CHECK(Instance.GetRecoveredToasts(Recovered) == 2);
+            CHECK(Recovered[0].Id == Third);
+            CHECK(Recovered[1].Tag == "fourth");
+            CHECK(Instance.GetStats().Failures.ByStage[size_t(Stage::Journal)] == 0);
+        }
+
+        // A record torn by a crash is dropped with everything after it, and appending carries on over it
+        void TestJournalTornTail()
+        {
+            TempJournal Journal("WinToast_test_torn.journal");
+            Options Options;
+            Options.JournalPath = Journal.GetPath();
+            int64_t First = 0;
+            {
+                WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(), Options);
+                CHECK(Instance.Initialize() == Error::Success);
+                CHECK(Instance.ShowToast(CreateTaggedTemplate("first", ""), {}, &First) == Error::Success);
+                CHECK(Instance.ShowToast(CreateTaggedTemplate("second", ""), {}, nullptr) == Error::Success);
+            }
+
+            auto Contents = Journal.Read();
+            auto Torn = Contents.find("second");
+            CHECK(Torn != std::string::npos);
+            if (Torn == std::string::npos) {
+                return;
+            }
+            Contents[Torn] = 'S';
+            Journal.Write(Contents);
+
+            {
+                WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(), Options);
+                CHECK(Instance.Initialize() == Error::Success);
+                RecoveredToast Recovered[4];
+                CHECK(Instance.GetRecoveredToasts(Recovered) == 1);
+                CHECK(Recovered[0].Id == First && Recovered[0].Tag == "first");
+                CHECK(Instance.ShowToast(CreateTaggedTemplate("third", ""), {}, nullptr) == Error::Success);
+            }
+
+            WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+            RecoveredToast Recovered[4];
+            CHECK(Instance.GetRecoveredToasts(Recovered) == 2);
+            CHECK(Recovered[0].Tag == "first");
+            CHECK(Recovered[1].Tag == "third");
+        }
+
+        // A file at JournalPath that isn't a journal is left alone, an empty one is taken over
+        void TestJournalForeignFile()
+        {
+            TempJournal Journal("WinToast_test_foreign.journal");
+            Options Options;
+            Options.JournalPath = Journal.GetPath();
+            const std::string Foreign = "Not a journal, but someone's data\n";
+            Journal.Write(Foreign);
+            {
+                WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(), Options);
+                CHECK(Instance.Initialize() == Error::JournalFailed);
+            }
+            CHECK(Journal.Read() == Foreign);
+
+            Journal.Write("");
+            WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+            CHECK(Journal.Read().starts_with("WTJOURNL"));
+        }
+
+        // Filling the journal compacts it, and a compaction that can't be written is reported
+        // while the journal carries on in the old file
+        void TestJournalCompaction()
+        {
+            TempJournal Journal("WinToast_test_compaction.journal");
+            Options Options;
+            Options.JournalPath = Journal.GetPath();
+            Options.JournalSize = 0;
+            int64_t Kept = 0;
+            {
+                WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(), Options);
+                CHECK(Instance.Initialize() == Error::Success);
+                CHECK(Instance.ShowToast(CreateTaggedTemplate("kept", ""), {}, &Kept) == Error::Success);
+                for (int Idx = 0; Idx < 1000; ++Idx) {
+                    int64_t Id = 0;
+                    CHECK(Instance.ShowToast(CreateTaggedTemplate("churn", ""), {}, &Id) == Error::Success);
+                    CHECK(Instance.HideToast(Id) == Error::Success);
+                }
+                CHECK(Instance.GetStats().Failures.ByStage[size_t(Stage::Journal)] == 0);
+
+                // The temporary file can't be created where a directory is in the way
+                std::filesystem::create_directory(Journal.GetTempPath());
+                uint64_t Failed = 0;
+                for (int Idx = 0; Idx < 1000 && !Failed; ++Idx) {
+                    int64_t Id = 0;
+                    CHECK(Instance.ShowToast(CreateTaggedTemplate("churn", ""), {}, &Id) == Error::Success);
+                    CHECK(Instance.HideToast(Id) == Error::Success);
+                    Failed = Instance.GetStats().Failures.ByStage[size_t(Stage::Journal)];
+                }
+                CHECK(Failed > 0);
+                std::filesystem::remove(Journal.GetTempPath());
+
+                CHECK(Instance.ShowToast(CreateTaggedTemplate("later", ""), {}, nullptr) == Error::Success);
+            }
+
+            WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+            RecoveredToast Recovered[4];
+            CHECK(Instance.GetRecoveredToasts(Recovered) == 2);
+            CHECK(Recovered[0].Id == Kept);
+            CHECK(Recovered[1].Tag == "later");
+        }
+
+        // The worker compacts a journal that's filling up while idle, before ShowToast would find it full
+        void TestJournalIdleCompaction()
+        {
+            constexpr int Count = 800;
+            TempJournal Journal("WinToast_test_idle_compaction.journal");
+            Options Options;
+            Options.UseWorkerThread = true;
+            Options.JournalPath = Journal.GetPath();
+            // 72 bytes of records per toast shown and hidden, so Count of them fill it past three quarters but not up
+            Options.JournalSize = 1 << 16;
+            WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+            int64_t Kept = 0;
+            CHECK(Instance.ShowToast(CreateTaggedTemplate("kept", ""), {}, &Kept) == Error::Success);
+            for (int Idx = 0; Idx < Count; ++Idx) {
+                int64_t Id = 0;
+                CHECK(Instance.ShowToast(CreateTaggedTemplate("churn", ""), {}, &Id) == Error::Success);
+                CHECK(Instance.HideToast(Id) == Error::Success);
+            }
+
+            auto CountChurned = [&Journal]() {
+                auto Contents = Journal.Read();
+                size_t Found = 0;
+                for (auto Pos = Contents.find("churn"); Pos != std::string::npos; Pos = Contents.find("churn", Pos + 1)) {
+                    ++Found;
+                }
+                return Found;
+            };
+            auto Deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (CountChurned() >= Count / 4 && std::chrono::steady_clock::now() < Deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            CHECK(CountChurned() < Count / 4);
+            CHECK(Journal.Read().find("kept") != std::string::npos);
+            CHECK(Instance.GetStats().Failures.ByStage[size_t(Stage::Journal)] == 0);
+        }
+
+        // ClearGroup removes every toast of the group, however many share it without a tag
+        void TestClearGroupUntagged()
+        {
+            constexpr int Count = 50;
+            auto Platform = std::make_unique<FakeBackend>();
+            auto& Fake = *Platform;
+            WinToast Instance("WinToast.Test", std::move(Platform));
+            CHECK(Instance.Initialize() == Error::Success);
+
+            std::vector<int64_t> Members;
+            for (int Idx = 0; Idx < Count; ++Idx) {
+                CHECK(Instance.ShowToast(CreateTaggedTemplate("", "downloads"), {}, &Members.emplace_back()) == Error::Success);
+            }
+            CHECK(Instance.ShowToast(CreateTaggedTemplate("report", "downloads"), {}, &Members.emplace_back()) == Error::Success);
+            int64_t Others[3] = {};
+            CHECK(Instance.ShowToast(CreateTaggedTemplate("", "uploads"), {}, &Others[0]) == Error::Success);
+            CHECK(Instance.ShowToast(CreateTaggedTemplate("", ""), {}, &Others[1]) == Error::Success);
+            CHECK(Instance.ShowToast(CreateTaggedTemplate("report", ""), {}, &Others[2]) == Error::Success);
+            CHECK(Instance.GetBufferStats().Live == Count + 4);
+
+            CHECK(Instance.ClearGroup("downloads") == Error::Success);
+            CHECK(Fake.Cleared == 1);
+            CHECK(Instance.GetBufferStats().Live == 3);
+            for (auto Id : Members) {
+                CHECK(Instance.HideToast(Id) == Error::IdNotFound);
+            }
+            for (auto Id : Others) {
+                CHECK(Instance.HideToast(Id) == Error::Success);
+            }
+            CHECK(Instance.ClearGroup("downloads") == Error::Success);
+            CHECK(Instance.GetBufferStats().Live == 0);
+        }
+
+        // Past MaxBufferSize or MaxBufferBytes the least recently shown toast is forgotten. A late event for it
+        // doesn't count as finished, while one for a toast still remembered does.
+        void TestBufferEviction()
+        {
+            Template Toast;
+            Toast.TextFields = { "Hello" };
+
+            {
+                Options Options;
+                Options.MaxBufferSize = 3;
+                auto Platform = std::make_unique<FakeBackend>();
+                auto& Fake = *Platform;
+                WinToast Instance("WinToast.Test", std::move(Platform), Options);
+                CHECK(Instance.Initialize() == Error::Success);
+
+                int64_t Ids[4] = {};
+                Handler Oldest;
+                for (auto& Id : Ids) {
+                    CHECK(Instance.ShowToast(Toast, {}, &Id) == Error::Success);
+                    if (&Id == &Ids[0]) {
+                        Oldest = Fake.LastShown->Handler;
+                    }
+                }
+                auto Stats = Instance.GetBufferStats();
+                CHECK(Stats.Live == 3);
+                CHECK(Stats.Evicted == 1);
+                CHECK(Stats.Finished == 0);
+                CHECK(Instance.HideToast(Ids[0]) == Error::IdNotFound);
+
+                Oldest.OnDismissed(DismissalReason::UserCanceled);
+                CHECK(Instance.GetBufferStats().Finished == 0);
+                Fake.LastShown->Handler.OnDismissed(DismissalReason::UserCanceled);
+                Stats = Instance.GetBufferStats();
+                CHECK(Stats.Live == 2);
+                CHECK(Stats.Finished == 1);
+                CHECK(Instance.HideToast(Ids[3]) == Error::IdNotFound);
+
+                // The finished toast freed its place, so only the second new one evicts
+                CHECK(Instance.ShowToast(Toast, {}) == Error::Success);
+                CHECK(Instance.GetBufferStats().Evicted == 1);
+                CHECK(Instance.ShowToast(Toast, {}) == Error::Success);
+                CHECK(Instance.GetBufferStats().Evicted == 2);
+                CHECK(Instance.HideToast(Ids[1]) == Error::IdNotFound);
+                CHECK(Instance.HideToast(Ids[2]) == Error::Success);
+            }
+
+            size_t Bytes = 0;
+            {
+                WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>());
+                CHECK(Instance.Initialize() == Error::Success);
+                CHECK(Instance.ShowToast(Toast, {}) == Error::Success);
+                Bytes = Instance.GetBufferStats().LiveBytes;
+                CHECK(Bytes > 0);
+            }
+
+            Options Options;
+            Options.MaxBufferBytes = Bytes * 2 + Bytes / 2;
+            WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>(), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+            int64_t Ids[3] = {};
+            for (auto& Id : Ids) {
+                CHECK(Instance.ShowToast(Toast, {}, &Id) == Error::Success);
+            }
+            auto Stats = Instance.GetBufferStats();
+            CHECK(Stats.Live == 2);
+            CHECK(Stats.LiveBytes == Bytes * 2);
+            CHECK(Stats.Evicted == 1);
+            CHECK(Instance.HideToast(Ids[0]) == Error::IdNotFound);
+            CHECK(Instance.HideToast(Ids[1]) == Error::Success);
+            CHECK(Instance.HideToast(Ids[2]) == Error::Success);
+        }
+
+        // Remembers every update sent to the platform
+        class UpdateRecordingBackend : public FakeBackend {
+        public:
+            struct SentUpdate {
+                uint32_t SequenceNumber;
+                std::vector<DataField> Data;
+            };
+
+            int32_t Update(std::string_view Tag, std::string_view Group, std::span<const DataField> Data, uint32_t SequenceNumber) override
+            {
+                {
+                    std::lock_guard Lock(Mutex);
+                    Sent.push_back({ SequenceNumber, std::vector<DataField>(Data.begin(), Data.end()) });
+                }
+                return FakeBackend::Update(Tag, Group, Data, SequenceNumber);
+            }
+
+            std::vector<SentUpdate> GetSent()
+            {
+                std::lock_guard Lock(Mutex);
+                return Sent;
+            }
+
+        private:
+            std::mutex Mutex;
+            std::vector<SentUpdate> Sent;
+        };
+
+        std::string_view FindValue(const std::vector<DataField>& Data, std::string_view Key)
+        {
+            for (auto& Field : Data) {
+                if (Field.Key == Key) {
+                    return Field.Value;
+                }
+            }
+            return "<missing>";
+        }
+
+        bool IsIncreasing(const std::vector<UpdateRecordingBackend::SentUpdate>& Sent)
+        {
+            for (size_t Idx = 1; Idx < Sent.size(); ++Idx) {
+                if (Sent[Idx - 1].SequenceNumber >= Sent[Idx].SequenceNumber) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Updates within MinUpdateInterval of the last one sent are merged into one carrying the latest values,
+        // sent by FlushUpdates. Without a worker thread, a due update is sent on the calling thread.
+        void TestUpdateThrottled()
+        {
+            Options Options;
+            Options.MinUpdateInterval = 60000;
+            auto Platform = std::make_unique<UpdateRecordingBackend>();
+            auto& Fake = *Platform;
+            WinToast Instance("WinToast.Test", std::move(Platform), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+            int64_t Id = 0;
+            CHECK(Instance.ShowToast(CreateTaggedTemplate("job", ""), {}, &Id) == Error::Success);
+
+            // The first one is due right away
+            CHECK(Instance.UpdateToast(Id, { { "progressValue", "0.1" } }) == Error::Success);
+            CHECK(Fake.Updated == 1);
+            CHECK(Instance.UpdateToast(Id, { { "progressValue", "0.2" }, { "progressStatus", "Copying" } }) == Error::Success);
+            CHECK(Instance.UpdateToast(Id, { { "progressValue", "0.3" } }) == Error::Success);
+            CHECK(Instance.UpdateToast(Id, { { "progressValue", "0.4" } }) == Error::Success);
+            CHECK(Fake.Updated == 1);
+
+            CHECK(Instance.FlushUpdates() == Error::Success);
+            CHECK(Fake.Updated == 2);
+            auto Sent = Fake.GetSent();
+            CHECK(Sent.size() == 2);
+            CHECK(FindValue(Sent[0].Data, "progressValue") == "0.1");
+            CHECK(FindValue(Sent[1].Data, "progressValue") == "0.4");
+            CHECK(FindValue(Sent[1].Data, "progressStatus") == "Copying");
+
+            // Numbered updates older than the last one are dropped, nothing is left to flush
+            CHECK(Instance.UpdateToast(Id, { { "progressValue", "0.9" } }, 100) == Error::Success);
+            CHECK(Instance.UpdateToast(Id, { { "progressValue", "0.5" } }, 50) == Error::Success);
+            CHECK(Instance.FlushUpdates() == Error::Success);
+            CHECK(Instance.FlushUpdates() == Error::Success);
+            Sent = Fake.GetSent();
+            CHECK(Sent.size() == 3);
+            CHECK(Sent.size() == 3 && Sent[2].SequenceNumber == 100 && FindValue(Sent[2].Data, "progressValue") == "0.9");
+            CHECK(IsIncreasing(Sent));
+
+            auto Stats = Instance.GetStats().Updates;
+            CHECK(Stats.Received == 5);
+            CHECK(Stats.Sent == 3);
+            CHECK(Stats.Stale == 1);
+        }
+
+        // A producer updating in a tight loop only gets a few updates through the worker, the last one with its final values
+        void TestUpdateWorker()
+        {
+            constexpr int Count = 10000;
+            Options Options;
+            Options.UseWorkerThread = true;
+            Options.MinUpdateInterval = 50;
+            auto Platform = std::make_unique<UpdateRecordingBackend>();
+            auto& Fake = *Platform;
+            WinToast Instance("WinToast.Test", std::move(Platform), Options);
+            CHECK(Instance.Initialize() == Error::Success);
+            int64_t Id = 0;
+            CHECK(Instance.ShowToast(CreateTaggedTemplate("job", ""), {}, &Id) == Error::Success);
+
+            auto Start = std::chrono::steady_clock::now();
+            for (int Idx = 1; Idx <= Count; ++Idx) {
+                auto Value = std::to_string(Idx);
+                CHECK(Instance.UpdateToast(Id, { { "progressValue", Value } }) == Error::Success);
+            }
+            auto Elapsed = std::chrono::steady_clock::now() - Start;
+            CHECK(Instance.FlushUpdates() == Error::Success);
+
+            auto Sent = Fake.GetSent();
+            CHECK(!Sent.empty());
+            CHECK(Sent.size() <= size_t(Elapsed / std::chrono::milliseconds(Options.MinUpdateInterval)) + 2);
+            CHECK(IsIncreasing(Sent));
+            CHECK(!Sent.empty() && Sent.back().SequenceNumber == Count && FindValue(Sent.back().Data, "progressValue") == std::to_string(Count));
+        }
+
+        // Keeps its own copy of each toast's handler, like the platform's event sinks, and can raise an event
+        // from within Show before failing it
+        class LateEventBackend : public FakeBackend {
+        public:
+            LateEventBackend(bool RaiseInShow) :
+                FakeBackend(FakeBackendConfig{ .FailureRate = 1 }),
+                RaiseInShow(RaiseInShow)
+            {
+
+            }
+
+            int32_t RegisterHandler(Notification& Notification, WinToastLib::Handler&& Handler) override
+            {
+                Kept = Handler;
+                return FakeBackend::RegisterHandler(Notification, std::move(Handler));
+            }
+
+            int32_t Show(Notification& Notification) override
+            {
+                if (RaiseInShow) {
+                    Kept.OnFailed();
+                }
+                return FakeBackend::Show(Notification);
+            }
+
+            WinToastLib::Handler Kept;
+
+        private:
+            bool RaiseInShow;
+        };
+
+        // Fire and forget coroutine, enough to drive ShowToastAsync
+        struct Workflow {
+            struct promise_type {
+                Workflow get_return_object() noexcept
+                {
+                    return {};
+                }
+
+                std::suspend_never initial_suspend() noexcept
+                {
+                    return {};
+                }
+
+                std::suspend_never final_suspend() noexcept
+                {
+                    return {};
+                }
+
+                void return_void() noexcept
+                {
+
+                }
+
+                void unhandled_exception() noexcept
+                {
+                    std::terminate();
+                }
+            };
+        };
+
+        Workflow AwaitToast(WinToast& Instance, const Template& Toast, std::vector<ToastOutcome>& Outcomes)
+        {
+            Outcomes.push_back(co_await Instance.ShowToastAsync(Toast));
+        }
+
+        bool IsFailure(const ToastOutcome& Outcome, Error Expected)
+        {
+            auto Failed = std::get_if<ToastFailed>(&Outcome);
+            return Failed && Failed->Error == Expected;
+        }
+
+        // Once showing fails, events the platform raises afterwards don't reach the handler or awaiter
+        void TestShowFailedLateEvent()
+        {
+            auto Platform = std::make_unique<LateEventBackend>(false);
+            auto& Fake = *Platform;
+            WinToast Instance("WinToast.Test", std::move(Platform));
+            CHECK(Instance.Initialize() == Error::Success);
+            Template Toast;
+            Toast.TextFields = { "Hello" };
+
+            int Events = 0;
+            Handler Handler;
+            Handler.OnClicked = [&Events](int) { ++Events; };
+            Handler.OnDismissed = [&Events](DismissalReason) { ++Events; };
+            Handler.OnFailed = [&Events]() { ++Events; };
+            ToastResult Result;
+            CHECK(Instance.ShowToast(Toast, Handler, Result) == Error::NotDisplayed);
+            CHECK(Result.Id == 0 && Result.Failure.Stage == Stage::Show);
+            Fake.Kept.OnFailed();
+            Fake.Kept.OnDismissed(DismissalReason::UserCanceled);
+            CHECK(Events == 0);
+
+            // The awaiting coroutine has finished and its frame is gone by the time the late event arrives
+            std::vector<ToastOutcome> Outcomes;
+            AwaitToast(Instance, Toast, Outcomes);
+            CHECK(Outcomes.size() == 1);
+            CHECK(Outcomes.size() == 1 && IsFailure(Outcomes[0], Error::NotDisplayed));
+            Fake.Kept.OnClicked(0);
+            Fake.Kept.OnFailed();
+            CHECK(Outcomes.size() == 1);
+            CHECK(Instance.GetBufferStats().Live == 0);
+        }
+
+        // An event raised before showing fails is the toast's only outcome
+        void TestShowFailedAfterEvent()
+        {
+            auto Platform = std::make_unique<LateEventBackend>(true);
+            auto& Fake = *Platform;
+            WinToast Instance("WinToast.Test", std::move(Platform));
+            CHECK(Instance.Initialize() == Error::Success);
+            Template Toast;
+            Toast.TextFields = { "Hello" };
+
+            int Failed = 0;
+            Handler Handler;
+            Handler.OnFailed = [&Failed]() { ++Failed; };
+            CHECK(Instance.ShowToast(Toast, Handler) == Error::Success);
+            CHECK(Failed == 1);
+            Fake.Kept.OnFailed();
+            CHECK(Failed == 1);
+
+            std::vector<ToastOutcome> Outcomes;
+            AwaitToast(Instance, Toast, Outcomes);
+            CHECK(Outcomes.size() == 1 && IsFailure(Outcomes[0], Error::NotDisplayed));
+            Fake.Kept.OnFailed();
+            CHECK(Outcomes.size() == 1);
+            CHECK(Instance.GetBufferStats().Live == 0);
+            CHECK(Instance.GetStats().Failures.ByStage[size_t(Stage::Show)] == 2);
+        }
+
+        // Just enough of a JSON parser to tell whether Text is one well-formed value
+        class JsonChecker {
+        public:
+            static bool IsValid(std::string_view Text)
+            {
+                JsonChecker Checker(Text);
+                return Checker.Value() && (Checker.SkipSpace(), Checker.Pos == Text.size());
+            }
+
+        private:
+            JsonChecker(std::string_view Text) :
+                Text(Text),
+                Pos(0)
+            {
+
+            }
+
+            std::string_view Text;
+            size_t Pos;
+
+            void SkipSpace()
+            {
+                while (Pos < Text.size() && (Text[Pos] == ' ' || Text[Pos] == '\n' || Text[Pos] == '\r' || Text[Pos] == '\t')) {
+                    ++Pos;
+                }
+            }
+
+            bool Take(char Expected)
+            {
+                SkipSpace();
+                if (Pos < Text.size() && Text[Pos] == Expected) {
+                    ++Pos;
+                    return true;
+                }
+                return false;
+            }
+
+            bool String()
+            {
+                if (!Take('"')) {
+                    return false;
+                }
+                while (Pos < Text.size() && Text[Pos] != '"') {
+                    if (uint8_t(Text[Pos]) < 0x20) {
+                        return false;
+                    }
+                    Pos += Text[Pos] == '\\' ? 2 : 1;
+                }
+                return Pos++ < Text.size();
+            }
+
+            bool Number()
+            {
+                auto Start = Pos;
+                Pos += Pos < Text.size() && Text[Pos] == '-';
+                while (Pos < Text.size() && (isdigit(uint8_t(Text[Pos])) || Text[Pos] == '.' || Text[Pos] == 'e' || Text[Pos] == 'E' || Text[Pos] == '+' || Text[Pos] == '-')) {
+                    ++Pos;
+                }
+                return Pos > Start;
+            }
+
+            bool Value()
+            {
+                SkipSpace();
+                if (Pos == Text.size()) {
+                    return false;
+                }
+                switch (Text[Pos])
+                {
+                case '{':
+                    ++Pos;
+                    if (Take('}')) {
+                        return true;
+                    }
+                    do {
+                        if (!String() || !Take(':') || !Value()) {
+                            return false;
+                        }
+                    } while (Take(','));
+                    return Take('}');
+                case '[':
+                    ++Pos;
+                    if (Take(']')) {
+                        return true;
+                    }
+                    do {
+                        if (!Value()) {
+                            return false;
+                        }
+                    } while (Take(','));
+                    return Take(']');
+                case '"':
+                    return String();
+                default:
+                    for (std::string_view Literal : { "true", "false", "null" }) {
+                        if (Text.substr(Pos).starts_with(Literal)) {
+                            Pos += Literal.size();
+                            return true;
+                        }
+                    }
+                    return Number();
+                }
+            }
+        };
+
+        // Counts the exported events with the given phase, and name if there is one. Every event is on its own line.
+        size_t CountTraceEvents(std::string_view Json, char Phase, std::string_view Name = {})
+        {
+            size_t Count = 0;
+            for (size_t Start = 0, End; Start < Json.size(); Start = End + 1) {
+                End = std::min(Json.find('\n', Start), Json.size());
+                auto Line = Json.substr(Start, End - Start);
+                if (!Line.starts_with("{\"name\":")) {
+                    continue;
+                }
+                bool Named = Name.empty() || Line.starts_with("{\"name\":\"" + std::string(Name) + "\"");
+                Count += Named && Line.find("\"ph\":\"" + std::string(1, Phase) + "\"") != std::string_view::npos && Line.find("\"ts\":") != std::string_view::npos;
+            }
+            return Count;
+        }
+
+        // Every toast gets an async span from being shown until it finishes or is hidden, and ShowToast's stages
+        // are complete events within it. A full per-thread buffer drops events, and without Options.Trace nothing is recorded.
+        void TestTraceExport()
+        {
+            auto Trace = std::make_shared<Tracer>();
+            {
+                Options Options;
+                Options.Trace = Trace;
+                auto Platform = std::make_unique<FakeBackend>();
+                auto& Fake = *Platform;
+                WinToast Instance("WinToast.Test", std::move(Platform), Options);
+                CHECK(Instance.Initialize() == Error::Success);
+
+                Template Toast;
+                Toast.TextFields = { "Hello" };
+                int64_t Ids[3] = {};
+                for (auto& Id : Ids) {
+                    CHECK(Instance.ShowToast(Toast, {}, &Id) == Error::Success);
+                }
+                Fake.LastShown->Handler.OnDismissed(DismissalReason::UserCanceled);
+                CHECK(Instance.HideToast(Ids[0]) == Error::Success);
+            }
+
+            std::string Json;
+            Trace->ExportChromeTrace(Json);
+            CHECK(JsonChecker::IsValid(Json));
+            CHECK(!JsonChecker::IsValid(std::string_view(Json).substr(0, Json.size() - 3)));
+            CHECK(Json.starts_with("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+            CHECK(CountTraceEvents(Json, 'b', "Toast") == 3);
+            CHECK(CountTraceEvents(Json, 'e', "Toast") == 2);
+            CHECK(CountTraceEvents(Json, 'X', "ShowToast") == 3);
+            CHECK(CountTraceEvents(Json, 'X', "Show") == 3);
+            CHECK(CountTraceEvents(Json, 'X', "HideToast") == 1);
+            CHECK(CountTraceEvents(Json, 'i', "Dismissed") == 1);
+            CHECK(Trace->GetDroppedCount() == 0);
+
+            // Each thread has its own buffer
+            Tracer Small(4);
+            for (int Idx = 0; Idx < 10; ++Idx) {
+                Small.Instant("Main");
+            }
+            std::thread([&Small]() { Small.Instant("Other"); }).join();
+            CHECK(Small.GetDroppedCount() == 6);
+            Json.clear();
+            Small.ExportChromeTrace(Json);
+            CHECK(JsonChecker::IsValid(Json));
+            CHECK(CountTraceEvents(Json, 'i', "Main") == 4);
+            CHECK(CountTraceEvents(Json, 'i', "Other") == 1);
+
+            Tracer Unused;
+            {
+                WinToast Instance("WinToast.Test", std::make_unique<FakeBackend>());
+                CHECK(Instance.Initialize() == Error::Success);
+                CHECK(Instance.ShowToast(CreateShortTemplate(), {}) == Error::Success);
+            }
+            Json.clear();
+            Unused.ExportChromeTrace(Json);
+            CHECK(JsonChecker::IsValid(Json));
+            CHECK(Json.find("\"ph\"") == std::string::npos);
+            CHECK(Unused.GetDroppedCount() == 0);
+        }
+
+        struct TestCase {
+            const char* Name;
+            void (*Run)();
+        };
+
+        constexpr TestCase Tests[] = {
+            { "payload/legacy", TestPayloadLegacy },
+            { "payload/modern", TestPayloadModern },
+            { "payload/rejected", TestPayloadRejected },
+            { "payload/reused", TestPayloadReused },
+            { "schema/toast", TestSchemaToast },
+            { "resolve/once", TestResolvedOnce },
+            { "resolve/after_disconnect", TestResolvedAfterDisconnect },
+            { "worker/submit", TestWorkerSubmit },
+            { "worker/failure", TestWorkerFailure },
+            { "failures/recent", TestRecentFailures },
+            { "events/executor_poll", TestExecutorPollEvents },
+            { "group/untagged", TestGroupOnly },
+            { "group/clear_untagged", TestClearGroupUntagged },
+            { "buffer/eviction", TestBufferEviction },
+            { "update/throttled", TestUpdateThrottled },
+            { "update/worker", TestUpdateWorker },
+            { "fixedvector/reuse", TestFixedVectorReuse },
+            { "histogram/buckets", TestHistogramBuckets },
+            { "histogram/percentiles", TestHistogramPercentiles },
+            { "utf/invalid", TestUtfInvalid },
+            { "utf/surrogate_pairs", TestUtfSurrogatePairs },
+            { "utf/continuation_only", TestUtfContinuationOnly },
+            { "utf/boundaries", TestUtfBoundaries },
+            { "allocation/submit", TestAllocationSubmit },
+            { "allocation/show", TestAllocationShow },
+            { "schedule/reentrant", TestScheduleReentrant },
+            { "expiry/fake_clock", TestExpiryFakeClock },
+            { "admission/drop_lowest", TestAdmissionDropLowest },
+            { "admission/block", TestAdmissionBlock },
+            { "batch/partial_failure", TestBatchPartialFailure },
+            { "journal/recovery", TestJournalRecovery },
+            { "journal/torn_tail", TestJournalTornTail },
+            { "journal/foreign_file", TestJournalForeignFile },
+            { "journal/compaction", TestJournalCompaction },
+            { "journal/idle_compaction", TestJournalIdleCompaction },
+            { "async/show_failed_late_event", TestShowFailedLateEvent },
+            { "async/show_failed_after_event", TestShowFailedAfterEvent },
+            { "trace/export", TestTraceExport }
+        };
+    }
+}
+
+int main(int Argc, char** Argv)
+{
+    using namespace WinToastLib::Bench;
+
+    std::string_view Filter;
+    for (int Idx = 1; Idx < Argc; ++Idx) {
+        std::string_view Arg = Argv[Idx];
+        if (Arg.starts_with("--filter=")) {
+            Filter = Arg.substr(9);
+        }
+        else {
+            fprintf(stderr, "Usage: %s [--filter=<substring>]\n", Argv[0]);
+            return 1;
+        }
+    }
+
+    int FailedTests = 0;
+    for (auto& Test : Tests) {
+        if (std::string_view(Test.Name).find(Filter) == std::string_view::npos) {
+            continue;
+        }
+
+        auto FailedBefore = FailedChecks;
+        Test.Run();
+        bool Passed = FailedChecks == FailedBefore;
+        FailedTests += !Passed;
+        fprintf(stderr, "%-40s %s\n", Test.Name, Passed ? "ok" : "FAILED");
+    }
+    return FailedTests ? 1 : 0;
+}
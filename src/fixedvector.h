@@ -0,0 +1,181 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <initializer_list>
+#include <utility>
+
+namespace WinToastLib::Detail {
+    // Vector with inline storage for up to N elements, so it never allocates on its own.
+    // Keeps a std::vector-like interface. Adding past capacity drops the element and marks
+    // the vector as overflowed, which lets callers reject it later on.
+    // Removed elements stay in place until overwritten, so strings keep their capacity for
+    // whatever is stored there next. Copies only take the elements in use.
+    template<class T, size_t N>
+    class FixedVector {
+    public:
+        using value_type = T;
+        using iterator = T*;
+        using const_iterator = const T*;
+
+        FixedVector() = default;
+        FixedVector(FixedVector&&) = default;
+        FixedVector& operator=(FixedVector&&) = default;
+
+        FixedVector(const FixedVector& Other) :
+            Size(Other.Size),
+            Overflowed(Other.Overflowed)
+        {
+            std::copy(Other.begin(), Other.end(), Items.begin());
+        }
+
+        FixedVector& operator=(const FixedVector& Other)
+        {
+            std::copy(Other.begin(), Other.end(), Items.begin());
+            Size = Other.Size;
+            Overflowed = Other.Overflowed;
+            return *this;
+        }
+
+        FixedVector(std::initializer_list<T> Init)
+        {
+            for (auto& Value : Init) {
+                push_back(Value);
+            }
+        }
+
+        bool push_back(const T& Value)
+        {
+            if (auto Slot = extend()) {
+                *Slot = Value;
+                return true;
+            }
+            return false;
+        }
+
+        bool push_back(T&& Value)
+        {
+            return emplace_back(std::move(Value));
+        }
+
+        template<class... ArgTs>
+        bool emplace_back(ArgTs&&... Args)
+        {
+            if (Size == N) {
+                Overflowed = true;
+                return false;
+            }
+            Items[Size++] = T(std::forward<ArgTs>(Args)...);
+            return true;
+        }
+
+        // Adds an element still holding whatever was last removed from its place (T() if nothing was),
+        // for assigning to in place. Null past capacity.
+        T* extend()
+        {
+            if (Size == N) {
+                Overflowed = true;
+                return nullptr;
+            }
+            return &Items[Size++];
+        }
+
+        void pop_back()
+        {
+            --Size;
+        }
+
+        void clear()
+        {
+            Size = 0;
+            Overflowed = false;
+        }
+
+        size_t size() const noexcept
+        {
+            return Size;
+        }
+
+        static constexpr size_t capacity() noexcept
+        {
+            return N;
+        }
+
+        bool empty() const noexcept
+        {
+            return Size == 0;
+        }
+
+        // Whether anything was dropped for being past capacity
+        bool overflowed() const noexcept
+        {
+            return Overflowed;
+        }
+
+        T& operator[](size_t Idx) noexcept
+        {
+            return Items[Idx];
+        }
+
+        const T& operator[](size_t Idx) const noexcept
+        {
+            return Items[Idx];
+        }
+
+        T* data() noexcept
+        {
+            return Items.data();
+        }
+
+        const T* data() const noexcept
+        {
+            return Items.data();
+        }
+
+        iterator begin() noexcept
+        {
+            return Items.data();
+        }
+
+        iterator end() noexcept
+        {
+            return Items.data() + Size;
+        }
+
+        const_iterator begin() const noexcept
+        {
+            return Items.data();
+        }
+
+        const_iterator end() const noexcept
+        {
+            return Items.data() + Size;
+        }
+
+    private:
+        std::array<T, N> Items{};
+        size_t Size = 0;
+        bool Overflowed = false;
+    };
+}
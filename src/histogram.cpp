@@ -0,0 +1,118 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "histogram.h"
+
+#include <bit>
+
+namespace WinToastLib::Detail {
+    namespace {
+        size_t GetShardIdx(size_t ShardCount) noexcept
+        {
+            static std::atomic<size_t> NextShard = 0;
+            thread_local size_t ShardIdx = NextShard.fetch_add(1, std::memory_order_relaxed);
+            return ShardIdx % ShardCount;
+        }
+    }
+
+    size_t LatencyHistogram::GetBucket(uint64_t Value) noexcept
+    {
+        constexpr uint64_t SubBucketCount = 1 << SubBucketBits;
+        if (Value < SubBucketCount) {
+            return size_t(Value);
+        }
+
+        if (Value >> MaxValueBits) {
+            Value = (uint64_t(1) << MaxValueBits) - 1;
+        }
+        int Exponent = std::bit_width(Value) - 1;
+        int Shift = Exponent - SubBucketBits;
+        return size_t(Shift + 1) * SubBucketCount + size_t((Value >> Shift) - SubBucketCount);
+    }
+
+    uint64_t LatencyHistogram::GetBucketValue(size_t Bucket) noexcept
+    {
+        constexpr uint64_t SubBucketCount = 1 << SubBucketBits;
+        if (Bucket < SubBucketCount) {
+            return Bucket;
+        }
+
+        int Shift = int(Bucket / SubBucketCount) - 1;
+        uint64_t Lower = (SubBucketCount + Bucket % SubBucketCount) << Shift;
+        return Lower + ((uint64_t(1) << Shift) >> 1);
+    }
+
+    void LatencyHistogram::Record(uint64_t Value) noexcept
+    {
+        auto& Target = Shards[GetShardIdx(ShardCount)];
+        Target.Buckets[GetBucket(Value)].fetch_add(1, std::memory_order_relaxed);
+
+        auto Max = Target.Max.load(std::memory_order_relaxed);
+        while (Value > Max && !Target.Max.compare_exchange_weak(Max, Value, std::memory_order_relaxed)) {}
+    }
+
+    LatencyStats LatencyHistogram::GetStats() const noexcept
+    {
+        uint64_t Counts[BucketCount] = {};
+        LatencyStats Stats{};
+        for (auto& Source : Shards) {
+            for (size_t Bucket = 0; Bucket < BucketCount; ++Bucket) {
+                Counts[Bucket] += Source.Buckets[Bucket].load(std::memory_order_relaxed);
+            }
+            auto Max = Source.Max.load(std::memory_order_relaxed);
+            Stats.MaxNs = Max > Stats.MaxNs ? Max : Stats.MaxNs;
+        }
+
+        uint64_t Total = 0;
+        for (size_t Bucket = 0; Bucket < BucketCount; ++Bucket) {
+            Stats.Count += Counts[Bucket];
+            Total += Counts[Bucket] * GetBucketValue(Bucket);
+        }
+        if (Stats.Count == 0) {
+            return Stats;
+        }
+        Stats.MeanNs = Total / Stats.Count;
+
+        struct {
+            double Quantile;
+            uint64_t& Value;
+        } Percentiles[] = {
+            { .50, Stats.P50Ns },
+            { .90, Stats.P90Ns },
+            { .99, Stats.P99Ns },
+            { .999, Stats.P999Ns }
+        };
+
+        uint64_t Seen = 0;
+        size_t Bucket = 0;
+        for (auto& Percentile : Percentiles) {
+            // Rank of the sample at this quantile, 1-based and rounded up
+            auto Rank = uint64_t(Percentile.Quantile * Stats.Count);
+            Rank += Rank < Percentile.Quantile * Stats.Count || Rank == 0;
+            while (Bucket < BucketCount && Seen + Counts[Bucket] < Rank) {
+                Seen += Counts[Bucket++];
+            }
+            auto Value = GetBucketValue(Bucket < BucketCount ? Bucket : BucketCount - 1);
+            Percentile.Value = Value < Stats.MaxNs ? Value : Stats.MaxNs;
+        }
+
+        return Stats;
+    }
+}
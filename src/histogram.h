@@ -0,0 +1,70 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace WinToastLib {
+    // Latencies in nanoseconds. The mean and percentiles are accurate to within 1/32nd of the value.
+    struct LatencyStats {
+        uint64_t Count;
+        uint64_t MeanNs;
+        uint64_t P50Ns;
+        uint64_t P90Ns;
+        uint64_t P99Ns;
+        uint64_t P999Ns;
+        uint64_t MaxNs;
+    };
+}
+
+namespace WinToastLib::Detail {
+    // Log-linear (HDR style) latency histogram. Values below 16 get a bucket each, and every
+    // power of two above that is split into 16 buckets. Values past ~68 seconds share the last bucket.
+    // Recording is one relaxed atomic add on a shard picked per thread (plus a CAS for a new maximum),
+    // so it's lock-free and concurrent recorders rarely touch the same cache lines.
+    // Like HdrHistogram, the mean is computed from the buckets rather than kept as a running sum.
+    class LatencyHistogram {
+    public:
+        void Record(uint64_t Value) noexcept;
+
+        // Not a consistent cut while recording is in progress, but never off by more than those records
+        LatencyStats GetStats() const noexcept;
+
+        static size_t GetBucket(uint64_t Value) noexcept;
+        // Midpoint of the values falling into Bucket
+        static uint64_t GetBucketValue(size_t Bucket) noexcept;
+
+    private:
+        static constexpr int SubBucketBits = 4;
+        static constexpr int MaxValueBits = 36;
+        static constexpr size_t BucketCount = size_t(MaxValueBits - SubBucketBits + 1) << SubBucketBits;
+        static constexpr size_t ShardCount = 4;
+
+        struct alignas(64) Shard {
+            std::atomic<uint64_t> Buckets[BucketCount] = {};
+            std::atomic<uint64_t> Max = 0;
+        };
+
+        Shard Shards[ShardCount];
+    };
+}
@@ -0,0 +1,154 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace WinToastLib::Detail {
+    template<class Signature, size_t Capacity = 6 * sizeof(void*)>
+    class InlineFunction;
+
+    // Copyable callable wrapper like std::function, but captures of up to Capacity bytes
+    // are stored inline so typical handlers never allocate. Larger ones go on the heap.
+    // Calling an empty InlineFunction does nothing and returns a value-initialized R.
+    template<class R, class... ArgTs, size_t Capacity>
+    class InlineFunction<R(ArgTs...), Capacity> {
+    public:
+        InlineFunction() noexcept = default;
+
+        InlineFunction(std::nullptr_t) noexcept
+        {
+
+        }
+
+        template<class F, class = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineFunction> && std::is_invocable_r_v<R, std::decay_t<F>&, ArgTs...>>>
+        InlineFunction(F&& Func)
+        {
+            using Callable = std::decay_t<F>;
+            if constexpr (IsInline<Callable>) {
+                new (Storage) Callable(std::forward<F>(Func));
+                Ops = &InlineOps<Callable>;
+            }
+            else {
+                *reinterpret_cast<Callable**>(Storage) = new Callable(std::forward<F>(Func));
+                Ops = &HeapOps<Callable>;
+            }
+        }
+
+        InlineFunction(const InlineFunction& Other) :
+            Ops(Other.Ops)
+        {
+            if (Ops) {
+                Ops->Copy(Storage, Other.Storage);
+            }
+        }
+
+        InlineFunction(InlineFunction&& Other) noexcept :
+            Ops(Other.Ops)
+        {
+            if (Ops) {
+                Ops->Move(Storage, Other.Storage);
+                Other.Ops = nullptr;
+            }
+        }
+
+        ~InlineFunction()
+        {
+            Reset();
+        }
+
+        InlineFunction& operator=(const InlineFunction& Other)
+        {
+            if (this != &Other) {
+                InlineFunction Copy(Other);
+                *this = std::move(Copy);
+            }
+            return *this;
+        }
+
+        InlineFunction& operator=(InlineFunction&& Other) noexcept
+        {
+            if (this != &Other) {
+                Reset();
+                Ops = Other.Ops;
+                if (Ops) {
+                    Ops->Move(Storage, Other.Storage);
+                    Other.Ops = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return Ops != nullptr;
+        }
+
+        R operator()(ArgTs... Args) const
+        {
+            if (!Ops) {
+                return R();
+            }
+            return Ops->Invoke(const_cast<unsigned char*>(Storage), std::forward<ArgTs>(Args)...);
+        }
+
+    private:
+        struct Operations {
+            R (*Invoke)(void* Storage, ArgTs&&... Args);
+            void (*Copy)(void* Storage, const void* From);
+            void (*Move)(void* Storage, void* From) noexcept;
+            void (*Destroy)(void* Storage) noexcept;
+        };
+
+        template<class F>
+        static constexpr bool IsInline = sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<F>;
+
+        template<class F>
+        static constexpr Operations InlineOps{
+            [](void* Storage, ArgTs&&... Args) -> R { return (*static_cast<F*>(Storage))(std::forward<ArgTs>(Args)...); },
+            [](void* Storage, const void* From) { new (Storage) F(*static_cast<const F*>(From)); },
+            [](void* Storage, void* From) noexcept { new (Storage) F(std::move(*static_cast<F*>(From))); static_cast<F*>(From)->~F(); },
+            [](void* Storage) noexcept { static_cast<F*>(Storage)->~F(); }
+        };
+
+        template<class F>
+        static constexpr Operations HeapOps{
+            [](void* Storage, ArgTs&&... Args) -> R { return (**static_cast<F**>(Storage))(std::forward<ArgTs>(Args)...); },
+            [](void* Storage, const void* From) { *static_cast<F**>(Storage) = new F(**static_cast<F* const*>(From)); },
+            [](void* Storage, void* From) noexcept { *static_cast<F**>(Storage) = *static_cast<F**>(From); },
+            [](void* Storage) noexcept { delete *static_cast<F**>(Storage); }
+        };
+
+        void Reset() noexcept
+        {
+            if (Ops) {
+                Ops->Destroy(Storage);
+                Ops = nullptr;
+            }
+        }
+
+        alignas(std::max_align_t) unsigned char Storage[Capacity];
+        const Operations* Ops = nullptr;
+    };
+}
@@ -0,0 +1,134 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace WinToastLib::Detail {
+    // Unbounded intrusive multi-producer single-consumer queue (Vyukov).
+    // Push is wait-free (one exchange), Pop must only be called from one thread.
+    // Pop can briefly report empty while a producer is between its exchange and its link.
+    //
+    // Popped nodes are recycled instead of freed: the consumer pushes them onto FreeNodes,
+    // and a producer takes the whole list at once into a per-thread cache. Only the consumer
+    // ever pushes and producers only exchange, so the free list has no ABA problem.
+    // Once warmed up to the peak queue depth, Push and Pop don't allocate.
+    template<class T>
+    class MpscQueue {
+    public:
+        MpscQueue() :
+            Head(new Node),
+            Tail(Head.load(std::memory_order_relaxed)),
+            FreeNodes(nullptr)
+        {
+
+        }
+
+        ~MpscQueue()
+        {
+            T Discarded;
+            while (Pop(Discarded)) {}
+            delete Tail;
+            DeleteNodes(FreeNodes.load(std::memory_order_acquire));
+        }
+
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        void Push(T&& Value)
+        {
+            auto NewNode = AcquireNode();
+            NewNode->Value = std::move(Value);
+            NewNode->Next.store(nullptr, std::memory_order_relaxed);
+            auto Prev = Head.exchange(NewNode, std::memory_order_acq_rel);
+            Prev->Next.store(NewNode, std::memory_order_release);
+        }
+
+        bool Pop(T& Value)
+        {
+            auto Next = Tail->Next.load(std::memory_order_acquire);
+            if (Next == nullptr) {
+                return false;
+            }
+
+            Value = std::move(Next->Value);
+            ReleaseNode(Tail);
+            Tail = Next;
+            return true;
+        }
+
+    private:
+        struct Node {
+            std::atomic<Node*> Next = nullptr;
+            Node* NextFree = nullptr;
+            T Value;
+        };
+
+        // Nodes are interchangeable between queues of the same type, so the cache is per thread
+        struct NodeCache {
+            Node* First = nullptr;
+
+            ~NodeCache()
+            {
+                DeleteNodes(First);
+            }
+        };
+
+        static void DeleteNodes(Node* First)
+        {
+            while (First) {
+                auto NextFree = First->NextFree;
+                delete First;
+                First = NextFree;
+            }
+        }
+
+        Node* AcquireNode()
+        {
+            static thread_local NodeCache Cache;
+            if (Cache.First == nullptr) {
+                Cache.First = FreeNodes.exchange(nullptr, std::memory_order_acquire);
+                if (Cache.First == nullptr) {
+                    return new Node;
+                }
+            }
+
+            auto Acquired = Cache.First;
+            Cache.First = Acquired->NextFree;
+            return Acquired;
+        }
+
+        void ReleaseNode(Node* Released)
+        {
+            // Whatever the node still holds was moved from, but may keep resources alive
+            Released->Value = T();
+            auto First = FreeNodes.load(std::memory_order_relaxed);
+            do {
+                Released->NextFree = First;
+            } while (!FreeNodes.compare_exchange_weak(First, Released, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        std::atomic<Node*> Head;
+        Node* Tail;
+        std::atomic<Node*> FreeNodes;
+    };
+}
@@ -0,0 +1,116 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace WinToastLib::Detail {
+    // Bounded lock-free multi-producer single-consumer ring (Vyukov's bounded queue with a
+    // single consumer). Each cell carries a sequence number telling producers and the consumer
+    // whose turn it is. TryPush fails instead of blocking when the ring is full.
+    template<class T>
+    class MpscRing {
+    public:
+        // Capacity is rounded up to a power of two
+        explicit MpscRing(size_t Capacity) :
+            Mask(RoundUp(Capacity) - 1),
+            Cells(new Cell[Mask + 1]),
+            EnqueuePos(0),
+            DequeuePos(0)
+        {
+            for (size_t Idx = 0; Idx <= Mask; ++Idx) {
+                Cells[Idx].Sequence.store(Idx, std::memory_order_relaxed);
+            }
+        }
+
+        MpscRing(const MpscRing&) = delete;
+        MpscRing& operator=(const MpscRing&) = delete;
+
+        bool TryPush(const T& Value)
+        {
+            Cell* Target;
+            auto Pos = EnqueuePos.load(std::memory_order_relaxed);
+            while (true) {
+                Target = &Cells[Pos & Mask];
+                auto Sequence = Target->Sequence.load(std::memory_order_acquire);
+                auto Diff = intptr_t(Sequence) - intptr_t(Pos);
+                if (Diff == 0) {
+                    if (EnqueuePos.compare_exchange_weak(Pos, Pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                else if (Diff < 0) {
+                    return false;
+                }
+                else {
+                    Pos = EnqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+
+            Target->Value = Value;
+            Target->Sequence.store(Pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Must only be called from one thread at a time
+        bool TryPop(T& Value)
+        {
+            auto& Target = Cells[DequeuePos & Mask];
+            if (Target.Sequence.load(std::memory_order_acquire) != DequeuePos + 1) {
+                return false;
+            }
+
+            Value = Target.Value;
+            Target.Sequence.store(DequeuePos + Mask + 1, std::memory_order_release);
+            ++DequeuePos;
+            return true;
+        }
+
+        size_t Capacity() const noexcept
+        {
+            return Mask + 1;
+        }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> Sequence;
+            T Value;
+        };
+
+        static size_t RoundUp(size_t Capacity)
+        {
+            size_t Rounded = 2;
+            while (Rounded < Capacity) {
+                Rounded <<= 1;
+            }
+            return Rounded;
+        }
+
+        const size_t Mask;
+        std::unique_ptr<Cell[]> Cells;
+        // Producers and the consumer each keep to their own cache line
+        alignas(64) std::atomic<size_t> EnqueuePos;
+        alignas(64) size_t DequeuePos;
+    };
+}
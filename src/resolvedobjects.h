@@ -0,0 +1,112 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "inlinefunction.h"
+
+#include <cstdint>
+#include <utility>
+
+namespace WinToastLib::Detail {
+    // HRESULTs meaning the notification platform went away and the objects resolved from it are dead:
+    // RPC_E_DISCONNECTED, RPC_E_SERVER_DIED, RPC_E_SERVER_DIED_DNE, CO_E_OBJNOTCONNECTED
+    // and HRESULT_FROM_WIN32(RPC_S_SERVER_UNAVAILABLE)
+    constexpr bool IsDisconnected(int32_t Result) noexcept
+    {
+        switch (uint32_t(Result))
+        {
+        case 0x80010108:
+        case 0x80010007:
+        case 0x80010012:
+        case 0x800401FD:
+        case 0x800706BA:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Objects resolved from the platform once (e.g. the toast manager, notifier and factory) and used by
+    // every call after that. They're only resolved again when a call fails because the platform went away,
+    // into a fresh T that replaces the old one only if resolving succeeded. So a failed attempt leaves the
+    // previous (dead) objects in place, which keep failing calls rather than leaving them null.
+    // Resolver fills in a T and returns an HRESULT style code, negative on failure.
+    template<class T>
+    class ResolvedObjects {
+    public:
+        using ResolverType = InlineFunction<int32_t(T& Objects)>;
+
+        explicit ResolvedObjects(ResolverType&& Resolver) :
+            Resolver(std::move(Resolver)),
+            Objects(),
+            Resolved(false)
+        {
+
+        }
+
+        int32_t Resolve()
+        {
+            T Fresh{};
+            auto Result = Resolver(Fresh);
+            if (Result >= 0) {
+                std::swap(Objects, Fresh);
+                Resolved = true;
+            }
+            return Result;
+        }
+
+        bool IsResolved() const noexcept
+        {
+            return Resolved;
+        }
+
+        // Returns Func(Objects), calling it once more with fresh objects if it failed because the platform
+        // went away. Func isn't called at all until resolving has succeeded, its failure is returned instead.
+        template<class F>
+        int32_t Call(F&& Func)
+        {
+            if (!Resolved) {
+                auto Result = Resolve();
+                if (Result < 0) {
+                    return Result;
+                }
+            }
+
+            int32_t Result = Func(Objects);
+            if (IsDisconnected(Result) && Resolve() >= 0) {
+                Result = Func(Objects);
+            }
+            return Result;
+        }
+
+        // Releases the objects, e.g. before uninitializing COM
+        void Reset()
+        {
+            Objects = T();
+            Resolved = false;
+        }
+
+    private:
+        ResolverType Resolver;
+        T Objects;
+        bool Resolved;
+    };
+}
@@ -0,0 +1,267 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace WinToastLib::Detail {
+    // Flat slot map handing out generation-tagged 64 bit ids.
+    // An id packs the slot index in its low 32 bits and the slot's generation in the high 31 bits,
+    // so ids are always positive and a stale id never matches a reused slot.
+    // Lookups are a bounds check and a generation compare; entries live contiguously and never
+    // allocate on their own. Occupied slots are also kept in a recency list (most recent first).
+    template<class T>
+    class SlotMap {
+    public:
+        static constexpr uint32_t Nil = UINT32_MAX;
+
+        SlotMap() :
+            Count(0),
+            FreeHead(Nil),
+            Newest(Nil),
+            Oldest(Nil)
+        {
+
+        }
+
+        int64_t Insert(T&& Value)
+        {
+            uint32_t Index;
+            if (FreeHead != Nil) {
+                Index = FreeHead;
+                FreeHead = Slots[Index].Next;
+            }
+            else {
+                Index = uint32_t(Slots.size());
+                Slots.emplace_back();
+            }
+
+            auto& Slot = Slots[Index];
+            Slot.Value = std::move(Value);
+            Slot.Occupied = true;
+            LinkNewest(Index);
+            ++Count;
+            return MakeId(Index, Slot.Generation);
+        }
+
+        // Inserts Value under an id handed out before, e.g. by an earlier process. Fails if its slot is taken.
+        // Slots skipped over to reach it are freed, so this is meant for filling an empty map.
+        bool Restore(int64_t Id, T&& Value)
+        {
+            auto Index = GetIndex(Id);
+            auto Generation = GetGeneration(Id);
+            if (Id <= 0 || Generation == 0 || Index == Nil) {
+                return false;
+            }
+            while (Slots.size() <= Index) {
+                auto Skipped = uint32_t(Slots.size());
+                Slots.emplace_back();
+                Slots[Skipped].Next = FreeHead;
+                FreeHead = Skipped;
+            }
+
+            auto& Slot = Slots[Index];
+            if (Slot.Occupied) {
+                return false;
+            }
+            for (auto* Link = &FreeHead; *Link != Nil; Link = &Slots[*Link].Next) {
+                if (*Link == Index) {
+                    *Link = Slot.Next;
+                    break;
+                }
+            }
+
+            Slot.Value = std::move(Value);
+            Slot.Generation = Generation;
+            Slot.Occupied = true;
+            LinkNewest(Index);
+            ++Count;
+            return true;
+        }
+
+        T* Find(int64_t Id)
+        {
+            auto Index = GetIndex(Id);
+            if (Index >= Slots.size() || !Slots[Index].Occupied || Slots[Index].Generation != GetGeneration(Id)) {
+                return nullptr;
+            }
+            return &Slots[Index].Value;
+        }
+
+        // Moves the value out into Value and frees the slot
+        bool Erase(int64_t Id, T& Value)
+        {
+            if (!Find(Id)) {
+                return false;
+            }
+
+            auto Index = GetIndex(Id);
+            Value = std::move(Slots[Index].Value);
+            Free(Index);
+            return true;
+        }
+
+        // Moves the most recently touched entry to the front of the recency list
+        void Touch(int64_t Id)
+        {
+            if (Find(Id)) {
+                auto Index = GetIndex(Id);
+                Unlink(Index);
+                LinkNewest(Index);
+            }
+        }
+
+        // Least recently inserted/touched id, or 0 if empty
+        int64_t GetOldest() const
+        {
+            return Oldest == Nil ? 0 : MakeId(Oldest, Slots[Oldest].Generation);
+        }
+
+        // Calls Func(Id, Value) on entries from the least recently inserted/touched one, until it returns false
+        template<class F>
+        void ForEachOldest(F&& Func) const
+        {
+            for (auto Index = Oldest; Index != Nil; Index = Slots[Index].Prev) {
+                if (!Func(MakeId(Index, Slots[Index].Generation), Slots[Index].Value)) {
+                    return;
+                }
+            }
+        }
+
+        // Calls Func(Id, Value) on every entry, erasing the ones it returns true for
+        template<class F>
+        void EraseIf(F&& Func)
+        {
+            for (uint32_t Index = 0; Index < Slots.size(); ++Index) {
+                auto& Slot = Slots[Index];
+                if (Slot.Occupied && Func(MakeId(Index, Slot.Generation), Slot.Value)) {
+                    Free(Index);
+                }
+            }
+        }
+
+        void Clear()
+        {
+            EraseIf([](int64_t, T&) { return true; });
+        }
+
+        void Swap(SlotMap& Other)
+        {
+            std::swap(Slots, Other.Slots);
+            std::swap(Count, Other.Count);
+            std::swap(FreeHead, Other.FreeHead);
+            std::swap(Newest, Other.Newest);
+            std::swap(Oldest, Other.Oldest);
+        }
+
+        void Reserve(size_t Size)
+        {
+            Slots.reserve(Size);
+        }
+
+        size_t Size() const
+        {
+            return Count;
+        }
+
+        bool Empty() const
+        {
+            return Count == 0;
+        }
+
+    private:
+        struct Slot {
+            T Value{};
+            uint32_t Generation = 1;
+            bool Occupied = false;
+            // Recency list links while occupied, free list link otherwise
+            uint32_t Prev = Nil;
+            uint32_t Next = Nil;
+        };
+
+        static int64_t MakeId(uint32_t Index, uint32_t Generation)
+        {
+            return int64_t(uint64_t(Generation) << 32 | Index);
+        }
+
+        static uint32_t GetIndex(int64_t Id)
+        {
+            return uint32_t(uint64_t(Id));
+        }
+
+        static uint32_t GetGeneration(int64_t Id)
+        {
+            return uint32_t(uint64_t(Id) >> 32);
+        }
+
+        void Free(uint32_t Index)
+        {
+            auto& Slot = Slots[Index];
+            Unlink(Index);
+            Slot.Value = T{};
+            Slot.Occupied = false;
+            // Generations stay within 31 bits and skip 0
+            Slot.Generation = Slot.Generation == INT32_MAX ? 1 : Slot.Generation + 1;
+            Slot.Next = FreeHead;
+            FreeHead = Index;
+            --Count;
+        }
+
+        void LinkNewest(uint32_t Index)
+        {
+            auto& Slot = Slots[Index];
+            Slot.Prev = Nil;
+            Slot.Next = Newest;
+            if (Newest != Nil) {
+                Slots[Newest].Prev = Index;
+            }
+            Newest = Index;
+            if (Oldest == Nil) {
+                Oldest = Index;
+            }
+        }
+
+        void Unlink(uint32_t Index)
+        {
+            auto& Slot = Slots[Index];
+            if (Slot.Prev != Nil) {
+                Slots[Slot.Prev].Next = Slot.Next;
+            }
+            else {
+                Newest = Slot.Next;
+            }
+            if (Slot.Next != Nil) {
+                Slots[Slot.Next].Prev = Slot.Prev;
+            }
+            else {
+                Oldest = Slot.Prev;
+            }
+        }
+
+        std::vector<Slot> Slots;
+        size_t Count;
+        uint32_t FreeHead;
+        uint32_t Newest;
+        uint32_t Oldest;
+    };
+}
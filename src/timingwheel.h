@@ -0,0 +1,305 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace WinToastLib::Detail {
+    // Hierarchical timing wheel of 4 levels with 256 slots each, keyed by tick. Level N slots span 256^N ticks,
+    // so with 1 ms ticks the top level reaches about 50 days out; anything further is parked in the top level
+    // and placed again once it's reached.
+    // Entries live in a flat pool and are linked into their slot's list by index, so inserting, cancelling and
+    // rescheduling are O(1) however many are pending. Advancing moves a slot's entries down a level when its span
+    // is reached and fires level 0 slots, jumping straight over ticks where nothing is occupied.
+    // Ids are generation-tagged like SlotMap's, so a stale id never matches a reused entry.
+    template<class T>
+    class TimingWheel {
+    public:
+        static constexpr uint32_t Nil = UINT32_MAX;
+        static constexpr size_t LevelCount = 4;
+        static constexpr size_t SlotBits = 8;
+        static constexpr size_t SlotCount = size_t(1) << SlotBits;
+
+        explicit TimingWheel(uint64_t Now = 0) :
+            Count(0),
+            FreeHead(Nil),
+            Current(Now),
+            Occupancy{}
+        {
+            Heads.fill(Nil);
+        }
+
+        // Entries due at or before the current tick fire on the next Advance
+        int64_t Insert(uint64_t Due, T&& Value)
+        {
+            uint32_t Index;
+            if (FreeHead != Nil) {
+                Index = FreeHead;
+                FreeHead = Nodes[Index].Next;
+            }
+            else {
+                Index = uint32_t(Nodes.size());
+                Nodes.emplace_back();
+            }
+
+            auto& Node = Nodes[Index];
+            Node.Value = std::move(Value);
+            Node.Due = Due;
+            Node.Occupied = true;
+            Link(Index);
+            ++Count;
+            return MakeId(Index, Node.Generation);
+        }
+
+        T* Find(int64_t Id)
+        {
+            auto Index = GetIndex(Id);
+            if (Index >= Nodes.size() || !Nodes[Index].Occupied || Nodes[Index].Generation != GetGeneration(Id)) {
+                return nullptr;
+            }
+            return &Nodes[Index].Value;
+        }
+
+        // Moves the value out into Value and frees the entry
+        bool Erase(int64_t Id, T& Value)
+        {
+            if (!Find(Id)) {
+                return false;
+            }
+
+            auto Index = GetIndex(Id);
+            Unlink(Index);
+            Value = std::move(Nodes[Index].Value);
+            Free(Index);
+            return true;
+        }
+
+        bool Reschedule(int64_t Id, uint64_t Due)
+        {
+            if (!Find(Id)) {
+                return false;
+            }
+
+            auto Index = GetIndex(Id);
+            Unlink(Index);
+            Nodes[Index].Due = Due;
+            Link(Index);
+            return true;
+        }
+
+        // Moves the wheel forward to Now, calling Func(Id, Value) with every entry that became due, in order of their
+        // due tick. Entries are freed before Func is called, so it may insert or erase others.
+        template<class F>
+        void Advance(uint64_t Now, F&& Func)
+        {
+            Fire(OverdueList, Func);
+            while (Current < Now) {
+                // Nothing is due before the next occupied slot starts, so the ticks in between are skipped
+                Current = std::min(GetNextDue(), Now);
+                for (size_t Level = LevelCount - 1; Level > 0; --Level) {
+                    auto Shift = SlotBits * Level;
+                    if ((Current & ((uint64_t(1) << Shift) - 1)) == 0) {
+                        Cascade(uint16_t(Level * SlotCount + ((Current >> Shift) & (SlotCount - 1))));
+                    }
+                }
+                Fire(uint16_t(Current & (SlotCount - 1)), Func);
+                Fire(OverdueList, Func);
+            }
+        }
+
+        // Lower bound of the earliest due tick (exact if it's within 256 ticks), or UINT64_MAX when empty.
+        // Advancing to it either fires something or moves entries down a level.
+        uint64_t GetNextDue() const
+        {
+            if (Heads[OverdueList] != Nil) {
+                return Current;
+            }
+
+            uint64_t Next = UINT64_MAX;
+            for (size_t Level = 0; Level < LevelCount; ++Level) {
+                auto Shift = SlotBits * Level;
+                auto Base = (Current >> Shift) + 1;
+                auto Offset = FindOccupied(Level, size_t(Base & (SlotCount - 1)));
+                if (Offset < SlotCount) {
+                    Next = std::min(Next, (Base + Offset) << Shift);
+                }
+            }
+            return Next;
+        }
+
+        uint64_t GetCurrent() const
+        {
+            return Current;
+        }
+
+        size_t Size() const
+        {
+            return Count;
+        }
+
+        bool Empty() const
+        {
+            return Count == 0;
+        }
+
+    private:
+        // Lists are indexed by Level * SlotCount + Slot, with one more for entries already due
+        static constexpr uint16_t OverdueList = uint16_t(LevelCount * SlotCount);
+
+        struct Node {
+            T Value{};
+            uint64_t Due = 0;
+            uint32_t Generation = 1;
+            bool Occupied = false;
+            uint16_t List = 0;
+            // Slot list links while occupied, free list link otherwise
+            uint32_t Prev = Nil;
+            uint32_t Next = Nil;
+        };
+
+        static int64_t MakeId(uint32_t Index, uint32_t Generation)
+        {
+            return int64_t(uint64_t(Generation) << 32 | Index);
+        }
+
+        static uint32_t GetIndex(int64_t Id)
+        {
+            return uint32_t(uint64_t(Id));
+        }
+
+        static uint32_t GetGeneration(int64_t Id)
+        {
+            return uint32_t(uint64_t(Id) >> 32);
+        }
+
+        void Free(uint32_t Index)
+        {
+            auto& Node = Nodes[Index];
+            Node.Value = T{};
+            Node.Occupied = false;
+            // Generations stay within 31 bits and skip 0
+            Node.Generation = Node.Generation == INT32_MAX ? 1 : Node.Generation + 1;
+            Node.Next = FreeHead;
+            FreeHead = Index;
+            --Count;
+        }
+
+        // Places the entry by how far out it's due: level N holds entries due within 256^(N+1) ticks
+        void Link(uint32_t Index)
+        {
+            auto& Node = Nodes[Index];
+            if (Node.Due <= Current) {
+                Node.List = OverdueList;
+            }
+            else {
+                auto Delta = Node.Due - Current;
+                size_t Level = 0;
+                while (Level + 1 < LevelCount && Delta >= uint64_t(1) << (SlotBits * (Level + 1))) {
+                    ++Level;
+                }
+                auto Due = std::min(Node.Due, Current + (uint64_t(1) << (SlotBits * LevelCount)) - 1);
+                auto Slot = (Due >> (SlotBits * Level)) & (SlotCount - 1);
+                Node.List = uint16_t(Level * SlotCount + Slot);
+                Occupancy[Level][Slot / 64] |= uint64_t(1) << (Slot % 64);
+            }
+
+            Node.Prev = Nil;
+            Node.Next = Heads[Node.List];
+            if (Node.Next != Nil) {
+                Nodes[Node.Next].Prev = Index;
+            }
+            Heads[Node.List] = Index;
+        }
+
+        void Unlink(uint32_t Index)
+        {
+            auto& Node = Nodes[Index];
+            if (Node.Prev != Nil) {
+                Nodes[Node.Prev].Next = Node.Next;
+            }
+            else {
+                Heads[Node.List] = Node.Next;
+                if (Node.Next == Nil && Node.List != OverdueList) {
+                    Occupancy[Node.List / SlotCount][(Node.List % SlotCount) / 64] &= ~(uint64_t(1) << (Node.List % 64));
+                }
+            }
+            if (Node.Next != Nil) {
+                Nodes[Node.Next].Prev = Node.Prev;
+            }
+        }
+
+        // Places every entry of a higher level slot again, now that its span has been reached
+        void Cascade(uint16_t List)
+        {
+            while (Heads[List] != Nil) {
+                auto Index = Heads[List];
+                Unlink(Index);
+                Link(Index);
+            }
+        }
+
+        template<class F>
+        void Fire(uint16_t List, F& Func)
+        {
+            while (Heads[List] != Nil) {
+                auto Index = Heads[List];
+                Unlink(Index);
+                auto Value = std::move(Nodes[Index].Value);
+                auto Id = MakeId(Index, Nodes[Index].Generation);
+                Free(Index);
+                Func(Id, std::move(Value));
+            }
+        }
+
+        // Offset from Start to the first occupied slot of Level, wrapping around, or SlotCount if there's none
+        size_t FindOccupied(size_t Level, size_t Start) const
+        {
+            auto& Bits = Occupancy[Level];
+            for (size_t Step = 0; Step <= Bits.size(); ++Step) {
+                auto Word = (Start / 64 + Step) % Bits.size();
+                auto Mask = Bits[Word];
+                if (Step == 0) {
+                    Mask &= ~uint64_t(0) << (Start % 64);
+                }
+                else if (Step == Bits.size()) {
+                    // Back at Start's word, only the bits before it are left
+                    Mask &= ~(~uint64_t(0) << (Start % 64));
+                }
+                if (Mask) {
+                    return (Word * 64 + std::countr_zero(Mask) - Start) & (SlotCount - 1);
+                }
+            }
+            return SlotCount;
+        }
+
+        std::vector<Node> Nodes;
+        size_t Count;
+        uint32_t FreeHead;
+        uint64_t Current;
+        std::array<uint32_t, LevelCount * SlotCount + 1> Heads;
+        std::array<std::array<uint64_t, SlotCount / 64>, LevelCount> Occupancy;
+    };
+}
@@ -0,0 +1,75 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "toasttypes.h"
+
+#include <chrono>
+#include <memory>
+#include <span>
+#include <string_view>
+
+namespace WinToastLib {
+    // Returns the current time. WinToast and its backend read the wall clock only through this, so it can be
+    // replaced (e.g. by a fake clock in tests). It's called from any thread.
+    using TimeSource = Detail::InlineFunction<std::chrono::system_clock::time_point()>;
+
+    // The notification platform WinToast drives. The default one talks to WinRT, but any
+    // implementation (e.g. an in-process fake) can be handed to WinToast's constructor.
+    // Everything but Initialize returns an HRESULT style code, negative on failure.
+    class Backend {
+    public:
+        // A platform notification object, kept alive by WinToast until it's hidden
+        class Notification {
+        public:
+            virtual ~Notification() = default;
+        };
+
+        virtual ~Backend() = default;
+
+        // Called from WinToast::Initialize, on the thread that will be making the other calls.
+        // Anything that doesn't change per toast (factories, notifiers) should be resolved here.
+        // Times handed to the platform (e.g. expirations) are relative to TimeSource.
+        virtual Error Initialize(const std::string& Aumi, const TimeSource& TimeSource) = 0;
+        virtual bool SupportsModernFeatures() const = 0;
+
+        // Payload is the serialized Toast, the rest of Toast (expiration, tag, group) is applied here
+        virtual int32_t CreateNotification(const Template& Toast, std::string_view Payload, std::unique_ptr<Notification>& Notification) = 0;
+        // Handler is handed over, the backend keeps it alive for as long as events can be raised
+        virtual int32_t RegisterHandler(Notification& Notification, Handler&& Handler) = 0;
+        virtual int32_t Show(Notification& Notification) = 0;
+        virtual int32_t Hide(Notification& Notification) = 0;
+        // Replaces bound values of the displayed toast with this tag and group, leaving the others as they are.
+        // The platform ignores updates with a lower SequenceNumber than what's displayed, 0 always applies.
+        // Returns S_FALSE (1) if no such toast is displayed.
+        virtual int32_t Update(std::string_view Tag, std::string_view Group, std::span<const DataField> Data, uint32_t SequenceNumber) = 0;
+        // Returns a notification for a toast with this tag and group shown by an earlier process, e.g. one read
+        // back from the journal. It's never shown and raises no events, but hiding it removes the toast.
+        virtual std::unique_ptr<Notification> Recover(std::string_view Tag, std::string_view Group) = 0;
+        // Remove the application's toasts in Group, or all of them, from the notification center at once.
+        // The platform may not raise events for them.
+        virtual int32_t RemoveGroup(std::string_view Group) = 0;
+        virtual int32_t RemoveAll() = 0;
+    };
+
+    // Returns the WinRT backend, or nullptr on platforms without one
+    std::unique_ptr<Backend> CreateDefaultBackend();
+}
@@ -0,0 +1,463 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "toastjournal.h"
+#include "utf.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace WinToastLib::Detail {
+    namespace {
+        constexpr char JournalMagic[8] = { 'W', 'T', 'J', 'O', 'U', 'R', 'N', 'L' };
+        constexpr uint32_t JournalVersion = 1;
+
+        size_t AlignRecord(size_t Size)
+        {
+            return (Size + 7) & ~size_t(7);
+        }
+
+        // Whether a file starting with these bytes may be started over: empty, zeroed or a journal of any version
+        bool IsReusable(const uint8_t* Start, size_t Count)
+        {
+            if (Count >= sizeof(JournalMagic) && memcmp(Start, JournalMagic, sizeof(JournalMagic)) == 0) {
+                return true;
+            }
+            return std::all_of(Start, Start + Count, [](uint8_t Byte) { return Byte == 0; });
+        }
+    }
+
+    ToastJournal::ToastJournal() :
+        View(nullptr),
+        Size(0),
+        Tail(0),
+        Flushed(0),
+        EarlyCompactAt(0),
+        Unflushed(0),
+#ifdef _WIN32
+        File(nullptr),
+        Mapping(nullptr)
+#else
+        File(-1)
+#endif
+    {
+
+    }
+
+    ToastJournal::~ToastJournal()
+    {
+        Close();
+    }
+
+    bool ToastJournal::Open(const std::string& Path, size_t InitialSize, std::vector<LiveToast>& Live)
+    {
+        Close();
+        this->Path = Path;
+        InitialSize = std::max(AlignRecord(InitialSize), sizeof(FileHeader) + 4096);
+        // A journal of another version is started over, a file that isn't one is left alone
+        if (!Map(Path, InitialSize, false) && !Map(Path, InitialSize, true)) {
+            return false;
+        }
+        Replay();
+
+        std::vector<std::pair<size_t, int64_t>> Order;
+        Order.reserve(LiveRecords.size());
+        for (auto& [Id, Offset] : LiveRecords) {
+            Order.emplace_back(Offset, Id);
+        }
+        std::sort(Order.begin(), Order.end());
+
+        Live.clear();
+        Live.reserve(Order.size());
+        for (auto& [Offset, Id] : Order) {
+            auto Record = reinterpret_cast<const RecordHeader*>(View + Offset);
+            auto Strings = reinterpret_cast<const char*>(Record + 1);
+            Live.push_back({ Id, Record->ShownAt, std::string(Strings, Record->TagSize), std::string(Strings + Record->TagSize, Record->GroupSize) });
+        }
+        return true;
+    }
+
+    void ToastJournal::Close()
+    {
+        if (View) {
+            FlushView(false);
+        }
+        Unmap();
+        LiveRecords.clear();
+    }
+
+    bool ToastJournal::IsOpen() const
+    {
+        return View != nullptr;
+    }
+
+    bool ToastJournal::Shown(int64_t Id, int64_t ShownAt, std::string_view Tag, std::string_view Group)
+    {
+        return Append(RecordType::Shown, Id, ShownAt, Tag, Group);
+    }
+
+    bool ToastJournal::Removed(int64_t Id)
+    {
+        return !LiveRecords.contains(Id) || Append(RecordType::Removed, Id, 0, {}, {});
+    }
+
+    bool ToastJournal::Cleared()
+    {
+        return LiveRecords.empty() || Append(RecordType::Cleared, 0, 0, {}, {});
+    }
+
+    void ToastJournal::Flush()
+    {
+        if (View) {
+            FlushView(false);
+        }
+    }
+
+    bool ToastJournal::ShouldCompact() const
+    {
+        return View && Tail >= EarlyCompactAt;
+    }
+
+    bool ToastJournal::CompactEarly()
+    {
+        if (Compact(0)) {
+            return true;
+        }
+        // Until compacting succeeds, which maps it again
+        EarlyCompactAt = SIZE_MAX;
+        return false;
+    }
+
+    bool ToastJournal::Map(const std::string& Path, size_t InitialSize, bool Create)
+    {
+        size_t MappedSize = InitialSize;
+#ifdef _WIN32
+        std::u16string WidePath;
+        if (!Utf8ToUtf16(Path, WidePath)) {
+            return false;
+        }
+
+        auto FileHandle = CreateFileW(reinterpret_cast<LPCWSTR>(WidePath.c_str()), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+            Create ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (FileHandle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        if (Create) {
+            // Emptied only once it's known not to be someone else's file, then extended with zeros by the mapping
+            FileHeader Existing{};
+            DWORD Read = 0;
+            LARGE_INTEGER Start{};
+            if (!ReadFile(FileHandle, &Existing, sizeof(Existing), &Read, nullptr) || !IsReusable(reinterpret_cast<const uint8_t*>(&Existing), Read) ||
+                !SetFilePointerEx(FileHandle, Start, nullptr, FILE_BEGIN) || !SetEndOfFile(FileHandle)) {
+                CloseHandle(FileHandle);
+                return false;
+            }
+        }
+        else {
+            LARGE_INTEGER FileSize;
+            if (!GetFileSizeEx(FileHandle, &FileSize)) {
+                CloseHandle(FileHandle);
+                return false;
+            }
+            MappedSize = size_t(FileSize.QuadPart);
+        }
+        if (MappedSize < sizeof(FileHeader)) {
+            CloseHandle(FileHandle);
+            return false;
+        }
+
+        // Mapping more than the file holds extends it with zeros
+        auto MappingHandle = CreateFileMappingW(FileHandle, nullptr, PAGE_READWRITE, DWORD(uint64_t(MappedSize) >> 32), DWORD(MappedSize), nullptr);
+        auto Mapped = MappingHandle ? MapViewOfFile(MappingHandle, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, MappedSize) : nullptr;
+        if (!Mapped) {
+            if (MappingHandle) {
+                CloseHandle(MappingHandle);
+            }
+            CloseHandle(FileHandle);
+            return false;
+        }
+        File = FileHandle;
+        Mapping = MappingHandle;
+#else
+        auto FileHandle = open(Path.c_str(), O_RDWR | O_CLOEXEC | (Create ? O_CREAT : 0), 0600);
+        if (FileHandle < 0) {
+            return false;
+        }
+        if (Create) {
+            // Emptied only once it's known not to be someone else's file, then extended with zeros
+            FileHeader Existing{};
+            auto Read = pread(FileHandle, &Existing, sizeof(Existing), 0);
+            if (Read < 0 || !IsReusable(reinterpret_cast<const uint8_t*>(&Existing), size_t(Read)) ||
+                ftruncate(FileHandle, 0) != 0 || ftruncate(FileHandle, off_t(MappedSize)) != 0) {
+                close(FileHandle);
+                return false;
+            }
+        }
+        else {
+            struct stat Stat;
+            if (fstat(FileHandle, &Stat) != 0) {
+                close(FileHandle);
+                return false;
+            }
+            MappedSize = size_t(Stat.st_size);
+        }
+        if (MappedSize < sizeof(FileHeader)) {
+            close(FileHandle);
+            return false;
+        }
+
+        int Flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+        // Faulted in now rather than while showing toasts
+        Flags |= MAP_POPULATE;
+#endif
+        auto Mapped = mmap(nullptr, MappedSize, PROT_READ | PROT_WRITE, Flags, FileHandle, 0);
+        if (Mapped == MAP_FAILED) {
+            close(FileHandle);
+            return false;
+        }
+        File = FileHandle;
+#endif
+
+        View = static_cast<uint8_t*>(Mapped);
+        Size = MappedSize;
+        auto Header = reinterpret_cast<FileHeader*>(View);
+        if (Create) {
+            memcpy(Header->Magic, JournalMagic, sizeof(JournalMagic));
+            Header->Version = JournalVersion;
+            Header->HeaderSize = sizeof(FileHeader);
+            Header->Size = Size;
+        }
+        else if (memcmp(Header->Magic, JournalMagic, sizeof(JournalMagic)) != 0 || Header->Version != JournalVersion ||
+            Header->HeaderSize != sizeof(FileHeader) || Header->Size != Size) {
+            Unmap();
+            return false;
+        }
+        Tail = sizeof(FileHeader);
+        Flushed = 0;
+        EarlyCompactAt = Size - Size / 4;
+        return true;
+    }
+
+    void ToastJournal::Unmap()
+    {
+#ifdef _WIN32
+        if (View) {
+            UnmapViewOfFile(View);
+        }
+        if (Mapping) {
+            CloseHandle(Mapping);
+        }
+        if (File) {
+            CloseHandle(File);
+        }
+        Mapping = nullptr;
+        File = nullptr;
+#else
+        if (View) {
+            munmap(View, Size);
+        }
+        if (File >= 0) {
+            close(File);
+        }
+        File = -1;
+#endif
+        View = nullptr;
+        Size = 0;
+        Tail = 0;
+        Flushed = 0;
+        EarlyCompactAt = 0;
+        Unflushed = 0;
+    }
+
+    // Only what was appended since the last flush is handed over, from the start of its page
+    bool ToastJournal::FlushView(bool Wait)
+    {
+        Unflushed = 0;
+#ifdef _WIN32
+        // Flushing 0 bytes would flush the whole view
+        bool Written = (Tail == Flushed || FlushViewOfFile(View + Flushed, Tail - Flushed)) && (!Wait || FlushFileBuffers(File));
+#else
+        static const size_t PageSize = size_t(sysconf(_SC_PAGESIZE));
+        auto Start = Flushed / PageSize * PageSize;
+        bool Written = msync(View + Start, Tail - Start, Wait ? MS_SYNC : MS_ASYNC) == 0;
+#endif
+        if (Written) {
+            Flushed = Tail;
+        }
+        return Written;
+    }
+
+    void ToastJournal::Replay()
+    {
+        LiveRecords.clear();
+        Tail = sizeof(FileHeader);
+        while (Size - Tail >= sizeof(RecordHeader)) {
+            auto Record = reinterpret_cast<const RecordHeader*>(View + Tail);
+            if (Record->Size < sizeof(RecordHeader) || Record->Size % 8 != 0 || Record->Size > Size - Tail ||
+                sizeof(RecordHeader) + Record->TagSize + Record->GroupSize > Record->Size || GetChecksum(Record) != Record->Checksum) {
+                break;
+            }
+
+            switch (Record->Type)
+            {
+            case RecordType::Shown:
+                LiveRecords.insert_or_assign(Record->Id, Tail);
+                break;
+            case RecordType::Removed:
+                LiveRecords.erase(Record->Id);
+                break;
+            case RecordType::Cleared:
+                LiveRecords.clear();
+                break;
+            }
+            Tail += Record->Size;
+        }
+
+        // A record torn by a crash is cleared, so what's appended over it can't be mixed up with its leftovers
+        if (Size - Tail >= sizeof(RecordHeader)) {
+            static constexpr uint8_t Zeroes[sizeof(RecordHeader)] = {};
+            if (memcmp(View + Tail, Zeroes, sizeof(Zeroes)) != 0) {
+                memset(View + Tail, 0, Size - Tail);
+            }
+        }
+    }
+
+    bool ToastJournal::Append(RecordType Type, int64_t Id, int64_t ShownAt, std::string_view Tag, std::string_view Group)
+    {
+        if (!View) {
+            return false;
+        }
+
+        Tag = Tag.substr(0, UINT16_MAX);
+        Group = Group.substr(0, UINT16_MAX);
+        auto StringsSize = Tag.size() + Group.size();
+        auto RecordSize = AlignRecord(sizeof(RecordHeader) + StringsSize);
+        if (RecordSize > Size - Tail && !Compact(RecordSize)) {
+            return false;
+        }
+
+        // The strings go in first and the checksum last, though only the checksum decides whether it's read back
+        auto Record = reinterpret_cast<RecordHeader*>(View + Tail);
+        auto Strings = reinterpret_cast<char*>(Record + 1);
+        std::copy(Tag.begin(), Tag.end(), Strings);
+        std::copy(Group.begin(), Group.end(), Strings + Tag.size());
+        memset(Strings + StringsSize, 0, RecordSize - sizeof(RecordHeader) - StringsSize);
+        Record->Size = uint32_t(RecordSize);
+        Record->Id = Id;
+        Record->ShownAt = ShownAt;
+        Record->TagSize = uint16_t(Tag.size());
+        Record->GroupSize = uint16_t(Group.size());
+        Record->Type = Type;
+        memset(Record->Padding, 0, sizeof(Record->Padding));
+        Record->Checksum = GetChecksum(Record);
+
+        switch (Type)
+        {
+        case RecordType::Shown:
+            LiveRecords.insert_or_assign(Id, Tail);
+            break;
+        case RecordType::Removed:
+            LiveRecords.erase(Id);
+            break;
+        case RecordType::Cleared:
+            LiveRecords.clear();
+            break;
+        }
+        Tail += RecordSize;
+
+        if (++Unflushed >= FlushEvery) {
+            FlushView(false);
+        }
+        return true;
+    }
+
+    // The new file is written back before it replaces the old one, so a crash leaves one of them whole.
+    // Until the old one is unmapped, a failure leaves it open as it was. A leftover temporary file is
+    // a journal, so the next compaction starts it over.
+    bool ToastJournal::Compact(size_t MinSize)
+    {
+        size_t LiveSize = 0;
+        std::vector<std::pair<size_t, int64_t>> Order;
+        Order.reserve(LiveRecords.size());
+        for (auto& [Id, Offset] : LiveRecords) {
+            LiveSize += reinterpret_cast<const RecordHeader*>(View + Offset)->Size;
+            Order.emplace_back(Offset, Id);
+        }
+        std::sort(Order.begin(), Order.end());
+
+        // Grown if the live toasts would take up more than half of it
+        auto NewSize = std::max(Size, AlignRecord(sizeof(FileHeader) + 2 * (LiveSize + MinSize)));
+        auto TempPath = Path + ".tmp";
+        {
+            ToastJournal Compacted;
+            if (!Compacted.Map(TempPath, NewSize, true)) {
+                return false;
+            }
+            for (auto& [Offset, Id] : Order) {
+                auto RecordSize = reinterpret_cast<const RecordHeader*>(View + Offset)->Size;
+                memcpy(Compacted.View + Compacted.Tail, View + Offset, RecordSize);
+                Compacted.Tail += RecordSize;
+            }
+            if (!Compacted.FlushView(true)) {
+                return false;
+            }
+        }
+
+        // Windows can't replace a file that's still mapped
+        Unmap();
+#ifdef _WIN32
+        std::u16string WidePath, WideTempPath;
+        bool Renamed = Utf8ToUtf16(Path, WidePath) && Utf8ToUtf16(TempPath, WideTempPath) &&
+            MoveFileExW(reinterpret_cast<LPCWSTR>(WideTempPath.c_str()), reinterpret_cast<LPCWSTR>(WidePath.c_str()), MOVEFILE_REPLACE_EXISTING);
+#else
+        bool Renamed = rename(TempPath.c_str(), Path.c_str()) == 0;
+#endif
+        // If it wasn't replaced, this maps the old file again
+        if (!Map(Path, NewSize, false)) {
+            Close();
+            return false;
+        }
+        Replay();
+        return Renamed;
+    }
+
+    uint32_t ToastJournal::GetChecksum(const RecordHeader* Record)
+    {
+        auto Bytes = reinterpret_cast<const uint8_t*>(Record);
+        uint32_t Hash = 2166136261u;
+        for (size_t Idx = sizeof(Record->Checksum); Idx < Record->Size; ++Idx) {
+            Hash = (Hash ^ Bytes[Idx]) * 16777619u;
+        }
+        return Hash;
+    }
+}
@@ -0,0 +1,136 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace WinToastLib::Detail {
+    // Append-only journal of displayed toasts in a memory mapped file, so a restarted process can still hide
+    // the toasts it showed before. Appending is a copy into the mapping, the OS writes it back on its own,
+    // and it's only flushed explicitly every FlushEvery records. Records carry a checksum and reading stops
+    // at the first bad one, so a record torn by a crash is dropped along with everything after it.
+    //
+    // When the file fills up, the toasts still live are copied into a new file, which replaces the old one
+    // by renaming, so opening it again only reads those plus what was appended since.
+    // Not thread-safe, WinToast calls it under its lock.
+    class ToastJournal {
+    public:
+        struct LiveToast {
+            int64_t Id;
+            // Milliseconds since the epoch
+            int64_t ShownAt;
+            std::string Tag;
+            std::string Group;
+        };
+
+        // Appends between flushes
+        static constexpr uint32_t FlushEvery = 256;
+
+        ToastJournal();
+        ~ToastJournal();
+
+        ToastJournal(const ToastJournal&) = delete;
+        ToastJournal& operator=(const ToastJournal&) = delete;
+
+        // Maps the journal at Path, creating it with InitialSize bytes if it doesn't exist, is empty or is a journal
+        // of another version, and reads back the toasts it still has as live, oldest first. Fails rather than
+        // overwrite a file that isn't a journal.
+        bool Open(const std::string& Path, size_t InitialSize, std::vector<LiveToast>& Live);
+        void Close();
+        bool IsOpen() const;
+
+        // These return false if the record couldn't be written, when the file was full and compacting it failed.
+        // The journal stays open if the old file is still usable.
+        bool Shown(int64_t Id, int64_t ShownAt, std::string_view Tag, std::string_view Group);
+        bool Removed(int64_t Id);
+        bool Cleared();
+        // Hands what's been appended to the OS to write back, without waiting for it
+        void Flush();
+        // Whether it's three quarters full, so compacting it now saves Shown from having to once it's full.
+        // Compacting copies the live toasts and waits for the new file to be written back.
+        bool ShouldCompact() const;
+        // After a failure, it's only compacted again once it's full
+        bool CompactEarly();
+
+    private:
+        enum class RecordType : uint8_t {
+            Shown = 1,
+            Removed,
+            Cleared
+        };
+
+        // Followed by the tag and group, and padded to 8 bytes
+        struct RecordHeader {
+            // FNV-1a of the rest of the record
+            uint32_t Checksum;
+            uint32_t Size;
+            int64_t Id;
+            int64_t ShownAt;
+            uint16_t TagSize;
+            uint16_t GroupSize;
+            RecordType Type;
+            uint8_t Padding[3];
+        };
+
+        struct FileHeader {
+            char Magic[8];
+            uint32_t Version;
+            uint32_t HeaderSize;
+            uint64_t Size;
+        };
+
+        // Maps an existing journal (validating its header) or creates one with InitialSize bytes,
+        // reusing the file only if it's empty, zeroed or a journal
+        bool Map(const std::string& Path, size_t InitialSize, bool Create);
+        void Unmap();
+        // Wait also waits for it to be written back, though not for earlier flushes
+        bool FlushView(bool Wait);
+        // Reads the records after the header, leaving Tail past the last good one
+        void Replay();
+        bool Append(RecordType Type, int64_t Id, int64_t ShownAt, std::string_view Tag, std::string_view Group);
+        // Rewrites the file with only the live toasts' records, in at least MinSize bytes
+        bool Compact(size_t MinSize);
+        static uint32_t GetChecksum(const RecordHeader* Record);
+
+        std::string Path;
+        uint8_t* View;
+        size_t Size;
+        size_t Tail;
+        // Everything before it was already handed to the OS
+        size_t Flushed;
+        // Tail past which ShouldCompact
+        size_t EarlyCompactAt;
+        // Offsets of the live toasts' Shown records
+        std::unordered_map<int64_t, size_t> LiveRecords;
+        uint32_t Unflushed;
+#ifdef _WIN32
+        void* File;
+        void* Mapping;
+#else
+        int File;
+#endif
+    };
+}
@@ -0,0 +1,220 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "toastpayload.h"
+
+#include <charconv>
+
+namespace WinToastLib::Detail {
+    const Skeleton& GetSkeleton(TemplateType Type)
+    {
+        static constexpr Skeleton Skeletons[] = {
+            CreateSkeleton(TemplateType::ImageAndText01),
+            CreateSkeleton(TemplateType::ImageAndText02),
+            CreateSkeleton(TemplateType::ImageAndText03),
+            CreateSkeleton(TemplateType::ImageAndText04),
+            CreateSkeleton(TemplateType::Text01),
+            CreateSkeleton(TemplateType::Text02),
+            CreateSkeleton(TemplateType::Text03),
+            CreateSkeleton(TemplateType::Text04)
+        };
+        return Skeletons[int(Type)];
+    }
+
+    bool PayloadBuilder::Build(const Template& Toast, bool ModernFeatures)
+    {
+        Buffer.clear();
+
+        auto TextFieldCount = GetTextFieldCount(Toast.Type);
+        if (TextFieldCount == 0) {
+            FailedField = FieldType::Type;
+            FailedFieldIdx = -1;
+            return false;
+        }
+        // Overflowed fields were dropped, so the first one that didn't fit is at capacity
+        if (Toast.TextFields.size() > TextFieldCount || Toast.TextFields.overflowed()) {
+            FailedField = FieldType::Text;
+            FailedFieldIdx = int(TextFieldCount);
+            return false;
+        }
+        if (Toast.Actions.overflowed()) {
+            FailedField = FieldType::Action;
+            FailedFieldIdx = int(Toast.Actions.capacity());
+            return false;
+        }
+        if (Toast.Data.overflowed()) {
+            FailedField = FieldType::Data;
+            FailedFieldIdx = int(Toast.Data.capacity());
+            return false;
+        }
+        if (!Toast.Data.empty() && Toast.Tag.empty()) {
+            FailedField = FieldType::Tag;
+            FailedFieldIdx = -1;
+            return false;
+        }
+        FailedField = FieldType::None;
+        FailedFieldIdx = -1;
+
+        auto& Layout = GetSkeleton(Toast.Type);
+        auto Xml = Layout.GetXml();
+        size_t Copied = 0;
+        for (auto& Slot : Layout.GetSlots()) {
+            Buffer.append(Xml, Copied, Slot.Offset - Copied);
+            Copied = Slot.Offset;
+            FillSlot(Toast, ModernFeatures, Slot.Type, Slot.Index);
+        }
+        Buffer.append(Xml, Copied);
+
+        return true;
+    }
+
+    void PayloadBuilder::FillSlot(const Template& Toast, bool ModernFeatures, Skeleton::SlotType Type, uint8_t Index)
+    {
+        switch (Type)
+        {
+        case Skeleton::SlotType::ToastAttributes:
+        {
+            // Actions and progress bars need ToastGeneric. Adding actions also defaults to a long duration.
+            bool HasActions = ModernFeatures && !Toast.Actions.empty();
+            bool HasProgress = ModernFeatures && !Toast.Progress.Value.empty();
+            if (HasActions || HasProgress) {
+                Append(" template=\"ToastGeneric\"");
+            }
+            if (ModernFeatures && Toast.Duration != Duration::System) {
+                Append(Toast.Duration == Duration::Short ? " duration=\"short\"" : " duration=\"long\"");
+            }
+            else if (HasActions) {
+                Append(" duration=\"long\"");
+            }
+            break;
+        }
+        case Skeleton::SlotType::Image:
+            AppendEscaped(Toast.ImagePath);
+            break;
+        case Skeleton::SlotType::Text:
+            if (Index < Toast.TextFields.size()) {
+                AppendEscaped(Toast.TextFields[Index]);
+            }
+            break;
+        case Skeleton::SlotType::Attribution:
+            if (ModernFeatures && !Toast.AttributionText.empty()) {
+                Append("<text placement=\"attribution\">");
+                AppendEscaped(Toast.AttributionText);
+                Append("</text>");
+            }
+            break;
+        case Skeleton::SlotType::Progress:
+            if (ModernFeatures && !Toast.Progress.Value.empty()) {
+                Append("<progress");
+                if (!Toast.Progress.Title.empty()) {
+                    Append(" title=\"");
+                    AppendEscaped(Toast.Progress.Title);
+                    Append("\"");
+                }
+                Append(" value=\"");
+                AppendEscaped(Toast.Progress.Value);
+                Append("\"");
+                if (!Toast.Progress.ValueStringOverride.empty()) {
+                    Append(" valueStringOverride=\"");
+                    AppendEscaped(Toast.Progress.ValueStringOverride);
+                    Append("\"");
+                }
+                // Status is required
+                Append(" status=\"");
+                AppendEscaped(Toast.Progress.Status);
+                Append("\"/>");
+            }
+            break;
+        case Skeleton::SlotType::Actions:
+            if (ModernFeatures && !Toast.Actions.empty()) {
+                Append("<actions>");
+                for (size_t Idx = 0; Idx < Toast.Actions.size(); ++Idx) {
+                    Append("<action content=\"");
+                    AppendEscaped(Toast.Actions[Idx]);
+                    Append("\" arguments=\"");
+                    char Arguments[24];
+                    auto [End, Ec] = std::to_chars(Arguments, Arguments + sizeof(Arguments), Idx);
+                    Append(std::string_view(Arguments, End - Arguments));
+                    Append("\"/>");
+                }
+                Append("</actions>");
+            }
+            break;
+        case Skeleton::SlotType::Audio:
+            if (ModernFeatures && (!Toast.AudioPath.empty() || Toast.AudioFile || Toast.AudioOption != AudioOption::Default)) {
+                Append("<audio");
+                if (!Toast.AudioPath.empty()) {
+                    Append(" src=\"");
+                    AppendEscaped(Toast.AudioPath);
+                    Append("\"");
+                }
+                // The table's URIs don't need escaping
+                else if (Toast.AudioFile) {
+                    Append(" src=\"");
+                    Append(GetAudioSystemFilePath(*Toast.AudioFile));
+                    Append("\"");
+                }
+                if (Toast.AudioOption != AudioOption::Default) {
+                    Append(Toast.AudioOption == AudioOption::Silent ? " silent=\"true\"" : " loop=\"true\"");
+                }
+                Append("/>");
+            }
+            break;
+        }
+    }
+
+    void PayloadBuilder::Append(std::string_view String)
+    {
+        Buffer.append(String);
+    }
+
+    void PayloadBuilder::AppendEscaped(std::string_view String)
+    {
+        size_t Start = 0;
+        for (size_t Idx = 0; Idx < String.size(); ++Idx) {
+            std::string_view Entity;
+            switch (String[Idx])
+            {
+            case '&':
+                Entity = "&amp;";
+                break;
+            case '<':
+                Entity = "&lt;";
+                break;
+            case '>':
+                Entity = "&gt;";
+                break;
+            case '"':
+                Entity = "&quot;";
+                break;
+            case '\'':
+                Entity = "&apos;";
+                break;
+            default:
+                continue;
+            }
+
+            Buffer.append(String.data() + Start, Idx - Start);
+            Buffer.append(Entity);
+            Start = Idx + 1;
+        }
+        Buffer.append(String.data() + Start, String.size() - Start);
+    }
+}
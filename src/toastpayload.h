@@ -0,0 +1,200 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "toasttypes.h"
+
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace WinToastLib::Detail {
+    // The fixed XML of a legacy template, built at compile time for each TemplateType,
+    // along with the offsets where the per-toast content gets spliced in
+    struct Skeleton {
+        // Enough for the largest template, CreateSkeleton doesn't compile if it's exceeded
+        static constexpr size_t MaxSize = 256;
+        static constexpr size_t MaxSlots = 12;
+
+        enum class SlotType : uint8_t {
+            ToastAttributes,
+            Image,
+            Text,
+            Attribution,
+            Progress,
+            Actions,
+            Audio
+        };
+
+        struct Slot {
+            size_t Offset;
+            SlotType Type;
+            uint8_t Index;
+        };
+
+        char Xml[MaxSize]{};
+        size_t XmlSize = 0;
+        Slot Slots[MaxSlots]{};
+        size_t SlotCount = 0;
+
+        constexpr std::string_view GetXml() const noexcept
+        {
+            return { Xml, XmlSize };
+        }
+
+        constexpr std::span<const Slot> GetSlots() const noexcept
+        {
+            return { Slots, SlotCount };
+        }
+    };
+
+    const Skeleton& GetSkeleton(TemplateType Type);
+
+    // Serializes a Template into toast XML in a single pass by filling the slots of its skeleton.
+    // The output matches what filling the legacy template through the XML DOM produces,
+    // so it can be handed to IXmlDocumentIO::LoadXml as is.
+    // The internal buffer is reused between calls to avoid reallocating on every toast.
+    class PayloadBuilder {
+    public:
+        // Returns false if the toast doesn't fit its template (e.g. too many text fields)
+        bool Build(const Template& Toast, bool ModernFeatures);
+
+        std::string_view GetPayload() const noexcept
+        {
+            return Buffer;
+        }
+
+        // The field that made the last Build fail, and its index (-1 for FieldType::Type and FieldType::Tag)
+        FieldType GetFailedField() const noexcept
+        {
+            return FailedField;
+        }
+
+        int GetFailedFieldIdx() const noexcept
+        {
+            return FailedFieldIdx;
+        }
+
+    private:
+        void FillSlot(const Template& Toast, bool ModernFeatures, Skeleton::SlotType Type, uint8_t Index);
+        void Append(std::string_view String);
+        void AppendEscaped(std::string_view String);
+
+        std::string Buffer;
+        FieldType FailedField = FieldType::None;
+        int FailedFieldIdx = -1;
+    };
+
+    // Number of <text> slots in a legacy template
+    constexpr size_t GetTextFieldCount(TemplateType Type) noexcept
+    {
+        switch (Type)
+        {
+        case TemplateType::ImageAndText01:
+        case TemplateType::Text01:
+            return 1;
+        case TemplateType::ImageAndText02:
+        case TemplateType::Text02:
+        case TemplateType::ImageAndText03:
+        case TemplateType::Text03:
+            return 2;
+        case TemplateType::ImageAndText04:
+        case TemplateType::Text04:
+            return 3;
+        default:
+            return 0;
+        }
+    }
+
+    constexpr bool HasImageField(TemplateType Type) noexcept
+    {
+        return Type <= TemplateType::ImageAndText04;
+    }
+
+    constexpr std::string_view GetTemplateName(TemplateType Type) noexcept
+    {
+        switch (Type)
+        {
+        case TemplateType::ImageAndText01:
+            return "ToastImageAndText01";
+        case TemplateType::ImageAndText02:
+            return "ToastImageAndText02";
+        case TemplateType::ImageAndText03:
+            return "ToastImageAndText03";
+        case TemplateType::ImageAndText04:
+            return "ToastImageAndText04";
+        case TemplateType::Text01:
+            return "ToastText01";
+        case TemplateType::Text02:
+            return "ToastText02";
+        case TemplateType::Text03:
+            return "ToastText03";
+        case TemplateType::Text04:
+            return "ToastText04";
+        default:
+            return "";
+        }
+    }
+
+    // Overflowing Skeleton::MaxSize or MaxSlots writes out of bounds, which isn't a constant expression
+    constexpr Skeleton CreateSkeleton(TemplateType Type)
+    {
+        Skeleton Ret;
+        auto Append = [&Ret](std::string_view String) {
+            for (auto Char : String) {
+                Ret.Xml[Ret.XmlSize++] = Char;
+            }
+        };
+        auto AddSlot = [&Ret](Skeleton::SlotType Slot, uint8_t Index = 0) {
+            Ret.Slots[Ret.SlotCount++] = { Ret.XmlSize, Slot, Index };
+        };
+
+        Append("<toast");
+        AddSlot(Skeleton::SlotType::ToastAttributes);
+        Append("><visual><binding template=\"");
+        Append(GetTemplateName(Type));
+        Append("\">");
+
+        if (HasImageField(Type)) {
+            Append("<image id=\"1\" src=\"");
+            AddSlot(Skeleton::SlotType::Image);
+            Append("\"/>");
+        }
+
+        for (size_t Idx = 0; Idx < GetTextFieldCount(Type); ++Idx) {
+            const char Id[] = { char('1' + Idx), '\0' };
+            Append("<text id=\"");
+            Append(Id);
+            Append("\">");
+            AddSlot(Skeleton::SlotType::Text, uint8_t(Idx));
+            Append("</text>");
+        }
+
+        AddSlot(Skeleton::SlotType::Attribution);
+        AddSlot(Skeleton::SlotType::Progress);
+        Append("</binding></visual>");
+        AddSlot(Skeleton::SlotType::Actions);
+        AddSlot(Skeleton::SlotType::Audio);
+        Append("</toast>");
+
+        return Ret;
+    }
+}
@@ -0,0 +1,100 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "toastpayload.h"
+
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace WinToastLib {
+    // A Template with its TemplateType fixed at compile time, so the wrong number of text fields, an image on a
+    // text-only template or too many actions don't compile instead of failing when it's shown. The template's
+    // XML is built at compile time as well (see Detail::CreateSkeleton), showing it only copies in the text.
+    // Converts to const Template&, so it can be passed to ShowToast and the rest as is. The other fields are set
+    // on Get(), which shouldn't be used to change its Type or TextFields.
+    template<TemplateType Type>
+    class Toast {
+    public:
+        static_assert(Detail::GetTextFieldCount(Type) != 0, "Type isn't a toast template");
+
+        static constexpr size_t TextFieldCount = Detail::GetTextFieldCount(Type);
+        static constexpr bool HasImage = Detail::HasImageField(Type);
+
+        template<class... Lines>
+            requires (sizeof...(Lines) == TextFieldCount && (std::is_constructible_v<std::string, Lines&&> && ...))
+        explicit Toast(Lines&&... Text)
+        {
+            Value.Type = Type;
+            (Value.TextFields.emplace_back(std::forward<Lines>(Text)), ...);
+        }
+
+        template<size_t Idx>
+            requires (Idx < TextFieldCount)
+        Toast& SetText(std::string Text)
+        {
+            Value.TextFields[Idx] = std::move(Text);
+            return *this;
+        }
+
+        Toast& SetImage(std::string Path) requires HasImage
+        {
+            Value.ImagePath = std::move(Path);
+            return *this;
+        }
+
+        template<class... Names>
+            requires (sizeof...(Names) <= MaxActions && (std::is_constructible_v<std::string, Names&&> && ...))
+        Toast& SetActions(Names&&... Actions)
+        {
+            Value.Actions.clear();
+            (Value.Actions.emplace_back(std::forward<Names>(Actions)), ...);
+            return *this;
+        }
+
+        Toast& SetAudio(AudioSystemFile File, AudioOption Option = AudioOption::Default)
+        {
+            Value.AudioPath.clear();
+            Value.AudioFile = File;
+            Value.AudioOption = Option;
+            return *this;
+        }
+
+        Template& Get() noexcept
+        {
+            return Value;
+        }
+
+        const Template& Get() const noexcept
+        {
+            return Value;
+        }
+
+        operator const Template&() const noexcept
+        {
+            return Value;
+        }
+
+    private:
+        Template Value;
+    };
+}
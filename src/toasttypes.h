@@ -0,0 +1,233 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "fixedvector.h"
+#include "inlinefunction.h"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Platform independent types shared by the toast API and the payload serializer.
+// Enum values mirror their ABI::Windows::UI::Notifications counterparts.
+namespace WinToastLib {
+    enum class Duration : uint8_t {
+        System,
+        Short,
+        Long
+    };
+
+    enum class AudioOption : uint8_t {
+        Default,
+        Silent,
+        Loop
+    };
+
+    enum class AudioSystemFile : uint8_t {
+        DefaultSound,
+        IM,
+        Mail,
+        Reminder,
+        SMS,
+        Alarm,
+        Alarm2,
+        Alarm3,
+        Alarm4,
+        Alarm5,
+        Alarm6,
+        Alarm7,
+        Alarm8,
+        Alarm9,
+        Alarm10,
+        Call,
+        Call1,
+        Call2,
+        Call3,
+        Call4,
+        Call5,
+        Call6,
+        Call7,
+        Call8,
+        Call9,
+        Call10
+    };
+
+    namespace Detail {
+        // Indexed by AudioSystemFile
+        constexpr std::array<std::string_view, size_t(AudioSystemFile::Call10) + 1> AudioSystemFilePaths = {
+            "ms-winsoundevent:Notification.Default",
+            "ms-winsoundevent:Notification.IM",
+            "ms-winsoundevent:Notification.Mail",
+            "ms-winsoundevent:Notification.Reminder",
+            "ms-winsoundevent:Notification.SMS",
+            "ms-winsoundevent:Notification.Looping.Alarm",
+            "ms-winsoundevent:Notification.Looping.Alarm2",
+            "ms-winsoundevent:Notification.Looping.Alarm3",
+            "ms-winsoundevent:Notification.Looping.Alarm4",
+            "ms-winsoundevent:Notification.Looping.Alarm5",
+            "ms-winsoundevent:Notification.Looping.Alarm6",
+            "ms-winsoundevent:Notification.Looping.Alarm7",
+            "ms-winsoundevent:Notification.Looping.Alarm8",
+            "ms-winsoundevent:Notification.Looping.Alarm9",
+            "ms-winsoundevent:Notification.Looping.Alarm10",
+            "ms-winsoundevent:Notification.Looping.Call",
+            "ms-winsoundevent:Notification.Looping.Call1",
+            "ms-winsoundevent:Notification.Looping.Call2",
+            "ms-winsoundevent:Notification.Looping.Call3",
+            "ms-winsoundevent:Notification.Looping.Call4",
+            "ms-winsoundevent:Notification.Looping.Call5",
+            "ms-winsoundevent:Notification.Looping.Call6",
+            "ms-winsoundevent:Notification.Looping.Call7",
+            "ms-winsoundevent:Notification.Looping.Call8",
+            "ms-winsoundevent:Notification.Looping.Call9",
+            "ms-winsoundevent:Notification.Looping.Call10"
+        };
+    }
+
+    // Empty for values outside AudioSystemFile
+    constexpr std::string_view GetAudioSystemFilePath(AudioSystemFile File) noexcept
+    {
+        return size_t(File) < Detail::AudioSystemFilePaths.size() ? Detail::AudioSystemFilePaths[size_t(File)] : std::string_view();
+    }
+
+    enum class TemplateType : int {
+        // 1 text field
+        ImageAndText01 = 0, // ToastTemplateType_ToastImageAndText01
+        Text01 = 4,         // ToastTemplateType_ToastText01
+        // 2 text fields
+        ImageAndText02 = 1, // ToastTemplateType_ToastImageAndText02
+        Text02 = 5,         // ToastTemplateType_ToastText02
+        ImageAndText03 = 2, // ToastTemplateType_ToastImageAndText03
+        Text03 = 6,         // ToastTemplateType_ToastText03
+        // 3 text fields
+        ImageAndText04 = 3, // ToastTemplateType_ToastImageAndText04
+        Text04 = 7          // ToastTemplateType_ToastText04
+    };
+
+    enum class DismissalReason : int {
+        UserCanceled = 0,      // ToastDismissalReason_UserCanceled
+        ApplicationHidden = 1, // ToastDismissalReason_ApplicationHidden
+        TimedOut = 2           // ToastDismissalReason_TimedOut
+    };
+
+    // Which toasts give way first when Options.MaxInFlight is reached
+    enum class Priority : uint8_t {
+        Low,
+        Normal,
+        High,
+        Urgent
+    };
+
+    constexpr size_t PriorityCount = 4;
+
+    enum class Error : uint8_t {
+        Success,
+        SystemNotSupported,
+        ComInitFailed,
+        InvalidAppUserModelID,
+        NotInitialized,
+        ComError,
+        InvalidHandler,
+        NotDisplayed,
+        IdNotFound,
+        CouldNotHide,
+        InvalidArgument,
+        CouldNotUpdate,
+        // Refused by admission control, see Options.MaxInFlight
+        Overloaded,
+        // Options.JournalPath couldn't be opened or created, or (as a recorded failure) written to
+        JournalFailed,
+    };
+
+    // Which part of a Template a failure is about
+    enum class FieldType : uint8_t {
+        None,
+        Type,
+        Text,
+        Action,
+        Tag,
+        Data
+    };
+
+    // Legacy templates have up to 3 text fields, and Windows shows at most 5 actions
+    constexpr size_t MaxTextFields = 3;
+    constexpr size_t MaxActions = 5;
+    constexpr size_t MaxDataFields = 8;
+
+    // A value bound into a toast wherever "{Key}" appears in its text or progress bar
+    struct DataField {
+        std::string Key;
+        std::string Value;
+    };
+
+    // Same as DataField, but only refers to the strings, for passing values in without copying them first
+    struct DataValue {
+        std::string_view Key;
+        std::string_view Value;
+    };
+
+    // Only shown with modern features, and only if Value is set. Value is from 0.0 to 1.0 or "indeterminate".
+    // Parts can be bound to data, e.g. Value = "{progressValue}".
+    struct ProgressBar {
+        std::string Title;
+        std::string Value;
+        std::string ValueStringOverride;
+        std::string Status;
+    };
+
+    // Fields are stored inline, so building and moving a Template doesn't allocate
+    // beyond what its strings need (short ones fit in their small buffer).
+    struct Template {
+        TemplateType Type = TemplateType::Text01;
+        Detail::FixedVector<std::string, MaxTextFields> TextFields;
+        Detail::FixedVector<std::string, MaxActions> Actions;
+        std::string ImagePath;
+        std::string AudioPath;
+        // A system sound, used if AudioPath is empty. Its URI is a constant, so nothing is copied for it.
+        std::optional<AudioSystemFile> AudioFile;
+        std::string AttributionText;
+        ProgressBar Progress;
+        // Initial values of the bound "{Key}"s, which UpdateToast changes while the toast is displayed.
+        // A toast with data needs a Tag, since that's how the platform finds it to update.
+        Detail::FixedVector<DataField, MaxDataFields> Data;
+        // Toasts sharing a tag and group replace each other instead of stacking up. Toasts with only
+        // a group all stay displayed, the group just lets ClearGroup remove them together.
+        std::string Tag;
+        std::string Group;
+        // Milliseconds after a tagged toast is shown during which new toasts with the same tag and group
+        // are dropped without any platform work, returning the displayed toast's id instead
+        int64_t CoalesceWindow = 0;
+        int64_t Expiration = 0;
+        WinToastLib::Priority Priority = WinToastLib::Priority::Normal;
+        WinToastLib::AudioOption AudioOption = WinToastLib::AudioOption::Default;
+        WinToastLib::Duration Duration = WinToastLib::Duration::System;
+    };
+
+    // Callbacks keep captures of up to 6 pointers inline, so copying a Handler doesn't allocate
+    struct Handler {
+        Detail::InlineFunction<void(int ActionIdx)> OnClicked = [](int) {};
+        Detail::InlineFunction<void(DismissalReason Reason)> OnDismissed = [](DismissalReason) {};
+        Detail::InlineFunction<void()> OnFailed = []() {};
+    };
+}
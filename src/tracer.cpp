@@ -0,0 +1,189 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "tracer.h"
+
+#include <cstdio>
+
+namespace WinToastLib {
+    namespace {
+        std::atomic<uint64_t> NextTracerSerial = 1;
+
+        // The buffer the calling thread last used, and the tracer it belongs to.
+        // Serials aren't reused, so a new tracer at a freed one's address doesn't match.
+        struct ThreadBufferCache {
+            uint64_t Serial = 0;
+            void* Buffer = nullptr;
+        };
+
+        thread_local ThreadBufferCache CachedBuffer;
+
+        int64_t ToNs(std::chrono::steady_clock::time_point Time)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(Time.time_since_epoch()).count();
+        }
+
+        void AppendEscaped(std::string& Out, const char* String)
+        {
+            for (; *String; ++String) {
+                if (*String == '"' || *String == '\\') {
+                    Out += '\\';
+                }
+                if (uint8_t(*String) >= 0x20) {
+                    Out += *String;
+                }
+            }
+        }
+    }
+
+    Tracer::Tracer(size_t EventsPerThread) :
+        Serial(NextTracerSerial.fetch_add(1, std::memory_order_relaxed)),
+        EventsPerThread(EventsPerThread),
+        Dropped(0)
+    {
+
+    }
+
+    Tracer::~Tracer() = default;
+
+    void Tracer::Begin(const char* Name, int64_t Id)
+    {
+        Record('B', Name, Id, std::chrono::steady_clock::now());
+    }
+
+    void Tracer::End(const char* Name, int64_t Id)
+    {
+        Record('E', Name, Id, std::chrono::steady_clock::now());
+    }
+
+    void Tracer::Complete(const char* Name, std::chrono::steady_clock::time_point Since, std::chrono::steady_clock::time_point Until, int64_t Id)
+    {
+        Record('X', Name, Id, Since, ToNs(Until) - ToNs(Since));
+    }
+
+    void Tracer::Instant(const char* Name, int64_t Id)
+    {
+        Record('i', Name, Id, std::chrono::steady_clock::now());
+    }
+
+    void Tracer::AsyncBegin(const char* Name, int64_t Id)
+    {
+        Record('b', Name, Id, std::chrono::steady_clock::now());
+    }
+
+    void Tracer::AsyncEnd(const char* Name, int64_t Id)
+    {
+        Record('e', Name, Id, std::chrono::steady_clock::now());
+    }
+
+    void Tracer::Record(char Phase, const char* Name, int64_t Id, std::chrono::steady_clock::time_point Time, int64_t Duration)
+    {
+        auto& Buffer = GetThreadBuffer();
+        auto Count = Buffer.Count.load(std::memory_order_relaxed);
+        if (Count == EventsPerThread) {
+            Dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        Buffer.Events[Count] = { Name, Id, ToNs(Time), Duration, Phase };
+        Buffer.Count.store(Count + 1, std::memory_order_release);
+    }
+
+    Tracer::ThreadBuffer& Tracer::GetThreadBuffer()
+    {
+        if (CachedBuffer.Serial == Serial) {
+            return *static_cast<ThreadBuffer*>(CachedBuffer.Buffer);
+        }
+
+        // First event from this thread, or it used another tracer since
+        std::lock_guard Lock(Mutex);
+        auto ThreadId = std::this_thread::get_id();
+        ThreadBuffer* Found = nullptr;
+        for (auto& Buffer : Buffers) {
+            if (Buffer->Thread == ThreadId) {
+                Found = Buffer.get();
+                break;
+            }
+        }
+        if (!Found) {
+            auto& Created = Buffers.emplace_back(new ThreadBuffer{ ThreadId, uint32_t(Buffers.size() + 1), std::make_unique<TraceEvent[]>(EventsPerThread), 0 });
+            Found = Created.get();
+        }
+
+        CachedBuffer = { Serial, Found };
+        return *Found;
+    }
+
+    void Tracer::ExportChromeTrace(std::string& Out) const
+    {
+        std::lock_guard Lock(Mutex);
+        Out += "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool First = true;
+        char Number[96];
+        for (auto& Buffer : Buffers) {
+            auto Count = Buffer->Count.load(std::memory_order_acquire);
+            for (size_t Idx = 0; Idx < Count; ++Idx) {
+                auto& Event = Buffer->Events[Idx];
+                Out += First ? "\n" : ",\n";
+                First = false;
+
+                Out += "{\"name\":\"";
+                AppendEscaped(Out, Event.Name);
+                snprintf(Number, sizeof(Number), "\",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%lld.%03d", Event.Phase, Buffer->Tid, (long long)(Event.Timestamp / 1000), int(Event.Timestamp % 1000));
+                Out += Number;
+                if (Event.Phase == 'X') {
+                    snprintf(Number, sizeof(Number), ",\"dur\":%lld.%03d", (long long)(Event.Duration / 1000), int(Event.Duration % 1000));
+                    Out += Number;
+                }
+                if (Event.Phase == 'i') {
+                    Out += ",\"s\":\"t\"";
+                }
+                if (Event.Phase == 'b' || Event.Phase == 'e') {
+                    snprintf(Number, sizeof(Number), ",\"cat\":\"toast\",\"id\":\"0x%llx\"", (unsigned long long)Event.Id);
+                    Out += Number;
+                }
+                if (Event.Id) {
+                    snprintf(Number, sizeof(Number), ",\"args\":{\"id\":%lld}", (long long)Event.Id);
+                    Out += Number;
+                }
+                Out += '}';
+            }
+        }
+        Out += "\n]}\n";
+    }
+
+    bool Tracer::ExportChromeTrace(const std::string& Path) const
+    {
+        std::string Json;
+        ExportChromeTrace(Json);
+
+        FILE* File = fopen(Path.c_str(), "wb");
+        if (!File) {
+            return false;
+        }
+        bool Written = fwrite(Json.data(), 1, Json.size(), File) == Json.size();
+        return fclose(File) == 0 && Written;
+    }
+
+    uint64_t Tracer::GetDroppedCount() const
+    {
+        return Dropped.load(std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,91 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace WinToastLib {
+    // Records timeline events into per-thread buffers and exports them as Chrome Trace Event JSON
+    // (chrome://tracing, Perfetto). Hand one to WinToast through Options::Trace to see every toast
+    // go from ShowToast's stages to being shown, and then clicked, dismissed, failed or hidden.
+    // The application can record its own work on the same tracer, so both line up on one timeline.
+    //
+    // Each thread writes into its own fixed-size buffer without locking. When it's full,
+    // further events from that thread are dropped and counted.
+    // Names must outlive the tracer, string literals are the intended use.
+    class Tracer {
+    public:
+        explicit Tracer(size_t EventsPerThread = 1 << 16);
+        ~Tracer();
+
+        Tracer(const Tracer&) = delete;
+        Tracer& operator=(const Tracer&) = delete;
+
+        // Nested spans on the calling thread
+        void Begin(const char* Name, int64_t Id = 0);
+        void End(const char* Name, int64_t Id = 0);
+        // A span that has already finished
+        void Complete(const char* Name, std::chrono::steady_clock::time_point Since, std::chrono::steady_clock::time_point Until, int64_t Id = 0);
+        void Instant(const char* Name, int64_t Id = 0);
+        // Spans that can start and end on different threads, matched by Name and Id
+        void AsyncBegin(const char* Name, int64_t Id);
+        void AsyncEnd(const char* Name, int64_t Id);
+
+        // Appends {"traceEvents": [...]} to Out. Events being recorded concurrently may be left out.
+        void ExportChromeTrace(std::string& Out) const;
+        bool ExportChromeTrace(const std::string& Path) const;
+
+        uint64_t GetDroppedCount() const;
+
+    private:
+        struct TraceEvent {
+            const char* Name;
+            int64_t Id;
+            int64_t Timestamp;
+            int64_t Duration;
+            char Phase;
+        };
+
+        // Written only by its thread, Count publishes the events before it
+        struct ThreadBuffer {
+            std::thread::id Thread;
+            uint32_t Tid;
+            std::unique_ptr<TraceEvent[]> Events;
+            std::atomic<size_t> Count;
+        };
+
+        void Record(char Phase, const char* Name, int64_t Id, std::chrono::steady_clock::time_point Time, int64_t Duration = 0);
+        ThreadBuffer& GetThreadBuffer();
+
+        const uint64_t Serial;
+        const size_t EventsPerThread;
+        mutable std::mutex Mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> Buffers;
+        std::atomic<uint64_t> Dropped;
+    };
+}
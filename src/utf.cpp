@@ -0,0 +1,186 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "utf.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WINTOAST_UTF_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+// vmaxvq_u8 only exists on AArch64, 32 bit ARM falls back to the scalar loop
+#define WINTOAST_UTF_NEON
+#include <arm_neon.h>
+#endif
+
+namespace WinToastLib::Detail {
+    template<class CharT>
+    size_t WidenAscii(const uint8_t* Input, size_t Size, CharT* Output) noexcept
+    {
+        size_t Idx = 0;
+#if defined(WINTOAST_UTF_SSE2)
+        const __m128i Zero = _mm_setzero_si128();
+        for (; Idx + 16 <= Size; Idx += 16) {
+            __m128i Chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Input + Idx));
+            if (_mm_movemask_epi8(Chunk) != 0) {
+                break;
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(Output + Idx), _mm_unpacklo_epi8(Chunk, Zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(Output + Idx + 8), _mm_unpackhi_epi8(Chunk, Zero));
+        }
+#elif defined(WINTOAST_UTF_NEON)
+        for (; Idx + 16 <= Size; Idx += 16) {
+            uint8x16_t Chunk = vld1q_u8(Input + Idx);
+            if (vmaxvq_u8(Chunk) >= 0x80) {
+                break;
+            }
+            vst1q_u16(reinterpret_cast<uint16_t*>(Output + Idx), vmovl_u8(vget_low_u8(Chunk)));
+            vst1q_u16(reinterpret_cast<uint16_t*>(Output + Idx + 8), vmovl_u8(vget_high_u8(Chunk)));
+        }
+#else
+        for (; Idx + 8 <= Size; Idx += 8) {
+            uint64_t Chunk;
+            memcpy(&Chunk, Input + Idx, sizeof(Chunk));
+            if (Chunk & 0x8080808080808080ull) {
+                break;
+            }
+            for (size_t Byte = 0; Byte < 8; ++Byte) {
+                Output[Idx + Byte] = CharT(Input[Idx + Byte]);
+            }
+        }
+#endif
+        return Idx;
+    }
+
+    template<class CharT>
+    size_t Transcode(std::string_view String, CharT* Output) noexcept
+    {
+        auto Input = reinterpret_cast<const uint8_t*>(String.data());
+        auto Size = String.size();
+        size_t Idx = 0;
+        size_t Written = 0;
+
+        while (Idx < Size) {
+            auto Ascii = WidenAscii(Input + Idx, Size - Idx, Output + Written);
+            Idx += Ascii;
+            Written += Ascii;
+
+            while (Idx < Size) {
+                uint8_t Lead = Input[Idx];
+                if (Lead < 0x80) {
+                    Output[Written++] = CharT(Lead);
+                    ++Idx;
+                    // Go back to the bulk path once we're in a run of ASCII again
+                    if (Idx + 16 <= Size && Input[Idx] < 0x80) {
+                        break;
+                    }
+                    continue;
+                }
+
+                uint32_t CodePoint;
+                size_t Length;
+                uint32_t Min;
+                if ((Lead & 0xE0) == 0xC0) {
+                    CodePoint = Lead & 0x1F;
+                    Length = 2;
+                    Min = 0x80;
+                }
+                else if ((Lead & 0xF0) == 0xE0) {
+                    CodePoint = Lead & 0x0F;
+                    Length = 3;
+                    Min = 0x800;
+                }
+                else if ((Lead & 0xF8) == 0xF0) {
+                    CodePoint = Lead & 0x07;
+                    Length = 4;
+                    Min = 0x10000;
+                }
+                else {
+                    return InvalidUtf8;
+                }
+
+                if (Size - Idx < Length) {
+                    return InvalidUtf8;
+                }
+
+                for (size_t Cont = 1; Cont < Length; ++Cont) {
+                    uint8_t Byte = Input[Idx + Cont];
+                    if ((Byte & 0xC0) != 0x80) {
+                        return InvalidUtf8;
+                    }
+                    CodePoint = (CodePoint << 6) | (Byte & 0x3F);
+                }
+
+                if (CodePoint < Min || CodePoint > 0x10FFFF || (CodePoint >= 0xD800 && CodePoint <= 0xDFFF)) {
+                    return InvalidUtf8;
+                }
+
+                if (CodePoint >= 0x10000) {
+                    CodePoint -= 0x10000;
+                    Output[Written++] = CharT(0xD800 | (CodePoint >> 10));
+                    Output[Written++] = CharT(0xDC00 | (CodePoint & 0x3FF));
+                }
+                else {
+                    Output[Written++] = CharT(CodePoint);
+                }
+                Idx += Length;
+            }
+        }
+
+        return Written;
+    }
+
+    size_t GetUtf16Length(std::string_view Input) noexcept
+    {
+        // Every byte but continuation bytes starts a code unit, 4 byte sequences need a surrogate pair
+        size_t Length = 0;
+        for (unsigned char Byte : Input) {
+            Length += (Byte & 0xC0) != 0x80;
+            Length += Byte >= 0xF0;
+        }
+        return Length;
+    }
+
+    size_t Utf8ToUtf16(std::string_view Input, char16_t* Output) noexcept
+    {
+        return Transcode(Input, Output);
+    }
+
+#if WCHAR_MAX == 0xFFFF
+    size_t Utf8ToUtf16(std::string_view Input, wchar_t* Output) noexcept
+    {
+        return Transcode(Input, Output);
+    }
+#endif
+
+    bool Utf8ToUtf16(std::string_view Input, std::u16string& Output)
+    {
+        Output.resize(Input.size());
+        auto Written = Utf8ToUtf16(Input, Output.data());
+        if (Written == InvalidUtf8) {
+            Output.clear();
+            return false;
+        }
+        Output.resize(Written);
+        return true;
+    }
+}
@@ -0,0 +1,45 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cwchar>
+#include <string>
+#include <string_view>
+
+namespace WinToastLib::Detail {
+    constexpr size_t InvalidUtf8 = size_t(-1);
+
+    // Number of UTF-16 code units Input transcodes to, assuming it's valid UTF-8
+    size_t GetUtf16Length(std::string_view Input) noexcept;
+
+    // Transcodes UTF-8 to UTF-16, validating as it goes (overlong forms, surrogates and
+    // code points past U+10FFFF are rejected). Output needs room for GetUtf16Length(Input)
+    // code units, Input.size() is always enough. Returns the number of code units written,
+    // or InvalidUtf8. Runs of ASCII are widened 16 bytes at a time with SSE2/NEON when available.
+    size_t Utf8ToUtf16(std::string_view Input, char16_t* Output) noexcept;
+#if WCHAR_MAX == 0xFFFF
+    size_t Utf8ToUtf16(std::string_view Input, wchar_t* Output) noexcept;
+#endif
+
+    // Returns false (and leaves Output empty) if Input isn't valid UTF-8
+    bool Utf8ToUtf16(std::string_view Input, std::u16string& Output);
+}
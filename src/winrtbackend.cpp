@@ -0,0 +1,677 @@
+/* * Copyright (C) 2016-2019 Mohammed Boujemaoui <mohabouje@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "wintoastlib.h"
+#include "resolvedobjects.h"
+#include "utf.h"
+
+#ifdef _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <wrl/event.h>
+#include <wrl/implements.h>
+#include <windows.ui.notifications.h>
+#include <VersionHelpers.h>
+#include <Shobjidl.h>
+
+#pragma comment(lib,"shlwapi")
+#pragma comment(lib,"user32")
+#pragma comment(lib,"WindowsApp")
+
+namespace WinToastLib::Detail {
+    using namespace ABI::Windows::Data::Xml::Dom;
+    using namespace ABI::Windows::Foundation;
+    using namespace ABI::Windows::UI::Notifications;
+    using namespace Microsoft::WRL;
+    using namespace Windows::Foundation;
+
+    // FILETIME ticks (100 ns since 1601) of the time source's current time
+    int64_t GetCurrentTicks(const TimeSource& TimeSource)
+    {
+        constexpr int64_t UnixEpochTicks = 116444736000000000;
+        using Ticks = std::chrono::duration<int64_t, std::ratio<1, 10000000>>;
+        return UnixEpochTicks + std::chrono::duration_cast<Ticks>(TimeSource().time_since_epoch()).count();
+    }
+
+    class DateTimeImpl : public IReference<DateTime> {
+    public:
+        DateTimeImpl(DateTime DateTime) :
+            Impl(DateTime)
+        {
+
+        }
+
+        DateTimeImpl(int64_t MillisecondsFromNow, const TimeSource& TimeSource) :
+            Impl{ GetCurrentTicks(TimeSource) + MillisecondsFromNow * 10000 }
+        {
+            
+        }
+
+        //~DateTimeImpl() = default;
+
+    protected:
+        HRESULT STDMETHODCALLTYPE get_Value(DateTime* DateTime) override
+        {
+            *DateTime = Impl;
+            return S_OK;
+        }
+
+        HRESULT STDMETHODCALLTYPE QueryInterface(const IID& riid, void** ppvObject) override
+        {
+            if (!ppvObject) {
+                return E_POINTER;
+            }
+            if (riid == __uuidof(IUnknown) || riid == __uuidof(IReference<DateTime>)) {
+                *ppvObject = static_cast<IUnknown*>(static_cast<IReference<DateTime>*>(this));
+                return S_OK;
+            }
+            return E_NOINTERFACE;
+        }
+
+        ULONG STDMETHODCALLTYPE Release() override
+        {
+            return 1;
+        }
+
+        ULONG STDMETHODCALLTYPE AddRef() override
+        {
+            return 2;
+        }
+
+        HRESULT STDMETHODCALLTYPE GetIids(ULONG*, IID**) override
+        {
+            return E_NOTIMPL;
+        }
+
+        HRESULT STDMETHODCALLTYPE GetRuntimeClassName(HSTRING*) override
+        {
+            return E_NOTIMPL;
+        }
+
+        HRESULT STDMETHODCALLTYPE GetTrustLevel(TrustLevel*) override
+        {
+            return E_NOTIMPL;
+        }
+
+    private:
+        DateTime Impl;
+    };
+
+    // Invalid UTF-8 goes through the system converter instead, which substitutes U+FFFD
+    std::wstring ToWide(std::string_view String)
+    {
+        std::wstring Ret(String.size(), L'\0');
+        auto Written = Utf8ToUtf16(String, Ret.data());
+        if (Written == InvalidUtf8) {
+            Written = MultiByteToWideChar(CP_UTF8, 0, String.data(), int(String.size()), Ret.data(), int(Ret.size()));
+        }
+        Ret.resize(Written);
+        return Ret;
+    }
+
+    PCWSTR AsWidePtr(HSTRING HString) {
+        return WindowsGetStringRawBuffer(HString, nullptr);
+    }
+
+    class StringWrapper {
+    public:
+        StringWrapper(PCWSTR String, size_t Size) noexcept
+        {
+            Create(String, Size);
+        }
+
+        StringWrapper(const std::wstring& String) noexcept :
+            StringWrapper(String.c_str(), String.size())
+        {
+
+        }
+
+        // Transcodes straight into the HSTRING's own buffer, so the text is only copied once
+        StringWrapper(std::string_view String) noexcept :
+            HString(nullptr)
+        {
+            if (String.empty()) {
+                return;
+            }
+
+            // Invalid input can count as no code units, it's left to ToWide's replacement characters
+            auto Length = GetUtf16Length(String);
+            PWSTR Buffer;
+            HSTRING_BUFFER BufferHandle;
+            if (Length > 0 && SUCCEEDED(WindowsPreallocateStringBuffer(UINT32(Length), &Buffer, &BufferHandle))) {
+                if (Utf8ToUtf16(String, Buffer) == Length && SUCCEEDED(WindowsPromoteStringBuffer(BufferHandle, &HString))) {
+                    return;
+                }
+                WindowsDeleteStringBuffer(BufferHandle);
+            }
+
+            auto Wide = ToWide(String);
+            Create(Wide.c_str(), Wide.size());
+        }
+
+        ~StringWrapper()
+        {
+            WindowsDeleteString(HString);
+        }
+
+        StringWrapper(const StringWrapper&) = delete;
+        StringWrapper& operator=(const StringWrapper&) = delete;
+
+        operator HSTRING() const noexcept
+        {
+            return HString;
+        }
+
+    private:
+        void Create(PCWSTR String, size_t Size) noexcept
+        {
+            HRESULT HResult = WindowsCreateString(String, UINT32(Size), &HString);
+            if (FAILED(HResult)) {
+                RaiseException(STATUS_INVALID_PARAMETER, EXCEPTION_NONCONTINUABLE, 0, NULL);
+            }
+        }
+
+        HSTRING HString;
+    };
+
+    // Fast-pass HSTRING over a string literal, which doesn't allocate or copy anything
+    class StringReference {
+    public:
+        template<size_t Size>
+        StringReference(const wchar_t (&String)[Size]) noexcept
+        {
+            HRESULT HResult = WindowsCreateStringReference(String, Size - 1, &Header, &HString);
+            if (FAILED(HResult)) {
+                RaiseException(STATUS_INVALID_PARAMETER, EXCEPTION_NONCONTINUABLE, 0, NULL);
+            }
+        }
+
+        StringReference(const StringReference&) = delete;
+        StringReference& operator=(const StringReference&) = delete;
+
+        operator HSTRING() const noexcept
+        {
+            return HString;
+        }
+
+    private:
+        HSTRING_HEADER Header;
+        HSTRING HString;
+    };
+
+    // One COM object receives all three events of a toast, so the handler is stored once
+    // and registering costs a single allocation
+    class ToastEventSink : public RuntimeClass<RuntimeClassFlags<ClassicCom>,
+        ITypedEventHandler<ToastNotification*, IInspectable*>,
+        ITypedEventHandler<ToastNotification*, ToastDismissedEventArgs*>,
+        ITypedEventHandler<ToastNotification*, ToastFailedEventArgs*>> {
+    public:
+        ToastEventSink(WinToastLib::Handler&& EventHandler, const WinToastLib::TimeSource& TimeSource) :
+            EventHandler(std::move(EventHandler)),
+            TimeSource(TimeSource)
+        {
+
+        }
+
+        IFACEMETHODIMP Invoke(IToastNotification* Notification, IInspectable* Inspectable) override
+        {
+            ComPtr<IToastActivatedEventArgs> ActivatedEventArgs;
+            auto Result = Inspectable->QueryInterface(ActivatedEventArgs.GetAddressOf());
+            if (FAILED(Result)) {
+                return Result;
+            }
+
+            HSTRING ArgumentsHandle;
+            Result = ActivatedEventArgs->get_Arguments(&ArgumentsHandle);
+            if (FAILED(Result)) {
+                return Result;
+            }
+
+            PCWSTR Arguments = AsWidePtr(ArgumentsHandle);
+            EventHandler.OnClicked(Arguments && *Arguments ? wcstol(Arguments, nullptr, 10) : -1);
+            return S_OK;
+        }
+
+        IFACEMETHODIMP Invoke(IToastNotification* Notification, IToastDismissedEventArgs* DismissedEventArgs) override
+        {
+            ToastDismissalReason Reason;
+            auto Result = DismissedEventArgs->get_Reason(&Reason);
+            if (FAILED(Result)) {
+                return Result;
+            }
+
+            DateTime ExpirationTime{};
+            {
+                ComPtr<IReference<DateTime>> ExpirationTimeRef;
+                Notification->get_ExpirationTime(&ExpirationTimeRef);
+                if (ExpirationTimeRef) {
+                    ExpirationTimeRef->get_Value(&ExpirationTime);
+                }
+            }
+
+            if (Reason == ToastDismissalReason_UserCanceled && ExpirationTime.UniversalTime && GetCurrentTicks(TimeSource) >= ExpirationTime.UniversalTime) {
+                Reason = ToastDismissalReason_TimedOut;
+            }
+            EventHandler.OnDismissed(static_cast<WinToastLib::DismissalReason>(Reason));
+            return S_OK;
+        }
+
+        IFACEMETHODIMP Invoke(IToastNotification* Notification, IToastFailedEventArgs* FailedEventArgs) override
+        {
+            EventHandler.OnFailed();
+            return S_OK;
+        }
+
+    private:
+        WinToastLib::Handler EventHandler;
+        WinToastLib::TimeSource TimeSource;
+    };
+
+    HRESULT SetEventHandlers(ComPtr<IToastNotification>& Notification, WinToastLib::Handler&& EventHandler, const TimeSource& TimeSource) {
+        auto Sink = Make<ToastEventSink>(std::move(EventHandler), TimeSource);
+        if (!Sink) {
+            return E_OUTOFMEMORY;
+        }
+
+        EventRegistrationToken ActivatedToken;
+        auto Result = Notification->add_Activated(Sink.Get(), &ActivatedToken);
+        if (FAILED(Result)) {
+            return Result;
+        }
+
+        EventRegistrationToken DismissedToken;
+        Result = Notification->add_Dismissed(Sink.Get(), &DismissedToken);
+        if (FAILED(Result)) {
+            return Result;
+        }
+
+        EventRegistrationToken FailedToken;
+        return Notification->add_Failed(Sink.Get(), &FailedToken);
+    }
+
+    // Bound values for a new toast or an update
+    HRESULT CreateNotificationData(std::span<const DataField> Data, uint32_t SequenceNumber, ComPtr<INotificationData>& NotificationData)
+    {
+        auto Result = ActivateInstance(StringReference(RuntimeClass_Windows_UI_Notifications_NotificationData), &NotificationData);
+        if (FAILED(Result)) {
+            return Result;
+        }
+
+        ComPtr<ABI::Windows::Foundation::Collections::IMap<HSTRING, HSTRING>> Values;
+        Result = NotificationData->get_Values(&Values);
+        if (FAILED(Result)) {
+            return Result;
+        }
+
+        for (auto& Field : Data) {
+            boolean Replaced;
+            Result = Values->Insert(StringWrapper(Field.Key), StringWrapper(Field.Value), &Replaced);
+            if (FAILED(Result)) {
+                return Result;
+            }
+        }
+
+        return NotificationData->put_SequenceNumber(SequenceNumber);
+    }
+
+    static_assert(int(TemplateType::ImageAndText01) == ToastTemplateType_ToastImageAndText01);
+    static_assert(int(TemplateType::ImageAndText02) == ToastTemplateType_ToastImageAndText02);
+    static_assert(int(TemplateType::ImageAndText03) == ToastTemplateType_ToastImageAndText03);
+    static_assert(int(TemplateType::ImageAndText04) == ToastTemplateType_ToastImageAndText04);
+    static_assert(int(TemplateType::Text01) == ToastTemplateType_ToastText01);
+    static_assert(int(TemplateType::Text02) == ToastTemplateType_ToastText02);
+    static_assert(int(TemplateType::Text03) == ToastTemplateType_ToastText03);
+    static_assert(int(TemplateType::Text04) == ToastTemplateType_ToastText04);
+    static_assert(int(DismissalReason::UserCanceled) == ToastDismissalReason_UserCanceled);
+    static_assert(int(DismissalReason::ApplicationHidden) == ToastDismissalReason_ApplicationHidden);
+    static_assert(int(DismissalReason::TimedOut) == ToastDismissalReason_TimedOut);
+
+    static_assert(IsDisconnected(RPC_E_DISCONNECTED) && IsDisconnected(RPC_E_SERVER_DIED) && IsDisconnected(RPC_E_SERVER_DIED_DNE) && IsDisconnected(CO_E_OBJNOTCONNECTED));
+
+    // What Initialize resolves once for every call after it
+    struct PlatformObjects {
+        ComPtr<IToastNotificationManagerStatics> Manager;
+        ComPtr<IToastNotifier> Notifier;
+        ComPtr<IToastNotificationFactory> Factory;
+    };
+
+    class WinRTNotification : public Backend::Notification {
+    public:
+        WinRTNotification(ComPtr<IToastNotification>&& Impl) :
+            Impl(std::move(Impl))
+        {
+
+        }
+
+        // A recovered toast, there's no object for it in this process
+        WinRTNotification(std::string_view Tag, std::string_view Group) :
+            Tag(Tag),
+            Group(Group)
+        {
+
+        }
+
+        ComPtr<IToastNotification> Impl;
+        std::string Tag;
+        std::string Group;
+    };
+
+    class WinRTBackend : public Backend {
+    public:
+        WinRTBackend() :
+            Coinitialized(false),
+            Resolved([this](PlatformObjects& Objects) { return Resolve(Objects); })
+        {
+
+        }
+
+        ~WinRTBackend() override
+        {
+            Resolved.Reset();
+            if (Coinitialized) {
+                CoUninitialize();
+            }
+        }
+
+        Error Initialize(const std::string& Aumi, const WinToastLib::TimeSource& TimeSource) override
+        {
+            if (!IsWindows8OrGreater()) {
+                return Error::SystemNotSupported;
+            }
+
+            if (!Coinitialized) {
+                auto Result = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+
+                if (Result == CO_E_NOTINITIALIZED) {
+                    return Error::ComInitFailed;
+                }
+                Coinitialized = true;
+            }
+
+            this->Aumi = Aumi;
+            this->TimeSource = TimeSource;
+            if (FAILED(SetCurrentProcessExplicitAppUserModelID(ToWide(Aumi).c_str()))) {
+                return Error::InvalidAppUserModelID;
+            }
+
+            ModernFeatures = IsWindows10OrGreater();
+
+            return FAILED(Resolved.Resolve()) ? Error::ComError : Error::Success;
+        }
+
+        bool SupportsModernFeatures() const override
+        {
+            return ModernFeatures;
+        }
+
+        int32_t CreateNotification(const Template& Toast, std::string_view Payload, std::unique_ptr<Notification>& Notification) override
+        {
+            ComPtr<IXmlDocument> Document;
+            auto Result = ActivateInstance(StringReference(RuntimeClass_Windows_Data_Xml_Dom_XmlDocument), &Document);
+            if (FAILED(Result)) {
+                return Result;
+            }
+
+            ComPtr<IXmlDocumentIO> DocumentIO;
+            Result = Document.As(&DocumentIO);
+            if (FAILED(Result)) {
+                return Result;
+            }
+
+            Result = DocumentIO->LoadXml(StringWrapper(Payload));
+            if (FAILED(Result)) {
+                return Result;
+            }
+
+            ComPtr<IToastNotification> Impl;
+            Result = Resolved.Call([&](PlatformObjects& Objects) {
+                return Objects.Factory->CreateToastNotification(Document.Get(), &Impl);
+            });
+            if (FAILED(Result)) {
+                return Result;
+            }
+
+            if (Toast.Expiration != 0) {
+                DateTimeImpl ExpirationTime(Toast.Expiration, TimeSource);
+                Result = Impl->put_ExpirationTime(&ExpirationTime);
+                if (FAILED(Result)) {
+                    return Result;
+                }
+            }
+
+            if (!Toast.Tag.empty() || !Toast.Group.empty()) {
+                ComPtr<IToastNotification2> Impl2;
+                Result = Impl.As(&Impl2);
+                if (FAILED(Result)) {
+                    return Result;
+                }
+
+                if (!Toast.Tag.empty()) {
+                    Result = Impl2->put_Tag(StringWrapper(Toast.Tag));
+                    if (FAILED(Result)) {
+                        return Result;
+                    }
+                }
+
+                if (!Toast.Group.empty()) {
+                    Result = Impl2->put_Group(StringWrapper(Toast.Group));
+                    if (FAILED(Result)) {
+                        return Result;
+                    }
+                }
+            }
+
+            if (!Toast.Data.empty()) {
+                ComPtr<IToastNotification4> Impl4;
+                Result = Impl.As(&Impl4);
+                if (FAILED(Result)) {
+                    return Result;
+                }
+
+                ComPtr<INotificationData> Data;
+                Result = CreateNotificationData(Toast.Data, 0, Data);
+                if (FAILED(Result)) {
+                    return Result;
+                }
+
+                Result = Impl4->put_Data(Data.Get());
+                if (FAILED(Result)) {
+                    return Result;
+                }
+            }
+
+            Notification = std::make_unique<WinRTNotification>(std::move(Impl));
+            return S_OK;
+        }
+
+        int32_t RegisterHandler(Notification& Notification, Handler&& Handler) override
+        {
+            return SetEventHandlers(static_cast<WinRTNotification&>(Notification).Impl, std::move(Handler), TimeSource);
+        }
+
+        int32_t Show(Notification& Notification) override
+        {
+            auto& Toast = static_cast<WinRTNotification&>(Notification).Impl;
+            return Resolved.Call([&](PlatformObjects& Objects) {
+                return Objects.Notifier->Show(Toast.Get());
+            });
+        }
+
+        int32_t Hide(Notification& Notification) override
+        {
+            auto& Toast = static_cast<WinRTNotification&>(Notification);
+            if (!Toast.Impl) {
+                return RemoveFromHistory(Toast.Tag, Toast.Group);
+            }
+
+            return Resolved.Call([&](PlatformObjects& Objects) {
+                return Objects.Notifier->Hide(Toast.Impl.Get());
+            });
+        }
+
+        int32_t Update(std::string_view Tag, std::string_view Group, std::span<const DataField> Data, uint32_t SequenceNumber) override
+        {
+            ComPtr<INotificationData> NotificationData;
+            auto Result = CreateNotificationData(Data, SequenceNumber, NotificationData);
+            if (FAILED(Result)) {
+                return Result;
+            }
+
+            StringWrapper TagString(Tag);
+            StringWrapper GroupString(Group);
+            NotificationUpdateResult Updated = NotificationUpdateResult_Succeeded;
+            Result = Resolved.Call([&](PlatformObjects& Objects) {
+                ComPtr<IToastNotifier2> Notifier2;
+                auto QueryResult = Objects.Notifier.As(&Notifier2);
+                if (FAILED(QueryResult)) {
+                    return QueryResult;
+                }
+                return Notifier2->UpdateWithTagAndGroup(NotificationData.Get(), TagString, GroupString, &Updated);
+            });
+            if (FAILED(Result)) {
+                return Result;
+            }
+
+            switch (Updated)
+            {
+            case NotificationUpdateResult_NotificationNotFound:
+                return S_FALSE;
+            case NotificationUpdateResult_Failed:
+                return E_FAIL;
+            default:
+                return S_OK;
+            }
+        }
+
+        std::unique_ptr<Notification> Recover(std::string_view Tag, std::string_view Group) override
+        {
+            return std::make_unique<WinRTNotification>(Tag, Group);
+        }
+
+        int32_t RemoveGroup(std::string_view Group) override
+        {
+            StringWrapper GroupString(Group);
+            StringWrapper AumiString(Aumi);
+            return WithHistory([&](IToastNotificationHistory* History) {
+                return History->RemoveGroupWithId(GroupString, AumiString);
+            });
+        }
+
+        int32_t RemoveAll() override
+        {
+            StringWrapper AumiString(Aumi);
+            return WithHistory([&](IToastNotificationHistory* History) {
+                return History->ClearWithId(AumiString);
+            });
+        }
+
+    private:
+        HRESULT RemoveFromHistory(std::string_view Tag, std::string_view Group)
+        {
+            StringWrapper TagString(Tag);
+            StringWrapper GroupString(Group);
+            StringWrapper AumiString(Aumi);
+            return WithHistory([&](IToastNotificationHistory* History) {
+                return History->RemoveGroupedTagWithId(TagString, GroupString, AumiString);
+            });
+        }
+
+        // Calls Func with the notification history, resolving again if the platform went away
+        template<class F>
+        HRESULT WithHistory(F&& Func)
+        {
+            return Resolved.Call([&](PlatformObjects& Objects) {
+                ComPtr<IToastNotificationManagerStatics2> Manager2;
+                auto QueryResult = Objects.Manager.As(&Manager2);
+                if (FAILED(QueryResult)) {
+                    return QueryResult;
+                }
+
+                ComPtr<IToastNotificationHistory> History;
+                QueryResult = Manager2->get_History(&History);
+                if (FAILED(QueryResult)) {
+                    return QueryResult;
+                }
+                return Func(History.Get());
+            });
+        }
+
+        // Creates the manager, notifier and notification factory into Objects, which is only swapped in if this succeeds
+        HRESULT Resolve(PlatformObjects& Objects)
+        {
+            auto Result = GetActivationFactory(StringReference(RuntimeClass_Windows_UI_Notifications_ToastNotificationManager), &Objects.Manager);
+            if (FAILED(Result)) {
+                return Result;
+            }
+
+            Result = Objects.Manager->CreateToastNotifierWithId(StringWrapper(Aumi), &Objects.Notifier);
+            if (FAILED(Result)) {
+                return Result;
+            }
+
+            return GetActivationFactory(StringReference(RuntimeClass_Windows_UI_Notifications_ToastNotification), &Objects.Factory);
+        }
+
+        bool Coinitialized;
+        bool ModernFeatures = false;
+        std::string Aumi;
+        WinToastLib::TimeSource TimeSource;
+        ResolvedObjects<PlatformObjects> Resolved;
+    };
+}
+
+namespace WinToastLib {
+    std::unique_ptr<Backend> CreateDefaultBackend()
+    {
+        return std::make_unique<Detail::WinRTBackend>();
+    }
+
+    bool WinToast::IsCompatible()
+    {
+        return IsWindows8OrGreater();
+    }
+
+    bool WinToast::SupportsModernFeatures()
+    {
+        return IsWindows10OrGreater();
+    }
+}
+
+#else
+
+namespace WinToastLib {
+    std::unique_ptr<Backend> CreateDefaultBackend()
+    {
+        return nullptr;
+    }
+
+    bool WinToast::IsCompatible()
+    {
+        return false;
+    }
+
+    bool WinToast::SupportsModernFeatures()
+    {
+        return false;
+    }
+}
+
+#endif
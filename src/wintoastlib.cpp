@@ -20,868 +20,1620 @@
 
 #include "wintoastlib.h"
 
-#include <wrl/event.h>
-#include <filesystem>
-#include <iostream>
-#include <VersionHelpers.h>
-#include <Shobjidl.h>
+#include <algorithm>
 
-#pragma comment(lib,"shlwapi")
-#pragma comment(lib,"user32")
-#pragma comment(lib,"WindowsApp")
+namespace WinToastLib {
+    // Everything is passed through one pointer so the queued std::function stays in its small buffer
+    template<class F>
+    Error WinToast::RunOnWorker(F&& Task)
+    {
+        struct {
+            F& Task;
+            Error Result;
+            std::atomic<bool> Done;
+        } Call{ Task, Error::Success, false };
+
+        QueueWork([Call = &Call]() {
+            Call->Result = Call->Task();
+            Call->Done.store(true, std::memory_order_release);
+            Call->Done.notify_one();
+        });
+        Call.Done.wait(false, std::memory_order_acquire);
+        return Call.Result;
+    }
+
+    WinToast::WinToast(const std::string& Aumi, const WinToastLib::Options& Options) :
+        WinToast(Aumi, CreateDefaultBackend(), Options)
+    {
 
-namespace Detail {
-    using namespace ABI::Windows::Data::Xml::Dom;
-    using namespace ABI::Windows::Foundation;
-    using namespace ABI::Windows::UI::Notifications;
-    using namespace Microsoft::WRL;
+    }
 
-    int64_t GetCurrentTicks()
+    WinToast::WinToast(const std::string& Aumi, std::unique_ptr<Backend> Backend, const WinToastLib::Options& Options) :
+        Initialized(false),
+        Aumi(Aumi),
+        Options(Options),
+        Platform(std::move(Backend)),
+        State(std::make_shared<SharedState>()),
+        BufferBytes(0),
+        FinishedCount(0),
+        ExpiredCount(0),
+        EvictedCount(0),
+        SuppressedCount(0),
+        ReplacedCount(0),
+        Latencies(std::make_unique<Detail::LatencyHistogram[]>(StageCount)),
+        Trace(Options.Trace.get()),
+        OtherHResultFailures(0),
+        FailureCount(0),
+        NextUpdateAt(std::chrono::steady_clock::time_point::max()),
+        UpdatesReceived(0),
+        UpdatesSent(0),
+        UpdatesStale(0),
+        NextScheduledAt(std::chrono::steady_clock::time_point::max()),
+        NextExpiryAt(std::chrono::steady_clock::time_point::max()),
+        AdmissionsPending(0),
+        AdmissionWaiters{},
+        AdmissionWaiting(0),
+        AdmittedCount(0),
+        QueuedCount(0),
+        ShedCount(0),
+        DisplacedCount(0),
+        StopWorker(false),
+        WorkerSleeping(false),
+        WorkQueued(0),
+        WorkCompleted(0),
+        WorkLatencyTotal(0),
+        WorkLatencyMax(0)
     {
-        FILETIME Now;
-        GetSystemTimeAsFileTime(&Now);
-        return ((((INT64)Now.dwHighDateTime) << 32) | Now.dwLowDateTime);
+        if (!this->Options.TimeSource) {
+            this->Options.TimeSource = []() { return std::chrono::system_clock::now(); };
+        }
+        auto Now = GetTick(this->Options.TimeSource(), false);
+        Scheduled = Detail::TimingWheel<ScheduledToast>(Now);
+        Expiries = Detail::TimingWheel<int64_t>(Now);
+
+        State->Owner = this;
+        State->CallbackExecutor = Options.CallbackExecutor;
+        State->Trace = Options.Trace;
+        if (Options.EventQueueSize) {
+            State->Events = std::make_unique<Detail::MpscRing<Event>>(Options.EventQueueSize);
+        }
+
+        if (Options.UseWorkerThread) {
+            Worker = std::thread(&WinToast::RunWorker, this);
+        }
     }
 
-    class DateTimeImpl : public IReference<DateTime> {
-    public:
-        DateTimeImpl(DateTime DateTime) :
-            Impl(DateTime)
+    WinToast::~WinToast()
+    {
         {
+            std::lock_guard Lock(State->Mutex);
+            State->Owner = nullptr;
+        }
 
+        if (Worker.joinable()) {
+            // The worker tears down the backend itself, so COM is uninitialized on the right thread
+            QueueWork([this]() { StopWorker = true; });
+            Worker.join();
         }
 
-        DateTimeImpl(int64_t MillisecondsFromNow) :
-            Impl{ GetCurrentTicks() + MillisecondsFromNow * 10000 }
-        {
-            
+        // Notifications have to be released before the backend tears down COM
+        Buffer.Clear();
+        Platform.reset();
+    }
+
+    Error WinToast::Initialize()
+    {
+        if (Options.UseWorkerThread && !IsOnWorker()) {
+            return RunOnWorker([this]() { return Initialize(); });
         }
 
-        //~DateTimeImpl() = default;
+        if (Initialized) {
+            return Error::Success;
+        }
 
-    protected:
-        HRESULT STDMETHODCALLTYPE get_Value(DateTime* DateTime) override
-        {
-            *DateTime = Impl;
-            return S_OK;
+        if (!Platform) {
+            return Error::SystemNotSupported;
         }
 
-        HRESULT STDMETHODCALLTYPE QueryInterface(const IID& riid, void** ppvObject) override
-        {
-            if (!ppvObject) {
-                return E_POINTER;
-            }
-            if (riid == __uuidof(IUnknown) || riid == __uuidof(IReference<DateTime>)) {
-                *ppvObject = static_cast<IUnknown*>(static_cast<IReference<DateTime>*>(this));
-                return S_OK;
+        auto Result = Platform->Initialize(Aumi, Options.TimeSource);
+        if (Result != Error::Success) {
+            return Result;
+        }
+
+        if (!Options.JournalPath.empty()) {
+            Result = RecoverToasts();
+            if (Result != Error::Success) {
+                return Result;
             }
-            return E_NOINTERFACE;
         }
 
-        ULONG STDMETHODCALLTYPE Release() override
-        {
-            return 1;
+        Initialized = true;
+        return Error::Success;
+    }
+
+    bool WinToast::IsInitialized() const
+    {
+        return Initialized;
+    }
+
+    Error WinToast::ShowToast(const Template& Toast, const Handler& Handler, int64_t* Id)
+    {
+        ToastResult Result;
+        auto Error = ShowToast(Toast, Handler, Result);
+        if (Error == Error::Success && Id != nullptr) {
+            *Id = Result.Id;
         }
+        return Error;
+    }
 
-        ULONG STDMETHODCALLTYPE AddRef() override
-        {
-            return 2;
+    // Waiting for a slot happens on the calling thread, before going to the worker, so the worker isn't held up
+    Error WinToast::ShowToast(const Template& Toast, const Handler& Handler, ToastResult& Result)
+    {
+        if (!Options.MaxInFlight || Options.AdmissionPolicy != AdmissionPolicy::Block) {
+            return ShowAdmitted(Toast, Handler, Result);
         }
 
-        HRESULT STDMETHODCALLTYPE GetIids(ULONG*, IID**) override
-        {
-            return E_NOTIMPL;
+        Result = {};
+        if (!IsInitialized()) {
+            return Result.Error = Error::NotInitialized;
         }
 
-        HRESULT STDMETHODCALLTYPE GetRuntimeClassName(HSTRING*) override
-        {
-            return E_NOTIMPL;
+        if (Admit(Toast.Priority, !IsOnWorker()) != Error::Success) {
+            return Result.Error = Error::Overloaded;
         }
+        auto Shown = ShowAdmitted(Toast, Handler, Result);
+        ReleaseAdmission();
+        return Shown;
+    }
 
-        HRESULT STDMETHODCALLTYPE GetTrustLevel(TrustLevel*) override
-        {
-            return E_NOTIMPL;
+    Error WinToast::ShowAdmitted(const Template& Toast, const Handler& Handler, ToastResult& Result)
+    {
+        if (Options.UseWorkerThread && !IsOnWorker()) {
+            return RunOnWorker([&]() { return ShowAdmitted(Toast, Handler, Result); });
         }
 
-    private:
-        DateTime Impl;
-    };
+        Result = {};
+        if (!IsInitialized()) {
+            return Result.Error = Error::NotInitialized;
+        }
 
-    std::wstring ToWide(const std::string& String)
-    {
-        return std::filesystem::path(String).wstring();
+        auto Start = std::chrono::steady_clock::now();
+        if (NextExpiryAt.load(std::memory_order_relaxed) <= Start) {
+            SweepExpired();
+            Start = std::chrono::steady_clock::now();
+        }
+        if (auto Coalesced = FindCoalesced(Toast)) {
+            Result.Id = Coalesced;
+            RecordLatency(Stage::ShowToast, Start);
+            return Result.Error = Error::Success;
+        }
+
+        // After coalescing, which takes no slot
+        bool Admitted = Options.MaxInFlight && Options.AdmissionPolicy != AdmissionPolicy::Block;
+        if (Admitted && Admit(Toast.Priority, false) != Error::Success) {
+            RecordLatency(Stage::ShowToast, Start);
+            return Result.Error = Error::Overloaded;
+        }
+
+        BufferEntry Entry;
+        auto Clock = Start;
+        Result.Error = CreateToast(Toast, Entry, Clock, Result.Failure);
+        if (Result.Error == Error::Success) {
+            Result.Error = PostToast(std::move(Entry), Handler, Result.Id, Clock, Result.Failure);
+        }
+        if (Admitted) {
+            ReleaseAdmission();
+        }
+
+        RecordLatency(Stage::ShowToast, Start, Clock, Result.Id);
+        return Result.Error;
     }
 
-    PCWSTR AsWidePtr(HSTRING HString) {
-        return WindowsGetStringRawBuffer(HString, nullptr);
+    Error WinToast::ShowToasts(std::span<const Template> Toasts, const Handler& Handler, std::span<ToastResult> Results)
+    {
+        return ShowToasts(Toasts, std::span<const WinToastLib::Handler>(&Handler, 1), Results);
     }
 
-    class StringWrapper {
-    public:
-        StringWrapper(const std::wstring& String) noexcept
-        {
-            HRESULT HResult = WindowsCreateString(String.c_str(), String.size(), &HString);
-            if (FAILED(HResult)) {
-                RaiseException(STATUS_INVALID_PARAMETER, EXCEPTION_NONCONTINUABLE, 0, NULL);
-            }
+    Error WinToast::ShowToasts(std::span<const Template> Toasts, std::span<const Handler> Handlers, std::span<ToastResult> Results)
+    {
+        if (Options.UseWorkerThread && !IsOnWorker()) {
+            return RunOnWorker([&]() { return ShowToasts(Toasts, Handlers, Results); });
         }
 
-        StringWrapper(PCWSTR String, size_t Size) noexcept :
-            StringWrapper(std::wstring(String, Size))
-        {
+        if (!IsInitialized()) {
+            return Error::NotInitialized;
+        }
 
+        if (Results.size() < Toasts.size() || (Handlers.size() != 1 && Handlers.size() != Toasts.size())) {
+            return Error::InvalidArgument;
         }
 
-        StringWrapper(const std::string& String) noexcept :
-            StringWrapper(ToWide(String))
-        {
+        auto Start = std::chrono::steady_clock::now();
+        if (NextExpiryAt.load(std::memory_order_relaxed) <= Start) {
+            SweepExpired();
+        }
 
+        // Build every notification first, then show them back to back.
+        // Toasts are only coalesced with ones displayed before the batch.
+        // Each toast's latency runs from when it starts building until it is shown.
+        std::vector<BufferEntry> Entries(Toasts.size());
+        std::vector<std::chrono::steady_clock::time_point> Starts(Toasts.size());
+        size_t Admitted = 0;
+        for (size_t Idx = 0; Idx < Toasts.size(); ++Idx) {
+            Starts[Idx] = std::chrono::steady_clock::now();
+            if (auto Coalesced = FindCoalesced(Toasts[Idx])) {
+                Results[Idx] = { Coalesced, Error::Success };
+                RecordLatency(Stage::ShowToast, Starts[Idx]);
+                continue;
+            }
+            if (Options.MaxInFlight) {
+                if (Admit(Toasts[Idx].Priority, false) != Error::Success) {
+                    Results[Idx] = { 0, Error::Overloaded };
+                    RecordLatency(Stage::ShowToast, Starts[Idx]);
+                    continue;
+                }
+                ++Admitted;
+            }
+            auto Clock = Starts[Idx];
+            Results[Idx] = {};
+            Results[Idx].Error = CreateToast(Toasts[Idx], Entries[Idx], Clock, Results[Idx].Failure);
+            if (Results[Idx].Error != Error::Success) {
+                RecordLatency(Stage::ShowToast, Starts[Idx], Clock, 0);
+            }
         }
 
-        ~StringWrapper()
         {
-            WindowsDeleteString(HString);
+            std::lock_guard Lock(State->Mutex);
+            Buffer.Reserve(Buffer.Size() + Toasts.size());
+        }
+        for (size_t Idx = 0; Idx < Toasts.size(); ++Idx) {
+            if (Results[Idx].Error == Error::Success && Entries[Idx].Notification) {
+                auto Clock = std::chrono::steady_clock::now();
+                Results[Idx].Error = PostToast(std::move(Entries[Idx]), Handlers[Handlers.size() == 1 ? 0 : Idx], Results[Idx].Id, Clock, Results[Idx].Failure);
+                RecordLatency(Stage::ShowToast, Starts[Idx], Clock, Results[Idx].Id);
+            }
+        }
+        if (Admitted) {
+            ReleaseAdmission(Admitted);
         }
 
-        operator HSTRING() const noexcept
-        {
-            return HString;
+        return Error::Success;
+    }
+
+    WinToast::ShowAwaiter WinToast::ShowToastAsync(const Template& Toast, Executor Scheduler, std::stop_token StopToken)
+    {
+        return ShowAwaiter(this, Toast, std::move(Scheduler), std::move(StopToken));
+    }
+
+    WinToast::ShowAwaiter::ShowAwaiter(WinToast* Owner, const Template& Toast, Executor&& Scheduler, std::stop_token StopToken) :
+        Owner(Owner),
+        Toast(&Toast),
+        Scheduler(std::move(Scheduler)),
+        StopToken(std::move(StopToken)),
+        Id(0),
+        Progress(0)
+    {
+        if (Toast.CoalesceWindow > 0) {
+            Uncoalesced.emplace(Toast);
+            Uncoalesced->CoalesceWindow = 0;
+            this->Toast = &*Uncoalesced;
         }
+    }
 
-    private:
-        HSTRING HString;
-    };
+    // The toast's events can arrive before ShowToast returns, so nothing here touches the frame after Progress is set
+    bool WinToast::ShowAwaiter::await_suspend(std::coroutine_handle<> Handle)
+    {
+        this->Handle = Handle;
+        WinToastLib::Handler Handler{
+            .OnClicked = [this](int ActionIdx) {
+                Complete(ToastClicked{ ActionIdx });
+            },
+            .OnDismissed = [this](DismissalReason Reason) {
+                Complete(Reason);
+            },
+            .OnFailed = [this]() {
+                Complete(ToastFailed{ Error::NotDisplayed });
+            }
+        };
 
-    HRESULT SetNodeStringValue(const std::string& String, ComPtr<IXmlNode>& Node, ComPtr<IXmlDocument>& Document) {
-        ComPtr<IXmlText> TextNode;
-        auto Result = Document->CreateTextNode(StringWrapper(String), &TextNode);
-        if (FAILED(Result)) {
-            return Result;
+        auto Result = Owner->ShowToast(*Toast, Handler, &Id);
+        if (Result != Error::Success) {
+            Complete(ToastFailed{ Result });
+        }
+        else if (StopToken.stop_possible()) {
+            // Runs right away if a stop was already requested
+            StopCallback.emplace(StopToken, Canceller{ this });
         }
 
-        ComPtr<IXmlNode> StringNode;
-        Result = TextNode.As(&StringNode);
-        if (FAILED(Result)) {
-            return Result;
+        if (Progress.exchange(1, std::memory_order_acq_rel) != 2) {
+            return true;
         }
+        // It ended while being shown
+        if (Scheduler) {
+            Resume();
+            return true;
+        }
+        return false;
+    }
 
-        ComPtr<IXmlNode> AppendedChild;
-        return Node->AppendChild(StringNode.Get(), &AppendedChild);
+    ToastOutcome WinToast::ShowAwaiter::await_resume()
+    {
+        StopCallback.reset();
+        return std::move(Outcome);
     }
 
-    HRESULT AddAttribute(ComPtr<IXmlDocument>& Document, const std::string& Name, ComPtr<IXmlNamedNodeMap>& AttributeMap) {
-        ComPtr<IXmlAttribute> SrcAttribute;
-        auto Result = Document->CreateAttribute(StringWrapper(Name), &SrcAttribute);
-        if (FAILED(Result)) {
-            return Result;
+    void WinToast::ShowAwaiter::Canceller::operator()() noexcept
+    {
+        Awaiter->Owner->CancelToast(Awaiter->Id);
+    }
+
+    void WinToast::ShowAwaiter::Complete(ToastOutcome&& Result)
+    {
+        Outcome = std::move(Result);
+        if (Progress.exchange(2, std::memory_order_acq_rel) == 1) {
+            Resume();
         }
+    }
 
-        ComPtr<IXmlNode> Node;
-        Result = SrcAttribute.As(&Node);
-        if (FAILED(Result)) {
-            return Result;
+    // The coroutine can run (and destroy the frame) as soon as it's handed to the scheduler, so the scheduler is moved out first
+    void WinToast::ShowAwaiter::Resume()
+    {
+        if (!Scheduler) {
+            Handle.resume();
+            return;
         }
 
-        ComPtr<IXmlNode> PreviousNode;
-        return AttributeMap->SetNamedItem(Node.Get(), &PreviousNode);
+        auto Post = std::move(Scheduler);
+        Post([Handle = Handle]() {
+            Handle.resume();
+        });
     }
 
-    HRESULT CreateElement(ComPtr<IXmlDocument>& Document, const std::string& RootNode, const std::string& ElementName, const std::vector<std::string>& AttributeNames) {
-        ComPtr<IXmlNodeList> RootList;
-        HRESULT Result = Document->GetElementsByTagName(StringWrapper(RootNode), &RootList);
-        if (FAILED(Result)) {
-            return Result;
+    Error WinToast::HideToast(int64_t Id)
+    {
+        if (Options.UseWorkerThread && !IsOnWorker()) {
+            return RunOnWorker([this, Id]() { return HideToast(Id); });
         }
 
-        ComPtr<IXmlNode> Root;
-        Result = RootList->Item(0, &Root);
-        if (FAILED(Result)) {
-            return Result;
+        if (!IsInitialized()) {
+            return Error::NotInitialized;
         }
 
-        ComPtr<IXmlElement> Element;
-        Result = Document->CreateElement(StringWrapper(ElementName), &Element);
-        if (FAILED(Result)) {
-            return Result;
+        auto Start = std::chrono::steady_clock::now();
+        std::unique_ptr<Backend::Notification> Notification;
+        {
+            std::lock_guard Lock(State->Mutex);
+            Notification = RemoveEntry(Id);
+        }
+        if (!Notification) {
+            RecordLatency(Stage::HideToast, Start);
+            return Error::IdNotFound;
         }
 
-        ComPtr<IXmlNode> NodeTmp;
-        Result = Element.As(&NodeTmp);
-        if (FAILED(Result)) {
-            return Result;
+        auto HideStart = std::chrono::steady_clock::now();
+        auto Result = Platform->Hide(*Notification);
+        auto End = RecordLatency(Stage::Hide, HideStart, Id);
+        RecordLatency(Stage::HideToast, Start, End, Id);
+        if (Result < 0) {
+            return RecordFailure(Error::CouldNotHide, { Stage::Hide, Result, FieldType::None, -1 });
         }
 
-        ComPtr<IXmlNode> Node;
-        Result = Root->AppendChild(NodeTmp.Get(), &Node);
-        if (FAILED(Result)) {
-            return Result;
+        return Error::Success;
+    }
+
+    Error WinToast::CancelToast(int64_t Id)
+    {
+        if (Options.UseWorkerThread && !IsOnWorker()) {
+            QueueWork([this, Id]() { CancelToast(Id); });
+            return Error::Success;
         }
 
-        ComPtr<IXmlNamedNodeMap> Attributes;
-        Result = Node->get_Attributes(&Attributes);
-        if (FAILED(Result)) {
-            return Result;
+        if (!IsInitialized()) {
+            return Error::NotInitialized;
         }
 
-        for (const auto& it : AttributeNames) {
-            Result = AddAttribute(Document, it, Attributes);
+        auto Start = std::chrono::steady_clock::now();
+        std::unique_ptr<Backend::Notification> Notification;
+        std::shared_ptr<TrackedHandler> Tracking;
+        {
+            std::lock_guard Lock(State->Mutex);
+            if (auto Entry = Buffer.Find(Id)) {
+                Tracking = Entry->Tracking.lock();
+            }
+            Notification = RemoveEntry(Id);
+        }
+        if (!Notification) {
+            RecordLatency(Stage::HideToast, Start);
+            return Error::IdNotFound;
         }
 
-        return Result;
+        // Claimed before hiding, so what the platform raises for the hide is dropped
+        bool Claimed = Tracking && !Tracking->Finished.exchange(true);
+        auto HideStart = std::chrono::steady_clock::now();
+        auto Result = Platform->Hide(*Notification);
+        auto End = RecordLatency(Stage::Hide, HideStart, Id);
+        RecordLatency(Stage::HideToast, Start, End, Id);
+        if (Claimed) {
+            DeliverEvent(Tracking, { Id, EventType::Dismissed, 0, DismissalReason::ApplicationHidden });
+        }
+        if (Result < 0) {
+            return RecordFailure(Error::CouldNotHide, { Stage::Hide, Result, FieldType::None, -1 });
+        }
+        return Error::Success;
     }
 
-    HRESULT SetTextFieldHelper(ComPtr<IXmlDocument>& Document, const std::string& Text, UINT32 Idx) {
-        ComPtr<IXmlNodeList> NodeList;
-        auto Result = Document->GetElementsByTagName(StringWrapper(L"text"), &NodeList);
-        if (FAILED(Result)) {
-            return Result;
+    Error WinToast::ClearToasts()
+    {
+        if (Options.UseWorkerThread && !IsOnWorker()) {
+            return RunOnWorker([this]() { return ClearToasts(); });
         }
 
-        ComPtr<IXmlNode> Node;
-        Result = NodeList->Item(Idx, &Node);
-        if (FAILED(Result)) {
-            return Result;
+        if (!IsInitialized()) {
+            return Error::NotInitialized;
+        }
+
+        auto Start = std::chrono::steady_clock::now();
+        std::vector<std::unique_ptr<Backend::Notification>> Cleared;
+        {
+            std::lock_guard Lock(State->Mutex);
+            ForgetToasts(Cleared);
         }
 
-        return SetNodeStringValue(Text, Node, Document);
+        bool FailedOnce = false;
+        auto HideStart = std::chrono::steady_clock::now();
+        for (auto& Notification : Cleared) {
+            auto Result = Platform->Hide(*Notification);
+            if (Result < 0) {
+                RecordFailure(Error::CouldNotHide, { Stage::Hide, Result, FieldType::None, -1 });
+                FailedOnce = true;
+            }
+            HideStart = RecordLatency(Stage::Hide, HideStart);
+        }
+        RecordLatency(Stage::ClearToasts, Start, HideStart);
+
+        return FailedOnce ? Error::CouldNotHide : Error::Success;
     }
 
-    HRESULT SetAttributionTextFieldHelper(ComPtr<IXmlDocument>& Document, const std::string& Text) {
-        CreateElement(Document, "binding", "text", { "placement" });
-        ComPtr<IXmlNodeList> NodeList;
-        auto Result = Document->GetElementsByTagName(StringWrapper(L"text"), &NodeList);
-        if (FAILED(Result)) {
-            return Result;
+    Error WinToast::ClearGroup(const std::string& Group)
+    {
+        if (Options.UseWorkerThread && !IsOnWorker()) {
+            return RunOnWorker([this, &Group]() { return ClearGroup(Group); });
         }
 
-        UINT32 NodeListLength;
-        Result = NodeList->get_Length(&NodeListLength);
-        if (FAILED(Result)) {
-            return Result;
+        if (!IsInitialized()) {
+            return Error::NotInitialized;
+        }
+        if (Group.empty()) {
+            return Error::InvalidArgument;
         }
 
-        for (UINT32 Idx = 0; Idx < NodeListLength; ++Idx) {
-            ComPtr<IXmlNode> Node;
-            Result = NodeList->Item(Idx, &Node);
-            if (FAILED(Result)) {
-                return Result;
+        auto Start = std::chrono::steady_clock::now();
+        std::vector<std::unique_ptr<Backend::Notification>> Cleared;
+        {
+            std::lock_guard Lock(State->Mutex);
+            auto Itr = GroupIndex.find(Group);
+            if (Itr != GroupIndex.end()) {
+                auto Ids = std::move(Itr->second);
+                GroupIndex.erase(Itr);
+                Cleared.reserve(Ids.size());
+                for (auto Id : Ids) {
+                    BufferEntry Entry;
+                    Buffer.Erase(Id, Entry);
+                    // Already out of GroupIndex
+                    Entry.GroupMembers = nullptr;
+                    ReleaseEntry(Id, Entry);
+                    Cleared.emplace_back(std::move(Entry.Notification));
+                }
             }
+        }
+        // Released without holding the lock, like any other notification
+        Cleared.clear();
 
-            ComPtr<IXmlNamedNodeMap> Attributes;
-            Result = Node->get_Attributes(&Attributes);
-            if (FAILED(Result)) {
-                return Result;
-            }
+        auto HideStart = std::chrono::steady_clock::now();
+        auto Result = Platform->RemoveGroup(Group);
+        auto End = RecordLatency(Stage::Hide, HideStart);
+        RecordLatency(Stage::ClearToasts, Start, End);
+        if (Result < 0) {
+            return RecordFailure(Error::CouldNotHide, { Stage::Hide, Result, FieldType::None, -1 });
+        }
+        return Error::Success;
+    }
 
-            ComPtr<IXmlNode> NodeEdited;
-            Result = Attributes->GetNamedItem(StringWrapper(L"placement"), &NodeEdited);
-            if (!NodeEdited || FAILED(Result)) {
-                continue;
-            }
+    Error WinToast::ClearAll()
+    {
+        if (Options.UseWorkerThread && !IsOnWorker()) {
+            return RunOnWorker([this]() { return ClearAll(); });
+        }
 
-            Result = SetNodeStringValue("attribution", NodeEdited, Document);
-            if (SUCCEEDED(Result)) {
-                return SetTextFieldHelper(Document, Text, Idx);
-            }
+        if (!IsInitialized()) {
+            return Error::NotInitialized;
         }
 
-        return Result;
-    }
+        auto Start = std::chrono::steady_clock::now();
+        std::vector<std::unique_ptr<Backend::Notification>> Cleared;
+        {
+            std::lock_guard Lock(State->Mutex);
+            ForgetToasts(Cleared);
+        }
+        Cleared.clear();
 
-    HRESULT AddActionHelper(ComPtr<IXmlDocument>& Document, const std::string& Content, const std::string& Arguments) {
-        ComPtr<IXmlNodeList> NodeList;
-        auto Result = Document->GetElementsByTagName(StringWrapper(L"actions"), &NodeList);
-        if (FAILED(Result)) {
-            return Result;
+        auto HideStart = std::chrono::steady_clock::now();
+        auto Result = Platform->RemoveAll();
+        auto End = RecordLatency(Stage::Hide, HideStart);
+        RecordLatency(Stage::ClearToasts, Start, End);
+        if (Result < 0) {
+            return RecordFailure(Error::CouldNotHide, { Stage::Hide, Result, FieldType::None, -1 });
         }
+        return Error::Success;
+    }
 
-        UINT32 NodeListLength;
-        Result = NodeList->get_Length(&NodeListLength);
-        if (FAILED(Result)) {
-            return Result;
+    Error WinToast::UpdateToast(int64_t Id, std::initializer_list<DataValue> Values, uint32_t SequenceNumber)
+    {
+        return UpdateToast(Id, std::span<const DataValue>(Values.begin(), Values.size()), SequenceNumber);
+    }
+
+    // Not marshalled onto the worker: values are handed over under the lock, and the worker is only
+    // woken once they're due, so a producer calling this in a loop never waits on the platform
+    Error WinToast::UpdateToast(int64_t Id, std::span<const DataValue> Values, uint32_t SequenceNumber)
+    {
+        if (!IsInitialized()) {
+            return Error::NotInitialized;
         }
 
-        ComPtr<IXmlNode> ActionsNode;
-        if (NodeListLength != 0) {
-            Result = NodeList->Item(0, &ActionsNode);
-            if (FAILED(Result)) {
-                return Result;
+        auto Now = std::chrono::steady_clock::now();
+        bool Sooner = false;
+        {
+            std::lock_guard Lock(State->Mutex);
+            auto Entry = Buffer.Find(Id);
+            if (!Entry) {
+                return Error::IdNotFound;
             }
-        }
-        else {
-            Result = Document->GetElementsByTagName(StringWrapper(L"toast"), &NodeList);
-            if (FAILED(Result)) {
-                return Result;
+            // The platform finds toasts to update by their tag, which is last in TagKey
+            if (Entry->TagKey.empty() || Entry->TagKey.back() == '\0') {
+                return Error::InvalidArgument;
             }
 
-            Result = NodeList->get_Length(&NodeListLength);
-            if (FAILED(Result)) {
-                return Result;
+            if (!Entry->Update) {
+                Entry->Update = std::make_unique<UpdateEntry>(UpdateEntry{ {}, 0, std::chrono::steady_clock::time_point::min(), false });
             }
+            auto& Update = *Entry->Update;
 
-            ComPtr<IXmlNode> ToastNode;
-            Result = NodeList->Item(0, &ToastNode);
-            if (FAILED(Result)) {
-                return Result;
+            if (SequenceNumber == 0) {
+                SequenceNumber = Update.SequenceNumber + 1;
             }
-
-            ComPtr<IXmlElement> ToastElement;
-            Result = ToastNode.As(&ToastElement);
-            if (FAILED(Result)) {
-                return Result;
+            else if (SequenceNumber <= Update.SequenceNumber) {
+                ++UpdatesStale;
+                return Error::Success;
             }
 
-            Result = ToastElement->SetAttribute(StringWrapper(L"template"), StringWrapper(L"ToastGeneric"));
-            if (FAILED(Result)) {
-                return Result;
+            // New keys are counted first, so an update that doesn't fit leaves the pending values alone
+            auto FindKey = [&Update](std::string_view Key) {
+                return std::find_if(Update.Pending.begin(), Update.Pending.end(), [Key](const DataField& Field) { return Field.Key == Key; });
+            };
+            size_t NewKeys = 0;
+            for (auto& Value : Values) {
+                if (FindKey(Value.Key) == Update.Pending.end()) {
+                    ++NewKeys;
+                }
             }
-
-            Result = ToastElement->SetAttribute(StringWrapper(L"duration"), StringWrapper(L"long"));
-            if (FAILED(Result)) {
-                return Result;
+            if (Update.Pending.size() + NewKeys > Update.Pending.capacity()) {
+                return Error::InvalidArgument;
             }
 
-            ComPtr<IXmlElement> ActionsElement;
-            Result = Document->CreateElement(StringWrapper(L"actions"), &ActionsElement);
-            if (FAILED(Result)) {
-                return Result;
+            for (auto& Value : Values) {
+                auto Itr = FindKey(Value.Key);
+                if (Itr != Update.Pending.end()) {
+                    Itr->Value.assign(Value.Value);
+                }
+                else {
+                    // Reuses the strings an earlier update left behind
+                    auto Field = Update.Pending.extend();
+                    Field->Key.assign(Value.Key);
+                    Field->Value.assign(Value.Value);
+                }
             }
-
-            Result = ActionsElement.As(&ActionsNode);
-            if (FAILED(Result)) {
-                return Result;
+            Update.SequenceNumber = SequenceNumber;
+            ++UpdatesReceived;
+
+            if (!Update.Due) {
+                Update.Due = true;
+                DueUpdates.push_back(Id);
+                auto DueAt = std::max(Now, Update.SentAt + std::chrono::milliseconds(Options.MinUpdateInterval));
+                if (DueAt < NextUpdateAt.load(std::memory_order_relaxed)) {
+                    NextUpdateAt.store(DueAt);
+                    Sooner = true;
+                }
             }
+        }
 
-            ComPtr<IXmlNode> AppendedChild;
-            Result = ToastNode->AppendChild(ActionsNode.Get(), &AppendedChild);
-            if (FAILED(Result)) {
-                return Result;
+        if (Options.UseWorkerThread) {
+            if (Sooner) {
+                WakeWorker();
             }
+            return Error::Success;
         }
 
-        ComPtr<IXmlElement> ActionElement;
-        Result = Document->CreateElement(StringWrapper(L"action"), &ActionElement);
-        if (FAILED(Result)) {
-            return Result;
+        if (NextUpdateAt.load(std::memory_order_relaxed) <= Now) {
+            return SendUpdates(false);
         }
+        return Error::Success;
+    }
 
-        Result = ActionElement->SetAttribute(StringWrapper(L"content"), StringWrapper(Content));
-        if (FAILED(Result)) {
-            return Result;
+    // Like UpdateToast, this doesn't go through the worker. It's only woken if the toast is due before
+    // it planned to look at the wheel again.
+    Error WinToast::ScheduleToast(Template Toast, Handler Handler, std::chrono::system_clock::time_point DeliveryTime, int64_t* Id)
+    {
+        if (!IsInitialized()) {
+            return Error::NotInitialized;
         }
 
-        Result = ActionElement->SetAttribute(StringWrapper(L"arguments"), StringWrapper(Arguments));
-        if (FAILED(Result)) {
-            return Result;
+        bool Sooner;
+        {
+            std::lock_guard Lock(ScheduleMutex);
+            auto ScheduleId = Scheduled.Insert(GetTick(DeliveryTime, true), { std::move(Toast), std::move(Handler) });
+            if (Id != nullptr) {
+                *Id = ScheduleId;
+            }
+            Sooner = UpdateNextScheduled();
         }
-
-        ComPtr<IXmlNode> ActionNode;
-        Result = ActionElement.As(&ActionNode);
-        if (FAILED(Result)) {
-            return Result;
+        if (Sooner && Options.UseWorkerThread) {
+            WakeWorker();
         }
 
-        ComPtr<IXmlNode> AppendedChild;
-        return ActionsNode->AppendChild(ActionNode.Get(), &AppendedChild);
+        return Error::Success;
     }
 
-    HRESULT SetAudioFieldHelper(ComPtr<IXmlDocument>& Document, const std::string& Path, WinToastLib::AudioOption Option)
+    Error WinToast::RescheduleToast(int64_t Id, std::chrono::system_clock::time_point DeliveryTime)
     {
+        bool Sooner;
         {
-            std::vector<std::string> Attributes;
-            if (!Path.empty()) {
-                Attributes.emplace_back("src");
+            std::lock_guard Lock(ScheduleMutex);
+            if (!Scheduled.Reschedule(Id, GetTick(DeliveryTime, true))) {
+                return Error::IdNotFound;
             }
-            if (Option != WinToastLib::AudioOption::Default) {
-                Attributes.emplace_back(Option == WinToastLib::AudioOption::Silent ? "silent" : "loop");
-            }
-            CreateElement(Document, "toast", "audio", Attributes);
+            Sooner = UpdateNextScheduled();
         }
-
-        ComPtr<IXmlNodeList> NodeList;
-        auto Result = Document->GetElementsByTagName(StringWrapper(L"audio"), &NodeList);
-        if (FAILED(Result)) {
-            return Result;
+        if (Sooner && Options.UseWorkerThread) {
+            WakeWorker();
         }
 
-        ComPtr<IXmlNode> Node;
-        Result = NodeList->Item(0, &Node);
-        if (FAILED(Result)) {
-            return Result;
-        }
+        return Error::Success;
+    }
 
-        ComPtr<IXmlNamedNodeMap> Attributes;
-        Result = Node->get_Attributes(&Attributes);
-        if (FAILED(Result)) {
-            return Result;
+    Error WinToast::CancelScheduledToast(int64_t Id)
+    {
+        // Released after unlocking, the handler's captures are the user's
+        ScheduledToast Cancelled;
+        std::lock_guard Lock(ScheduleMutex);
+        if (!Scheduled.Erase(Id, Cancelled)) {
+            return Error::IdNotFound;
         }
+        UpdateNextScheduled();
+        return Error::Success;
+    }
 
-        ComPtr<IXmlNode> NodeEdited;
-        if (!Path.empty()) {
-            Result = Attributes->GetNamedItem(StringWrapper(L"src"), &NodeEdited);
-            if (FAILED(Result)) {
-                return Result;
-            }
+    size_t WinToast::DeliverScheduled()
+    {
+        if (Options.UseWorkerThread && !IsOnWorker()) {
+            size_t Shown = 0;
+            RunOnWorker([this, &Shown]() {
+                Shown = DeliverScheduled();
+                return Error::Success;
+            });
+            return Shown;
+        }
 
-            Result = SetNodeStringValue(Path, NodeEdited, Document);
-            if (FAILED(Result)) {
-                return Result;
-            }
+        if (!IsInitialized()) {
+            return 0;
         }
 
-        if (Option != WinToastLib::AudioOption::Default) {
-            Result = Attributes->GetNamedItem(StringWrapper(Option == WinToastLib::AudioOption::Silent ? L"silent" : L"loop"), &NodeEdited);
-            if (FAILED(Result)) {
-                return Result;
+        {
+            std::lock_guard Lock(ScheduleMutex);
+            Scheduled.Advance(GetTick(Options.TimeSource(), false), [this](int64_t, ScheduledToast&& Due) {
+                DueToasts.emplace_back(std::move(Due));
+            });
+            UpdateNextScheduled();
+        }
+
+        // Handlers can schedule toasts and deliver them, so the batch is moved out while it's shown
+        auto Batch = std::move(DueToasts);
+        size_t Shown = 0;
+        for (auto& Due : Batch) {
+            if (ShowToast(Due.Toast, Due.Handler) == Error::Success) {
+                ++Shown;
             }
-
-            Result = SetNodeStringValue("true", NodeEdited, Document);
-            if (FAILED(Result)) {
-                return Result;
+            else {
+                Due.Handler.OnFailed();
             }
         }
-
-        return Result;
+        Batch.clear();
+        DueToasts = std::move(Batch);
+        return Shown;
     }
 
-    HRESULT AddDurationHelper(ComPtr<IXmlDocument>& Document, const std::string& Duration)
+    // Everything expired is taken out under one lock, then hidden as a batch
+    size_t WinToast::SweepExpired()
     {
-        ComPtr<IXmlNodeList> NodeList;
-        auto Result = Document->GetElementsByTagName(StringWrapper(L"toast"), &NodeList);
-        if (FAILED(Result)) {
-            return Result;
+        if (Options.UseWorkerThread && !IsOnWorker()) {
+            size_t Swept = 0;
+            RunOnWorker([this, &Swept]() {
+                Swept = SweepExpired();
+                return Error::Success;
+            });
+            return Swept;
         }
 
-        UINT32 NodeListLength;
-        Result = NodeList->get_Length(&NodeListLength);
-        if (FAILED(Result)) {
-            return Result;
+        if (!IsInitialized()) {
+            return 0;
         }
 
-        ComPtr<IXmlNode> ToastNode;
-        Result = NodeList->Item(0, &ToastNode);
-        if (FAILED(Result)) {
-            return Result;
+        {
+            std::lock_guard Lock(State->Mutex);
+            Expiries.Advance(GetTick(Options.TimeSource(), false), [this](int64_t, int64_t&& Id) {
+                BufferEntry Entry;
+                if (!Buffer.Erase(Id, Entry)) {
+                    return;
+                }
+                // Already freed by Advance
+                Entry.ExpiryTimer = 0;
+                ReleaseEntry(Id, Entry);
+                ++ExpiredCount;
+                ExpiredToasts.push_back({ Id, std::move(Entry.Notification), Entry.Tracking.lock() });
+            });
+            NextExpiryAt.store(GetWakeTime(Expiries.GetNextDue()));
+        }
+
+        // Handlers can show toasts, which can sweep again, so the batch is moved out while it's handled
+        auto Batch = std::move(ExpiredToasts);
+        auto Start = std::chrono::steady_clock::now();
+        for (auto& Expired : Batch) {
+            // Claimed before hiding, so it's the platform's dismissal for the hide that gets dropped
+            bool Claimed = Expired.Tracking && !Expired.Tracking->Finished.exchange(true, std::memory_order_acq_rel);
+            auto Result = Platform->Hide(*Expired.Notification);
+            Start = RecordLatency(Stage::Hide, Start, Expired.Id);
+            if (Result < 0) {
+                RecordFailure(Error::CouldNotHide, { Stage::Hide, Result, FieldType::None, -1 });
+            }
+            if (Claimed) {
+                DeliverEvent(Expired.Tracking, { Expired.Id, EventType::Dismissed, 0, DismissalReason::TimedOut });
+            }
         }
 
-        ComPtr<IXmlElement> ToastElement;
-        Result = ToastNode.As(&ToastElement);
-        if (FAILED(Result)) {
-            return Result;
-        }
+        auto Swept = Batch.size();
+        Batch.clear();
+        ExpiredToasts = std::move(Batch);
+        return Swept;
+    }
 
-        return ToastElement->SetAttribute(StringWrapper(L"duration"), StringWrapper(Duration));
+    uint64_t WinToast::GetTick(std::chrono::system_clock::time_point Time, bool RoundUp)
+    {
+        auto Since = Time.time_since_epoch();
+        auto Milliseconds = RoundUp ? std::chrono::ceil<std::chrono::milliseconds>(Since) : std::chrono::floor<std::chrono::milliseconds>(Since);
+        return Milliseconds.count() > 0 ? uint64_t(Milliseconds.count()) : 0;
     }
 
-    HRESULT SetImageFieldHelper(ComPtr<IXmlDocument>& Document, const std::string& Path)
+    // Long waits are cut short so the wall clock is read again at least every minute, in case it was changed
+    // or the machine was asleep (which the steady clock doesn't necessarily count)
+    std::chrono::steady_clock::time_point WinToast::GetWakeTime(uint64_t Due) const
     {
-        ComPtr<IXmlNodeList> NodeList;
-        auto Result = Document->GetElementsByTagName(StringWrapper(L"image"), &NodeList);
-        if (FAILED(Result)) {
-            return Result;
+        if (Due == UINT64_MAX) {
+            return std::chrono::steady_clock::time_point::max();
         }
 
-        ComPtr<IXmlNode> Node;
-        Result = NodeList->Item(0, &Node);
-        if (FAILED(Result)) {
-            return Result;
-        }
+        auto Now = GetTick(Options.TimeSource(), false);
+        auto Wait = std::min<uint64_t>(Due > Now ? Due - Now : 0, 60000);
+        return std::chrono::steady_clock::now() + std::chrono::milliseconds(Wait);
+    }
 
-        ComPtr<IXmlNamedNodeMap> Attributes;
-        Result = Node->get_Attributes(&Attributes);
-        if (FAILED(Result)) {
-            return Result;
-        }
+    bool WinToast::UpdateNextScheduled()
+    {
+        auto Next = GetWakeTime(Scheduled.GetNextDue());
+        auto Sooner = Next < NextScheduledAt.load(std::memory_order_relaxed);
+        NextScheduledAt.store(Next);
+        return Sooner;
+    }
 
-        ComPtr<IXmlNode> NodeEdited;
-        Result = Attributes->GetNamedItem(StringWrapper(L"src"), &NodeEdited);
-        if (FAILED(Result)) {
-            return Result;
+    Error WinToast::FlushUpdates()
+    {
+        if (Options.UseWorkerThread && !IsOnWorker()) {
+            return RunOnWorker([this]() { return FlushUpdates(); });
         }
 
-        SetNodeStringValue(Path, NodeEdited, Document);
+        if (!IsInitialized()) {
+            return Error::NotInitialized;
+        }
 
-        return Result;
+        return SendUpdates(true);
     }
 
-    HRESULT SetEventHandlers(ComPtr<IToastNotification>& Notification, const WinToastLib::Handler& EventHandler) {
-        EventRegistrationToken ActivatedToken;
-        auto Result = Notification->add_Activated(
-            Callback<Implements<RuntimeClassFlags<ClassicCom>, ITypedEventHandler<ToastNotification*, IInspectable*>>>(
-                [EventHandler](IToastNotification* Notification, IInspectable* Inspectable)
-                {
-                    IToastActivatedEventArgs* ActivatedEventArgs;
-                    auto Result = Inspectable->QueryInterface(&ActivatedEventArgs);
-                    if (FAILED(Result)) {
-                        return Result;
-                    }
-
-                    HSTRING ArgumentsHandle;
-                    Result = ActivatedEventArgs->get_Arguments(&ArgumentsHandle);
-                    if (FAILED(Result)) {
-                        return Result;
-                    }
-
-                    PCWSTR Arguments = AsWidePtr(ArgumentsHandle);
-                    EventHandler.OnClicked(Arguments && *Arguments ? wcstol(Arguments, nullptr, 10) : -1);
-                    return S_OK;
-                }
-            ).Get(),
-            &ActivatedToken
-        );
-        if (FAILED(Result)) {
-            return Result;
+    Error WinToast::SubmitToast(Template Toast, Handler Handler)
+    {
+        if (!Options.UseWorkerThread) {
+            return ShowToast(Toast, Handler);
         }
 
-        EventRegistrationToken DismissedToken;
-        Result = Notification->add_Dismissed(
-            Callback<Implements<RuntimeClassFlags<ClassicCom>, ITypedEventHandler<ToastNotification*, ToastDismissedEventArgs*>>>(
-                [EventHandler](IToastNotification* Notification, IToastDismissedEventArgs* DismissedEventArgs)
-                {
-                    ToastDismissalReason Reason;
-                    auto Result = DismissedEventArgs->get_Reason(&Reason);
-                    if (FAILED(Result)) {
-                        return Result;
-                    }
-
-
-                    DateTime ExpirationTime{};
-                    {
-                        IReference<DateTime>* ExpirationTimeRef = nullptr;
-                        Notification->get_ExpirationTime(&ExpirationTimeRef);
-                        if (ExpirationTimeRef != nullptr) {
-                            ExpirationTimeRef->get_Value(&ExpirationTime);
-                        }
-                    }
-
-                    if (Reason == ToastDismissalReason_UserCanceled && ExpirationTime.UniversalTime && GetCurrentTicks() >= ExpirationTime.UniversalTime) {
-                        Reason = ToastDismissalReason_TimedOut;
-                    }
-                    EventHandler.OnDismissed(static_cast<WinToastLib::DismissalReason>(Reason));
-                    return S_OK;
-                }
-            ).Get(),
-            &DismissedToken
-        );
-        if (FAILED(Result)) {
-            return Result;
+        if (!IsInitialized()) {
+            return Error::NotInitialized;
         }
 
-        EventRegistrationToken FailedToken;
-        Result = Notification->add_Failed(
-            Callback<Implements<RuntimeClassFlags<ClassicCom>, ITypedEventHandler<ToastNotification*, ToastFailedEventArgs*>>>(
-                [EventHandler](IToastNotification* Notification, IToastFailedEventArgs* FailedEventArgs)
-                {
-                    EventHandler.OnFailed();
-                    return S_OK;
-                }
-            ).Get(),
-            &FailedToken
-        );
-        if (FAILED(Result)) {
-            return Result;
+        // Blocking here holds the producer back rather than the worker
+        bool Admitted = Options.MaxInFlight && Options.AdmissionPolicy == AdmissionPolicy::Block;
+        if (Admitted && Admit(Toast.Priority, !IsOnWorker()) != Error::Success) {
+            return Error::Overloaded;
         }
 
-        return Result;
+        if (Trace) {
+            Trace->Instant("SubmitToast");
+        }
+        QueueWork({ nullptr, std::move(Toast), std::move(Handler), std::chrono::steady_clock::now(), Admitted });
+        return Error::Success;
     }
-}
-
-namespace WinToastLib {
-    using namespace Windows::Foundation;
 
-    std::string GetAudioSystemFilePath(AudioSystemFile File)
-    {
-        switch (File)
-        {
-        case AudioSystemFile::DefaultSound:
-            return "ms-winsoundevent:Notification.Default";
-        case AudioSystemFile::IM:
-            return "ms-winsoundevent:Notification.IM";
-        case AudioSystemFile::Mail:
-            return "ms-winsoundevent:Notification.Mai";
-        case AudioSystemFile::Reminder:
-            return "ms-winsoundevent:Notification.Reminder";
-        case AudioSystemFile::SMS:
-            return "ms-winsoundevent:Notification.SMS";
-        case AudioSystemFile::Alarm:
-            return "ms-winsoundevent:Notification.Looping.Alarm";
-        case AudioSystemFile::Alarm2:
-            return "ms-winsoundevent:Notification.Looping.Alarm2";
-        case AudioSystemFile::Alarm3:
-            return "ms-winsoundevent:Notification.Looping.Alarm3";
-        case AudioSystemFile::Alarm4:
-            return "ms-winsoundevent:Notification.Looping.Alarm4";
-        case AudioSystemFile::Alarm5:
-            return "ms-winsoundevent:Notification.Looping.Alarm5";
-        case AudioSystemFile::Alarm6:
-            return "ms-winsoundevent:Notification.Looping.Alarm6";
-        case AudioSystemFile::Alarm7:
-            return "ms-winsoundevent:Notification.Looping.Alarm7";
-        case AudioSystemFile::Alarm8:
-            return "ms-winsoundevent:Notification.Looping.Alarm8";
-        case AudioSystemFile::Alarm9:
-            return "ms-winsoundevent:Notification.Looping.Alarm9";
-        case AudioSystemFile::Alarm10:
-            return "ms-winsoundevent:Notification.Looping.Alarm10";
-        case AudioSystemFile::Call:
-            return "ms-winsoundevent:Notification.Looping.Cal";
-        case AudioSystemFile::Call1:
-            return "ms-winsoundevent:Notification.Looping.Call1";
-        case AudioSystemFile::Call2:
-            return "ms-winsoundevent:Notification.Looping.Call2";
-        case AudioSystemFile::Call3:
-            return "ms-winsoundevent:Notification.Looping.Call3";
-        case AudioSystemFile::Call4:
-            return "ms-winsoundevent:Notification.Looping.Call4";
-        case AudioSystemFile::Call5:
-            return "ms-winsoundevent:Notification.Looping.Call5";
-        case AudioSystemFile::Call6:
-            return "ms-winsoundevent:Notification.Looping.Call6";
-        case AudioSystemFile::Call7:
-            return "ms-winsoundevent:Notification.Looping.Call7";
-        case AudioSystemFile::Call8:
-            return "ms-winsoundevent:Notification.Looping.Call8";
-        case AudioSystemFile::Call9:
-            return "ms-winsoundevent:Notification.Looping.Call9";
-        case AudioSystemFile::Call10:
-            return "ms-winsoundevent:Notification.Looping.Call10";
-        default:
-            return "";
-        }
-    }
-
-    WinToast::WinToast(const std::string& Aumi) :
-        Initialized(false),
-        Coinitialized(false),
-        Aumi(Aumi)
+    size_t WinToast::PollEvents(std::span<Event> Events)
     {
+        if (!State->Events) {
+            return 0;
+        }
 
+        size_t Count = 0;
+        while (Count < Events.size() && State->Events->TryPop(Events[Count])) {
+            ++Count;
+        }
+        return Count;
     }
 
-    WinToast::~WinToast()
+    uint64_t WinToast::GetDroppedEventCount() const
     {
-        if (Coinitialized) {
-            CoUninitialize();
-        }
+        return State->DroppedEvents.load(std::memory_order_relaxed);
     }
 
-    bool WinToast::IsCompatible()
+    WorkerStats WinToast::GetWorkerStats() const
     {
-        return IsWindows8OrGreater();
+        auto Completed = WorkCompleted.load(std::memory_order_relaxed);
+        auto Queued = WorkQueued.load(std::memory_order_relaxed);
+        return {
+            .QueueDepth = Queued > Completed ? Queued - Completed : 0,
+            .Submitted = Queued,
+            .Completed = Completed,
+            .AverageLatencyNs = Completed ? WorkLatencyTotal.load(std::memory_order_relaxed) / Completed : 0,
+            .MaxLatencyNs = WorkLatencyMax.load(std::memory_order_relaxed)
+        };
     }
 
-    bool WinToast::SupportsModernFeatures()
+    BufferStats WinToast::GetBufferStats() const
     {
-        return IsWindows10OrGreater();
+        std::lock_guard Lock(State->Mutex);
+        return {
+            .Live = Buffer.Size(),
+            .LiveBytes = BufferBytes,
+            .Finished = FinishedCount,
+            .Expired = ExpiredCount,
+            .Evicted = EvictedCount,
+            .Suppressed = SuppressedCount,
+            .Replaced = ReplacedCount
+        };
     }
 
-    Error WinToast::Initialize()
+    Stats WinToast::GetStats() const
     {
-        if (Initialized) {
-            return Error::Success;
+        Stats Snapshot{};
+        for (size_t Idx = 0; Idx < StageCount; ++Idx) {
+            Snapshot.Stages[Idx] = Latencies[Idx].GetStats();
         }
-
-        if (!IsCompatible()) {
-            return Error::SystemNotSupported;
+        Snapshot.Buffer = GetBufferStats();
+        Snapshot.Worker = GetWorkerStats();
+        {
+            std::lock_guard Lock(State->Mutex);
+            Snapshot.Updates = {
+                .Received = UpdatesReceived,
+                .Sent = UpdatesSent,
+                .Stale = UpdatesStale
+            };
+            Snapshot.Admission = {
+                .Admitted = AdmittedCount,
+                .Queued = QueuedCount,
+                .Shed = ShedCount,
+                .Displaced = DisplacedCount,
+                .Waiting = AdmissionWaiting
+            };
+        }
+
+        auto& Failures = Snapshot.Failures;
+        for (size_t Idx = 0; Idx < StageCount; ++Idx) {
+            Failures.ByStage[Idx] = FailuresByStage[Idx].load(std::memory_order_relaxed);
+        }
+        Failures.ByHResultCount = 0;
+        for (auto& Slot : FailuresByHResult) {
+            if (auto Key = Slot.Key.load(std::memory_order_acquire)) {
+                Failures.ByHResult[Failures.ByHResultCount++] = { int32_t(uint32_t(Key)), Slot.Count.load(std::memory_order_relaxed) };
+            }
         }
+        Failures.OtherHResults = OtherHResultFailures.load(std::memory_order_relaxed);
+        return Snapshot;
+    }
 
-        if (!Coinitialized) {
-            auto Result = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+    Error WinToast::CreateToast(const Template& Toast, BufferEntry& Entry, std::chrono::steady_clock::time_point& Clock, Failure& Failed)
+    {
+        auto Built = Payload.Build(Toast, Platform->SupportsModernFeatures());
+        Clock = RecordLatency(Stage::Serialize, Clock);
+        if (!Built) {
+            Failed = { Stage::Serialize, 0, Payload.GetFailedField(), Payload.GetFailedFieldIdx() };
+            return RecordFailure(Error::ComError, Failed);
+        }
 
-            if (Result == CO_E_NOTINITIALIZED) {
-                return Error::ComInitFailed;
-            }
-            Coinitialized = true;
+        auto Result = Platform->CreateNotification(Toast, Payload.GetPayload(), Entry.Notification);
+        Clock = RecordLatency(Stage::CreateNotification, Clock);
+        if (Result < 0) {
+            Failed = { Stage::CreateNotification, Result, FieldType::None, -1 };
+            return RecordFailure(Error::ComError, Failed);
         }
 
-        if (FAILED(SetCurrentProcessExplicitAppUserModelID(Detail::ToWide(Aumi).c_str()))) {
-            return Error::InvalidAppUserModelID;
+        Entry.Bytes = Payload.GetPayload().size();
+        Entry.Priority = Toast.Priority;
+        if (!Toast.Tag.empty() || !Toast.Group.empty()) {
+            Entry.TagKey.assign(Toast.Group).append(1, '\0').append(Toast.Tag);
         }
+        // The platform's expiration time is read from the same clock
+        Entry.ExpiresAt = Toast.Expiration != 0 ? GetTick(Options.TimeSource(), true) + Toast.Expiration : 0;
 
-        Initialized = true;
         return Error::Success;
     }
 
-    bool WinToast::IsInitialized() const
+    Error WinToast::PostToast(BufferEntry&& Entry, const Handler& Handler, int64_t& Id, std::chrono::steady_clock::time_point& Clock, Failure& Failed)
     {
-        return Initialized;
-    }
+        Backend::Notification* Notification = Entry.Notification.get();
+        auto ExpiresAt = Entry.ExpiresAt;
+        // The three callbacks share one block, so each only captures a shared_ptr and stays inline.
+        // Its id is filled in once there is one.
+        auto Tracking = std::make_shared<TrackedHandler>(State, 0, Handler, false);
+        Entry.Tracking = Tracking;
+        Entry.ExpiryTimer = 0;
+        Entry.GroupMembers = nullptr;
+
+        std::vector<std::unique_ptr<Backend::Notification>> Evicted;
+        {
+            std::lock_guard Lock(State->Mutex);
+            BufferBytes += Entry.Bytes;
+            Id = Buffer.Insert(std::move(Entry));
+            Tracking->Id = Id;
+            if (Trace) {
+                Trace->AsyncBegin("Toast", Id);
+            }
+            if (ExpiresAt) {
+                Buffer.Find(Id)->ExpiryTimer = Expiries.Insert(ExpiresAt, int64_t(Id));
+                NextExpiryAt.store(GetWakeTime(Expiries.GetNextDue()));
+            }
 
-    Error WinToast::ShowToast(const Template& Toast, const Handler& Handler, int64_t* Id)
-    {
-        if (!IsInitialized()) {
-            return Error::NotInitialized;
-        }
+            // The platform replaces a toast with the same tag and group on its own, so the old one is just forgotten.
+            // Toasts with only a group never replace each other, they are just indexed by their group.
+            auto& TagKey = Buffer.Find(Id)->TagKey;
+            if (!TagKey.empty() && TagKey.back() != '\0') {
+                auto Itr = TagIndex.find(TagKey);
+                if (Itr != TagIndex.end()) {
+                    if (auto Replaced = RemoveEntry(Itr->second.Id)) {
+                        Evicted.emplace_back(std::move(Replaced));
+                        ++ReplacedCount;
+                    }
+                }
+                TagIndex.insert_or_assign(TagKey, TagEntry{ Id, Clock });
+
+                // The platform can only find it again by its tag
+                if (Journal.IsOpen()) {
+                    auto Split = TagKey.find('\0');
+                    auto ShownAt = std::chrono::duration_cast<std::chrono::milliseconds>(Options.TimeSource().time_since_epoch()).count();
+                    if (!Journal.Shown(Id, ShownAt, std::string_view(TagKey).substr(Split + 1), std::string_view(TagKey).substr(0, Split))) {
+                        RecordFailure(Error::JournalFailed, { Stage::Journal, 0, FieldType::None, -1 });
+                    }
+                }
+            }
+            if (!TagKey.empty()) {
+                IndexGroup(Id, *Buffer.Find(Id));
+            }
 
-        ComPtr<IToastNotificationManagerStatics> Manager;
-        auto Result = GetActivationFactory(Detail::StringWrapper(RuntimeClass_Windows_UI_Notifications_ToastNotificationManager), &Manager);
-        if (FAILED(Result)) {
-            return Error::ComError;
+            EvictEntries(Evicted);
         }
+        Evicted.clear();
 
-        ComPtr<IToastNotifier> Notifier;
-        Result = Manager->CreateToastNotifierWithId(Detail::StringWrapper(Aumi), &Notifier);
-        if (FAILED(Result)) {
-            return Error::ComError;
-        }
+        WinToastLib::Handler Tracked{
+            .OnClicked = [Tracking](int ActionIdx) {
+                OnToastEvent(Tracking, { Tracking->Id, EventType::Clicked, ActionIdx, {} });
+            },
+            .OnDismissed = [Tracking](DismissalReason Reason) {
+                OnToastEvent(Tracking, { Tracking->Id, EventType::Dismissed, 0, Reason });
+            },
+            .OnFailed = [Tracking]() {
+                OnToastEvent(Tracking, { Tracking->Id, EventType::Failed, 0, {} });
+            }
+        };
+
+        // The handler is claimed on failure, so events the platform raises later are dropped instead of reaching
+        // a caller that was already told (e.g. an awaiter whose frame is gone). If an event got there first, the
+        // handler already has the toast's outcome, so the failure is only recorded and the toast counts as shown.
+        auto Abandon = [&](Error Code, Stage At, int32_t HResult) {
+            {
+                std::unique_ptr<Backend::Notification> Removed;
+                std::lock_guard Lock(State->Mutex);
+                Removed = RemoveEntry(Id);
+            }
+            Failed = { At, HResult, FieldType::None, -1 };
+            RecordFailure(Code, Failed);
+            if (Tracking->Finished.exchange(true, std::memory_order_acq_rel)) {
+                return Error::Success;
+            }
+            Id = 0;
+            return Code;
+        };
 
-        ComPtr<IToastNotificationFactory> Factory;
-        Result = GetActivationFactory(Detail::StringWrapper(RuntimeClass_Windows_UI_Notifications_ToastNotification), &Factory);
-        if (FAILED(Result)) {
-            return Error::ComError;
+        // The platform can raise events synchronously, so it's called without holding the lock
+        auto Result = Platform->RegisterHandler(*Notification, std::move(Tracked));
+        Clock = RecordLatency(Stage::RegisterHandler, Clock, Id);
+        if (Result < 0) {
+            return Abandon(Error::InvalidHandler, Stage::RegisterHandler, Result);
         }
 
-        ComPtr<IXmlDocument> Document;
-        Result = Manager->GetTemplateContent(ToastTemplateType(Toast.Type), &Document);
-        if (FAILED(Result)) {
-            return Error::ComError;
+        Result = Platform->Show(*Notification);
+        Clock = RecordLatency(Stage::Show, Clock, Id);
+        if (Result < 0) {
+            return Abandon(Error::NotDisplayed, Stage::Show, Result);
         }
 
-        for (size_t Idx = 0; Idx < Toast.TextFields.size(); ++Idx) {
-            Result = Detail::SetTextFieldHelper(Document, Toast.TextFields[Idx], Idx);
+        return Error::Success;
+    }
 
-            if (FAILED(Result)) {
-                return Error::ComError;
-            }
-        }
+    // One toast is taken at a time, and DueUpdates is scanned again for the next one, so updates
+    // arriving meanwhile are picked up. The last scan finds nothing due and sets NextUpdateAt.
+    // Runs on the worker thread, or without one on whichever thread called UpdateToast or FlushUpdates.
+    Error WinToast::SendUpdates(bool Force)
+    {
+        auto Result = Error::Success;
+        auto Now = std::chrono::steady_clock::now();
+        auto Interval = std::chrono::milliseconds(Options.MinUpdateInterval);
+        for (;;) {
+            int64_t Id = 0;
+            uint32_t SequenceNumber = 0;
+            {
+                std::lock_guard Lock(State->Mutex);
+                auto Next = std::chrono::steady_clock::time_point::max();
+                for (size_t Idx = 0; Idx < DueUpdates.size() && !Id;) {
+                    auto Entry = Buffer.Find(DueUpdates[Idx]);
+                    if (Entry && !Force && Entry->Update->SentAt + Interval > Now) {
+                        Next = std::min(Next, Entry->Update->SentAt + Interval);
+                        ++Idx;
+                        continue;
+                    }
 
-        if (SupportsModernFeatures()) {
-            if (!Toast.AttributionText.empty()) {
-                Result = Detail::SetAttributionTextFieldHelper(Document, Toast.AttributionText);
+                    // Toasts that went away in the meantime are just dropped
+                    if (Entry) {
+                        auto& Update = *Entry->Update;
+                        Id = DueUpdates[Idx];
+                        SequenceNumber = Update.SequenceNumber;
+                        std::swap(UpdateScratch, Update.Pending);
+                        Update.SentAt = Now;
+                        Update.Due = false;
+                        UpdateTagKey.assign(Entry->TagKey);
+                        ++UpdatesSent;
+                    }
+                    DueUpdates[Idx] = DueUpdates.back();
+                    DueUpdates.pop_back();
+                }
 
-                if (FAILED(Result)) {
-                    return Error::ComError;
+                if (!Id) {
+                    NextUpdateAt.store(Next);
+                    return Result;
                 }
             }
 
-            for (size_t Idx = 0; Idx < Toast.Actions.size(); ++Idx) {
-                Result = Detail::AddActionHelper(Document, Toast.Actions[Idx], std::to_string(Idx));
+            auto Start = std::chrono::steady_clock::now();
+            auto Split = UpdateTagKey.find('\0');
+            auto Group = std::string_view(UpdateTagKey).substr(0, Split);
+            auto Tag = std::string_view(UpdateTagKey).substr(Split + 1);
+            auto Sent = Platform->Update(Tag, Group, UpdateScratch, SequenceNumber);
+            RecordLatency(Stage::Update, Start, Id);
+            UpdateScratch.clear();
+            if (Sent < 0) {
+                Result = RecordFailure(Error::CouldNotUpdate, { Stage::Update, Sent, FieldType::None, -1 });
+            }
+            else if (Sent == 1 && Result == Error::Success) {
+                // S_FALSE, the toast isn't displayed anymore (its events might still be on the way)
+                Result = Error::IdNotFound;
+            }
+        }
+    }
 
-                if (FAILED(Result)) {
-                    return Error::ComError;
+    Error WinToast::Admit(Priority Level, bool CanWait)
+    {
+        int64_t DisplacedId = 0;
+        std::unique_ptr<Backend::Notification> Displaced;
+        {
+            std::unique_lock Lock(State->Mutex);
+            if (!HasSlot(Level)) {
+                if (Options.AdmissionPolicy != AdmissionPolicy::Block) {
+                    // Its slot goes straight to the new toast
+                    DisplacedId = FindDisplaced(Level);
+                    Displaced = RemoveEntry(DisplacedId);
+                }
+                else if (CanWait) {
+                    ++QueuedCount;
+                    ++AdmissionWaiters[size_t(Level)];
+                    ++AdmissionWaiting;
+                    auto Woken = AdmissionCondition.wait_for(Lock, std::chrono::milliseconds(Options.AdmissionTimeout), [this, Level]() { return HasSlot(Level); });
+                    --AdmissionWaiters[size_t(Level)];
+                    --AdmissionWaiting;
+                    if (!Woken) {
+                        // Lower priorities it was holding back might fit
+                        AdmissionCondition.notify_all();
+                    }
                 }
             }
 
-            if (!Toast.AudioPath.empty() || Toast.AudioOption != AudioOption::Default) {
-                Result = Detail::SetAudioFieldHelper(Document, Toast.AudioPath, Toast.AudioOption);
+            if (!Displaced && !HasSlot(Level)) {
+                ++ShedCount;
+                return Error::Overloaded;
+            }
+            if (Displaced) {
+                ++DisplacedCount;
+            }
+            ++AdmissionsPending;
+            ++AdmittedCount;
+        }
 
-                if (FAILED(Result)) {
-                    return Error::ComError;
-                }
+        if (Displaced) {
+            auto Start = std::chrono::steady_clock::now();
+            auto Result = Platform->Hide(*Displaced);
+            RecordLatency(Stage::Hide, Start, DisplacedId);
+            if (Result < 0) {
+                RecordFailure(Error::CouldNotHide, { Stage::Hide, Result, FieldType::None, -1 });
             }
+        }
+        return Error::Success;
+    }
 
-            if (Toast.Duration != Duration::System) {
-                Result = Detail::AddDurationHelper(Document, Toast.Duration == Duration::Short ? "short" : "long");
+    void WinToast::ReleaseAdmission(size_t Count)
+    {
+        std::lock_guard Lock(State->Mutex);
+        AdmissionsPending -= Count;
+        if (AdmissionWaiting) {
+            AdmissionCondition.notify_all();
+        }
+    }
 
-                if (FAILED(Result)) {
-                    return Error::ComError;
-                }
+    bool WinToast::HasSlot(Priority Level) const
+    {
+        if (Buffer.Size() + AdmissionsPending >= Options.MaxInFlight) {
+            return false;
+        }
+        for (auto Higher = size_t(Level) + 1; Higher < PriorityCount; ++Higher) {
+            if (AdmissionWaiters[Higher]) {
+                return false;
             }
         }
+        return true;
+    }
 
-        if (Toast.Type <= TemplateType::ImageAndText04) {
-            Result = Detail::SetImageFieldHelper(Document, Toast.ImagePath);
+    // Buffer is walked from the oldest toast, so ties go to the oldest one
+    int64_t WinToast::FindDisplaced(Priority Level)
+    {
+        int64_t Found = 0;
+        auto Lowest = Level;
+        Buffer.ForEachOldest([&](int64_t Id, const BufferEntry& Entry) {
+            if (Options.AdmissionPolicy == AdmissionPolicy::DropOldest) {
+                if (Entry.Priority <= Level) {
+                    Found = Id;
+                    return false;
+                }
+                return true;
+            }
 
-            if (FAILED(Result)) {
-                return Error::ComError;
+            if (Entry.Priority < Lowest) {
+                Found = Id;
+                Lowest = Entry.Priority;
             }
+            return Lowest != Priority::Low;
+        });
+        return Found;
+    }
+
+    int64_t WinToast::FindCoalesced(const Template& Toast)
+    {
+        // Only a tag identifies a toast, toasts sharing just a group are distinct
+        if (Toast.CoalesceWindow <= 0 || Toast.Tag.empty()) {
+            return 0;
+        }
+
+        std::lock_guard Lock(State->Mutex);
+        TagKeyScratch.assign(Toast.Group).append(1, '\0').append(Toast.Tag);
+        auto Itr = TagIndex.find(TagKeyScratch);
+        if (Itr == TagIndex.end() || std::chrono::steady_clock::now() - Itr->second.ShownAt >= std::chrono::milliseconds(Toast.CoalesceWindow)) {
+            return 0;
         }
 
-        ComPtr<IToastNotification> Notification;
-        Result = Factory->CreateToastNotification(Document.Get(), &Notification);
-        if (FAILED(Result)) {
-            return Error::ComError;
+        ++SuppressedCount;
+        return Itr->second.Id;
+    }
+
+    std::unique_ptr<Backend::Notification> WinToast::RemoveEntry(int64_t Id)
+    {
+        BufferEntry Entry;
+        if (!Buffer.Erase(Id, Entry)) {
+            return nullptr;
         }
 
-        if (Toast.Expiration != 0) {
-            Detail::DateTimeImpl Expiration(Toast.Expiration);
-            Result = Notification->put_ExpirationTime(&Expiration);
-            if (FAILED(Result)) {
-                return Error::ComError;
+        ReleaseEntry(Id, Entry);
+        return std::move(Entry.Notification);
+    }
+
+    void WinToast::ReleaseEntry(int64_t Id, BufferEntry& Entry)
+    {
+        if (Trace) {
+            Trace->AsyncEnd("Toast", Id);
+        }
+        BufferBytes -= Entry.Bytes;
+        if (!Journal.Removed(Id)) {
+            RecordFailure(Error::JournalFailed, { Stage::Journal, 0, FieldType::None, -1 });
+        }
+        if (AdmissionWaiting) {
+            AdmissionCondition.notify_all();
+        }
+        if (Entry.ExpiryTimer) {
+            int64_t Unused;
+            Expiries.Erase(Entry.ExpiryTimer, Unused);
+        }
+        if (!Entry.TagKey.empty() && Entry.TagKey.back() != '\0') {
+            auto Itr = TagIndex.find(Entry.TagKey);
+            if (Itr != TagIndex.end() && Itr->second.Id == Id) {
+                TagIndex.erase(Itr);
             }
         }
+        // The group's last id takes its place
+        if (Entry.GroupMembers) {
+            auto& Ids = Entry.GroupMembers->second;
+            auto Moved = Ids.back();
+            Ids[Entry.GroupSlot] = Moved;
+            Ids.pop_back();
+            if (Ids.empty()) {
+                GroupIndex.erase(GroupIndex.find(Entry.GroupMembers->first));
+            }
+            else if (Moved != Id) {
+                Buffer.Find(Moved)->GroupSlot = Entry.GroupSlot;
+            }
+            Entry.GroupMembers = nullptr;
+        }
+    }
 
-        Result = Detail::SetEventHandlers(Notification, Handler);
-        if (FAILED(Result)) {
-            return Error::InvalidHandler;
+    void WinToast::IndexGroup(int64_t Id, BufferEntry& Entry)
+    {
+        auto Split = Entry.TagKey.find('\0');
+        if (Split == 0 || Split == std::string::npos) {
+            return;
         }
 
-        GUID Guid;
-        Result = CoCreateGuid(&Guid);
-        if (FAILED(Result)) {
-            return Error::ComError;
+        GroupKeyScratch.assign(Entry.TagKey, 0, Split);
+        auto& Members = *GroupIndex.try_emplace(GroupKeyScratch).first;
+        Entry.GroupMembers = &Members;
+        Entry.GroupSlot = Members.second.size();
+        Members.second.push_back(Id);
+    }
+
+    void WinToast::ForgetToasts(std::vector<std::unique_ptr<Backend::Notification>>& Forgotten)
+    {
+        Forgotten.reserve(Buffer.Size());
+        Buffer.EraseIf([this, &Forgotten](int64_t Id, BufferEntry& Entry) {
+            Forgotten.emplace_back(std::move(Entry.Notification));
+            if (Entry.ExpiryTimer) {
+                int64_t Unused;
+                Expiries.Erase(Entry.ExpiryTimer, Unused);
+            }
+            if (Trace) {
+                Trace->AsyncEnd("Toast", Id);
+            }
+            return true;
+        });
+        BufferBytes = 0;
+        TagIndex.clear();
+        GroupIndex.clear();
+        if (!Journal.Cleared()) {
+            RecordFailure(Error::JournalFailed, { Stage::Journal, 0, FieldType::None, -1 });
+        }
+        if (AdmissionWaiting) {
+            AdmissionCondition.notify_all();
+        }
+        NextExpiryAt.store(std::chrono::steady_clock::time_point::max());
+    }
+
+    void WinToast::EvictEntries(std::vector<std::unique_ptr<Backend::Notification>>& Evicted)
+    {
+        while (!Buffer.Empty() &&
+            ((Options.MaxBufferSize && Buffer.Size() > Options.MaxBufferSize) ||
+             (Options.MaxBufferBytes && BufferBytes > Options.MaxBufferBytes))) {
+            Evicted.emplace_back(RemoveEntry(Buffer.GetOldest()));
+            ++EvictedCount;
         }
+    }
 
-        int64_t IdVal = Guid.Data1;
+    std::unique_ptr<Backend::Notification> WinToast::OnToastFinished(const std::shared_ptr<SharedState>& State, int64_t Id)
+    {
+        std::lock_guard Lock(State->Mutex);
+        if (!State->Owner) {
+            return nullptr;
+        }
 
-        Buffer.emplace(IdVal, Notification);
+        auto Notification = State->Owner->RemoveEntry(Id);
+        if (Notification) {
+            ++State->Owner->FinishedCount;
+        }
+        return Notification;
+    }
 
-        Result = Notifier->Show(Notification.Get());
-        if (FAILED(Result)) {
-            return Error::NotDisplayed;
+    // Only the first event is delivered. Besides the platform raising more than one, SweepExpired
+    // raises TimedOut itself and the platform follows up with ApplicationHidden for the hide.
+    void WinToast::OnToastEvent(const std::shared_ptr<TrackedHandler>& Tracking, const Event& Raised)
+    {
+        if (!Tracking->Finished.exchange(true, std::memory_order_acq_rel)) {
+            DeliverEvent(Tracking, Raised);
         }
+    }
+
+    // Finished toasts drop out of the buffer before the user's handler runs. When called inline,
+    // the notification itself is released once the handler returns.
+    void WinToast::DeliverEvent(const std::shared_ptr<TrackedHandler>& Tracking, const Event& Raised)
+    {
+        auto& Shared = *Tracking->State;
+        // Before OnToastFinished, so the event lands inside the toast's async span
+        if (Shared.Trace) {
+            constexpr const char* EventNames[] = { "Clicked", "Dismissed", "Failed" };
+            Shared.Trace->Instant(EventNames[size_t(Raised.Type)], Raised.Id);
+        }
+
+        auto Finished = OnToastFinished(Tracking->State, Tracking->Id);
+        if (Shared.Events && !Shared.Events->TryPush(Raised)) {
+            Shared.DroppedEvents.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        auto Deliver = [Tracking, Raised]() {
+            switch (Raised.Type) {
+            case EventType::Clicked:
+                Tracking->User.OnClicked(Raised.ActionIdx);
+                break;
+            case EventType::Dismissed:
+                Tracking->User.OnDismissed(Raised.Reason);
+                break;
+            case EventType::Failed:
+                Tracking->User.OnFailed();
+                break;
+            }
+        };
 
-        if (Id != nullptr) {
-            *Id = IdVal;
+        if (Shared.CallbackExecutor) {
+            Shared.CallbackExecutor(Deliver);
         }
+        else {
+            Deliver();
+        }
+    }
 
+    // Recovered toasts keep their ids, so ids the application held on to still work. The platform
+    // may have removed some of them meanwhile, hiding those does nothing. Ids of the toasts that
+    // weren't recovered can be handed out again.
+    Error WinToast::RecoverToasts()
+    {
+        std::vector<Detail::ToastJournal::LiveToast> Live;
+        if (!Journal.Open(Options.JournalPath, Options.JournalSize, Live)) {
+            return Error::JournalFailed;
+        }
+
+        std::lock_guard Lock(State->Mutex);
+        Recovered.clear();
+        Recovered.reserve(Live.size());
+        for (auto& Toast : Live) {
+            BufferEntry Entry{};
+            Entry.Notification = Platform->Recover(Toast.Tag, Toast.Group);
+            Entry.Priority = Priority::Normal;
+            Entry.TagKey.assign(Toast.Group).append(1, '\0').append(Toast.Tag);
+            auto TagKey = Entry.TagKey;
+            if (!Entry.Notification || TagIndex.contains(TagKey) || !Buffer.Restore(Toast.Id, std::move(Entry))) {
+                if (!Journal.Removed(Toast.Id)) {
+                    RecordFailure(Error::JournalFailed, { Stage::Journal, 0, FieldType::None, -1 });
+                }
+                continue;
+            }
+
+            // Long enough ago not to coalesce anything
+            TagIndex.insert_or_assign(std::move(TagKey), TagEntry{ Toast.Id, std::chrono::steady_clock::time_point() });
+            IndexGroup(Toast.Id, *Buffer.Find(Toast.Id));
+            Recovered.push_back({ Toast.Id, std::move(Toast.Tag), std::move(Toast.Group),
+                std::chrono::system_clock::time_point(std::chrono::milliseconds(Toast.ShownAt)) });
+            if (Trace) {
+                Trace->AsyncBegin("Toast", Toast.Id);
+            }
+        }
         return Error::Success;
     }
 
-    Error WinToast::HideToast(int64_t Id)
+    void WinToast::CompactJournal()
     {
-        if (!IsInitialized()) {
-            return Error::NotInitialized;
+        if (Options.JournalPath.empty()) {
+            return;
+        }
+        std::lock_guard Lock(State->Mutex);
+        if (Journal.ShouldCompact() && !Journal.CompactEarly()) {
+            RecordFailure(Error::JournalFailed, { Stage::Journal, 0, FieldType::None, -1 });
         }
+    }
 
-        auto Itr = Buffer.find(Id);
-        if (Itr == Buffer.end()) {
-            return Error::IdNotFound;
+    Error WinToast::RecordFailure(Error Result, const Failure& Failed)
+    {
+        FailuresByStage[size_t(Failed.Stage)].fetch_add(1, std::memory_order_relaxed);
+
+        // Lock-free open addressing: a slot's key is claimed once and never changes afterwards
+        if (Failed.HResult != 0) {
+            uint64_t Key = uint64_t(uint32_t(Failed.HResult)) | (uint64_t(1) << 32);
+            bool Counted = false;
+            for (size_t Probe = 0; Probe < MaxTrackedHResults && !Counted; ++Probe) {
+                auto& Slot = FailuresByHResult[(uint32_t(Failed.HResult) + Probe) % MaxTrackedHResults];
+                auto SlotKey = Slot.Key.load(std::memory_order_acquire);
+                if (SlotKey == 0 && Slot.Key.compare_exchange_strong(SlotKey, Key, std::memory_order_acq_rel)) {
+                    SlotKey = Key;
+                }
+                if (SlotKey == Key) {
+                    Slot.Count.fetch_add(1, std::memory_order_relaxed);
+                    Counted = true;
+                }
+            }
+            if (!Counted) {
+                OtherHResultFailures.fetch_add(1, std::memory_order_relaxed);
+            }
         }
 
-        ComPtr<IToastNotificationManagerStatics> Manager;
-        auto Result = GetActivationFactory(Detail::StringWrapper(RuntimeClass_Windows_UI_Notifications_ToastNotificationManager), &Manager);
-        if (FAILED(Result)) {
-            return Error::ComError;
+        std::lock_guard Lock(FailureMutex);
+        RecentFailures[FailureCount++ % RecentFailures.size()] = { Failed, Result, std::chrono::system_clock::now() };
+        return Result;
+    }
+
+    size_t WinToast::GetRecoveredToasts(std::span<RecoveredToast> Toasts) const
+    {
+        std::lock_guard Lock(State->Mutex);
+        auto Count = std::min(Recovered.size(), Toasts.size());
+        std::copy_n(Recovered.begin(), Count, Toasts.begin());
+        return Count;
+    }
+
+    size_t WinToast::GetRecentFailures(std::span<FailureRecord> Records) const
+    {
+        std::lock_guard Lock(FailureMutex);
+        auto Count = std::min<uint64_t>({ FailureCount, RecentFailures.size(), Records.size() });
+        for (uint64_t Idx = 0; Idx < Count; ++Idx) {
+            Records[Idx] = RecentFailures[(FailureCount - Count + Idx) % RecentFailures.size()];
         }
+        return Count;
+    }
 
-        ComPtr<IToastNotifier> Notifier;
-        Result = Manager->CreateToastNotifierWithId(Detail::StringWrapper(Aumi), &Notifier);
-        if (FAILED(Result)) {
-            return Error::ComError;
+    std::chrono::steady_clock::time_point WinToast::RecordLatency(Stage Timed, std::chrono::steady_clock::time_point Since, int64_t Id)
+    {
+        auto Now = std::chrono::steady_clock::now();
+        RecordLatency(Timed, Since, Now, Id);
+        return Now;
+    }
+
+    void WinToast::RecordLatency(Stage Timed, std::chrono::steady_clock::time_point Since, std::chrono::steady_clock::time_point Until, int64_t Id)
+    {
+        Latencies[size_t(Timed)].Record(std::chrono::duration_cast<std::chrono::nanoseconds>(Until - Since).count());
+        if (Trace) {
+            constexpr const char* StageNames[StageCount] = { "Serialize", "CreateNotification", "RegisterHandler", "Show", "Hide", "Update", "ShowToast", "HideToast", "ClearToasts", "Journal" };
+            Trace->Complete(StageNames[size_t(Timed)], Since, Until, Id);
         }
+    }
 
-        Result = Notifier->Hide(Itr->second.Get());
-        Buffer.erase(Itr);
+    bool WinToast::IsOnWorker() const
+    {
+        return std::this_thread::get_id() == Worker.get_id();
+    }
 
-        return FAILED(Result) ? Error::CouldNotHide : Error::Success;
+    void WinToast::QueueWork(std::function<void()>&& Task)
+    {
+        QueueWork({ std::move(Task), {}, {}, std::chrono::steady_clock::now(), false });
     }
 
-    Error WinToast::ClearToasts()
+    void WinToast::QueueWork(WorkItem&& Item)
     {
-        if (!IsInitialized()) {
-            return Error::NotInitialized;
-        }
+        WorkQueue.Push(std::move(Item));
+        // Sequentially consistent, pairs with WaitForWork storing WorkerSleeping before checking WorkQueued
+        WorkQueued.fetch_add(1);
+        WakeWorker();
+    }
 
-        ComPtr<IToastNotificationManagerStatics> Manager;
-        auto Result = GetActivationFactory(Detail::StringWrapper(RuntimeClass_Windows_UI_Notifications_ToastNotificationManager), &Manager);
-        if (FAILED(Result)) {
-            return Error::ComError;
+    void WinToast::WakeWorker()
+    {
+        if (WorkerSleeping.load()) {
+            {
+                std::lock_guard Lock(WakeMutex);
+            }
+            WakeCondition.notify_one();
         }
+    }
 
-        ComPtr<IToastNotifier> Notifier;
-        Result = Manager->CreateToastNotifierWithId(Detail::StringWrapper(Aumi), &Notifier);
-        if (FAILED(Result)) {
-            return Error::ComError;
+    // A condition variable rather than an atomic wait, since the worker also has to wake up
+    // on its own when a held back update, a scheduled toast or an expiry is due
+    void WinToast::WaitForWork(uint64_t Queued)
+    {
+        std::unique_lock Lock(WakeMutex);
+        WorkerSleeping.store(true);
+        auto Due = std::min({ NextUpdateAt.load(), NextScheduledAt.load(), NextExpiryAt.load() });
+        auto Woken = [&]() {
+            return WorkQueued.load() != Queued || NextUpdateAt.load() < Due || NextScheduledAt.load() < Due;
+        };
+        if (Due == std::chrono::steady_clock::time_point::max()) {
+            WakeCondition.wait(Lock, Woken);
+        }
+        else {
+            WakeCondition.wait_until(Lock, Due, Woken);
         }
+        WorkerSleeping.store(false, std::memory_order_relaxed);
+    }
 
-        bool FailedOnce = false;
-        for (auto& [Id, Notification] : Buffer) {
-            Result = Notifier->Hide(Notification.Get());
-            FailedOnce = FailedOnce || FAILED(Result);
+    void WinToast::RunWorker()
+    {
+        WorkItem Item;
+        while (!StopWorker) {
+            auto UpdateDue = NextUpdateAt.load(std::memory_order_relaxed);
+            auto ScheduledDue = NextScheduledAt.load(std::memory_order_relaxed);
+            auto ExpiryDue = NextExpiryAt.load(std::memory_order_relaxed);
+            if (std::min({ UpdateDue, ScheduledDue, ExpiryDue }) != std::chrono::steady_clock::time_point::max()) {
+                auto Now = std::chrono::steady_clock::now();
+                if (UpdateDue <= Now) {
+                    SendUpdates(false);
+                }
+                if (ScheduledDue <= Now) {
+                    DeliverScheduled();
+                }
+                if (ExpiryDue <= Now) {
+                    SweepExpired();
+                }
+            }
+
+            if (!WorkQueue.Pop(Item)) {
+                auto Queued = WorkQueued.load(std::memory_order_acquire);
+                if (Queued == WorkCompleted.load(std::memory_order_relaxed)) {
+                    CompactJournal();
+                    WaitForWork(Queued);
+                }
+                else {
+                    // A producer is midway through its push
+                    std::this_thread::yield();
+                }
+                continue;
+            }
+
+            if (Item.Task) {
+                Item.Task();
+                Item.Task = nullptr;
+            }
+            else {
+                ToastResult Result;
+                if (ShowAdmitted(Item.Toast, Item.Handler, Result) != Error::Success) {
+                    Item.Handler.OnFailed();
+                }
+                if (Item.Admitted) {
+                    ReleaseAdmission();
+                }
+                Item.Handler = {};
+            }
+
+            uint64_t Latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Item.Queued).count();
+            WorkLatencyTotal.fetch_add(Latency, std::memory_order_relaxed);
+            auto Max = WorkLatencyMax.load(std::memory_order_relaxed);
+            while (Latency > Max && !WorkLatencyMax.compare_exchange_weak(Max, Latency, std::memory_order_relaxed)) {}
+            WorkCompleted.fetch_add(1, std::memory_order_relaxed);
         }
-        Buffer.clear();
 
-        return FailedOnce ? Error::CouldNotHide : Error::Success;
+        // Taken out under the lock and released after it, so no notification or handler is destroyed while holding it
+        Detail::SlotMap<BufferEntry> Released;
+        decltype(TagIndex) ReleasedTags;
+        {
+            std::lock_guard Lock(State->Mutex);
+            Buffer.Swap(Released);
+            TagIndex.swap(ReleasedTags);
+        }
+        Released.Clear();
+        Platform.reset();
     }
 }
@@ -20,116 +20,342 @@
 
 #pragma once
 
+#include "histogram.h"
+#include "mpscqueue.h"
+#include "mpscring.h"
+#include "slotmap.h"
+#include "timingwheel.h"
+#include "toastbackend.h"
+#include "toastjournal.h"
+#include "toastpayload.h"
+#include "toastschema.h"
+#include "tracer.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
 #include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <thread>
 #include <unordered_map>
-
-#define WIN32_LEAN_AND_MEAN
-#define NOMINMAX
-#include <wrl/implements.h>
-#include <windows.ui.notifications.h>
+#include <variant>
 
 namespace WinToastLib {
-    using namespace ABI::Windows::Data::Xml::Dom;
-    using namespace ABI::Windows::UI::Notifications;
-    using namespace Microsoft::WRL;
-
-    enum class Duration : uint8_t {
-        System,
-        Short,
-        Long
-    };
-
-    enum class AudioOption : uint8_t {
-        Default,
-        Silent,
-        Loop
-    };
-
-    enum class AudioSystemFile : uint8_t {
-        DefaultSound,
-        IM,
-        Mail,
-        Reminder,
-        SMS,
-        Alarm,
-        Alarm2,
-        Alarm3,
-        Alarm4,
-        Alarm5,
-        Alarm6,
-        Alarm7,
-        Alarm8,
-        Alarm9,
-        Alarm10,
-        Call,
-        Call1,
-        Call2,
-        Call3,
-        Call4,
-        Call5,
-        Call6,
-        Call7,
-        Call8,
-        Call9,
-        Call10
-    };
-
-    enum class TemplateType : int {
-        // 1 text field
-        ImageAndText01 = ToastTemplateType::ToastTemplateType_ToastImageAndText01,
-        Text01 = ToastTemplateType::ToastTemplateType_ToastText01,
-        // 2 text fields
-        ImageAndText02 = ToastTemplateType::ToastTemplateType_ToastImageAndText02,
-        Text02 = ToastTemplateType::ToastTemplateType_ToastText02,
-        ImageAndText03 = ToastTemplateType::ToastTemplateType_ToastImageAndText03,
-        Text03 = ToastTemplateType::ToastTemplateType_ToastText03,
-        // 3 text fields
-        ImageAndText04 = ToastTemplateType::ToastTemplateType_ToastImageAndText04,
-        Text04 = ToastTemplateType::ToastTemplateType_ToastText04
-    };
-
-    enum class DismissalReason : int {
-        UserCanceled = ToastDismissalReason::ToastDismissalReason_UserCanceled,
-        ApplicationHidden = ToastDismissalReason::ToastDismissalReason_ApplicationHidden,
-        TimedOut = ToastDismissalReason::ToastDismissalReason_TimedOut
-    };
-
-    enum class Error : uint8_t {
-        Success,
-        SystemNotSupported,
-        ComInitFailed,
-        InvalidAppUserModelID,
-        NotInitialized,
-        ComError,
-        InvalidHandler,
-        NotDisplayed,
-        IdNotFound,
-        CouldNotHide,
-    };
-
-    struct Template {
-        TemplateType Type = TemplateType::Text01;
-        std::vector<std::string> TextFields;
-        std::vector<std::string> Actions;
-        std::string ImagePath;
-        std::string AudioPath;
-        std::string AttributionText;
-        int64_t Expiration = 0;
-        AudioOption AudioOption = AudioOption::Default;
-        Duration Duration = Duration::System;
-    };
-
-    struct Handler {
-        std::function<void(int ActionIdx)> OnClicked = [](int) {};
-        std::function<void(DismissalReason Reason)> OnDismissed = [](DismissalReason) {};
-        std::function<void()> OnFailed = []() {};
-    };
-
-    std::string GetAudioSystemFilePath(AudioSystemFile File);
+    // Timed parts of ShowToast, HideToast and ClearToasts, also where failures are attributed to
+    enum class Stage : uint8_t {
+        // Building the XML payload
+        Serialize,
+        // Loading the payload and creating the platform notification
+        CreateNotification,
+        // Tracking the toast in the buffer and registering its handler
+        RegisterHandler,
+        Show,
+        // The platform hiding a single toast, or removing a group or all toasts from the notification center
+        Hide,
+        // The platform replacing a data-bound toast's values, for UpdateToast
+        Update,
+        // End to end, including the stages above
+        ShowToast,
+        HideToast,
+        // Also ClearGroup and ClearAll
+        ClearToasts,
+        // Writing to Options.JournalPath, not timed
+        Journal
+    };
+
+    // What happens to a toast arriving while Options.MaxInFlight toasts are displayed
+    enum class AdmissionPolicy : uint8_t {
+        // Hide the lowest priority toast (the oldest of them) if it's lower than the new one, otherwise refuse the new one
+        DropLowest,
+        // Hide the oldest toast that isn't higher priority than the new one, otherwise refuse the new one
+        DropOldest,
+        // Wait up to Options.AdmissionTimeout for a toast to finish, higher priorities going first, then refuse it.
+        // ShowToasts and toasts shown from the worker thread (scheduled ones) don't wait.
+        Block
+    };
+    constexpr size_t StageCount = size_t(Stage::Journal) + 1;
+
+    // Where a call failed. HResult is the platform's error code, or 0 when the stage has none
+    // (e.g. a Template that doesn't fit its type, which is pointed at by Field and FieldIdx).
+    struct Failure {
+        WinToastLib::Stage Stage;
+        int32_t HResult;
+        FieldType Field;
+        int FieldIdx;
+    };
+
+    struct ToastResult {
+        int64_t Id;
+        WinToastLib::Error Error;
+        // Only filled in when a stage failed
+        WinToastLib::Failure Failure{};
+    };
+
+    struct FailureRecord {
+        WinToastLib::Failure Failure;
+        WinToastLib::Error Error;
+        std::chrono::system_clock::time_point Time;
+    };
+
+    namespace Detail {
+        struct HResultName {
+            int32_t HResult;
+            std::string_view Name;
+        };
+
+        // Errors the notification platform and COM commonly fail with, from winerror.h
+        constexpr HResultName HResultNames[] = {
+            { int32_t(0x80004001), "E_NOTIMPL" },
+            { int32_t(0x80004002), "E_NOINTERFACE" },
+            { int32_t(0x80004003), "E_POINTER" },
+            { int32_t(0x80004005), "E_FAIL" },
+            { int32_t(0x8000000E), "E_ILLEGAL_METHOD_CALL" },
+            { int32_t(0x80010106), "RPC_E_CHANGED_MODE" },
+            { int32_t(0x80040154), "REGDB_E_CLASSNOTREG" },
+            { int32_t(0x800401F0), "CO_E_NOTINITIALIZED" },
+            { int32_t(0x80070005), "E_ACCESSDENIED" },
+            { int32_t(0x8007000E), "E_OUTOFMEMORY" },
+            { int32_t(0x80070057), "E_INVALIDARG" },
+            { int32_t(0x80070490), "HRESULT_FROM_WIN32(ERROR_NOT_FOUND)" },
+            { int32_t(0x803E0105), "WPN_E_PLATFORM_UNAVAILABLE" },
+            { int32_t(0x803E0106), "WPN_E_NOTIFICATION_POSTED" },
+            { int32_t(0x803E0107), "WPN_E_NOTIFICATION_HIDDEN" },
+            { int32_t(0x803E0108), "WPN_E_NOTIFICATION_NOT_POSTED" },
+            { int32_t(0x803E0111), "WPN_E_NOTIFICATION_DISABLED" },
+            { int32_t(0x803E0112), "WPN_E_NOTIFICATION_INCAPABLE" },
+            { int32_t(0x803E0114), "WPN_E_NOTIFICATION_TYPE_DISABLED" },
+            { int32_t(0x803E0115), "WPN_E_NOTIFICATION_SIZE" },
+            { int32_t(0x803E0116), "WPN_E_TAG_SIZE" },
+            { int32_t(0x803E0117), "WPN_E_ACCESS_DENIED" },
+            { int32_t(0x803E0205), "WPN_E_NOTIFICATION_ID_MATCHED" },
+            { int32_t(0x803E0207), "WPN_E_TOAST_NOTIFICATION_DROPPED" }
+        };
+    }
+
+    // Symbolic name of a Failure::HResult, for logging failures. Empty for ones not in the table above.
+    constexpr std::string_view GetHResultName(int32_t HResult) noexcept
+    {
+        for (auto& Known : Detail::HResultNames) {
+            if (Known.HResult == HResult) {
+                return Known.Name;
+            }
+        }
+        return std::string_view();
+    }
+
+    // Distinct HRESULTs counted individually, the rest are only counted in total
+    constexpr size_t MaxTrackedHResults = 16;
+
+    struct FailureStats {
+        struct HResultCount {
+            int32_t HResult;
+            uint64_t Count;
+        };
+
+        // Indexed by Stage
+        uint64_t ByStage[StageCount];
+        // The first ByHResultCount entries are valid
+        HResultCount ByHResult[MaxTrackedHResults];
+        size_t ByHResultCount;
+        uint64_t OtherHResults;
+    };
+
+    enum class EventType : uint8_t {
+        Clicked,
+        Dismissed,
+        Failed
+    };
+
+    // A toast's lifecycle event, ActionIdx is set for Clicked and Reason for Dismissed
+    struct Event {
+        int64_t Id;
+        EventType Type;
+        int ActionIdx;
+        DismissalReason Reason;
+    };
+
+    // Receives every handler callback to run, instead of it being called on the thread
+    // that raised the event. It's called from the notification platform's threads.
+    using Executor = Detail::InlineFunction<void(Detail::InlineFunction<void()>&& Callback)>;
+
+    struct Options {
+        // Run the backend on a thread owned by WinToast (its own STA on Windows).
+        // Every call is marshalled onto it, so any thread can use the instance,
+        // and SubmitToast returns as soon as the toast is queued.
+        bool UseWorkerThread = false;
+
+        // Limits on how many toasts (and payload bytes) are remembered for HideToast/ClearToasts.
+        // When exceeded, the least recently shown toasts are forgotten. 0 means unlimited.
+        size_t MaxBufferSize = 0;
+        size_t MaxBufferBytes = 0;
+
+        // Runs handler callbacks, e.g. by posting them to the application's event loop.
+        // Without one, they run on the notification platform's thread.
+        Executor CallbackExecutor;
+
+        // When non-zero, lifecycle events are also recorded into a ring of (at least) this many
+        // entries, to be drained with PollEvents. Events are dropped while the ring is full.
+        size_t EventQueueSize = 0;
+
+        // Milliseconds between updates sent for the same toast. UpdateToast calls closer together
+        // are merged, and only the latest values are sent once the interval has passed. 0 sends every update.
+        int64_t MinUpdateInterval = 0;
+
+        // Where the wall clock is read from, for scheduled toasts and expirations. Defaults to std::chrono::system_clock.
+        WinToastLib::TimeSource TimeSource;
+
+        // Records ShowToast's stages and each toast's lifecycle onto this tracer's timeline
+        std::shared_ptr<Tracer> Trace;
+
+        // When non-zero, at most this many toasts are displayed (or being shown) at once. A toast that finishes,
+        // expires, is hidden or forgotten frees its slot. Toasts past the limit are handled by AdmissionPolicy and
+        // their Template::Priority, and refused ones fail with Error::Overloaded.
+        size_t MaxInFlight = 0;
+        WinToastLib::AdmissionPolicy AdmissionPolicy = WinToastLib::AdmissionPolicy::DropLowest;
+        // Milliseconds AdmissionPolicy::Block waits for a slot
+        int64_t AdmissionTimeout = 1000;
+
+        // When set, displayed toasts are journaled to this file, and Initialize recovers the ones a previous run
+        // left displayed under their old ids, so HideToast and ClearToasts still reach them. Only toasts with a tag
+        // can be recovered. JournalSize is the file's initial size in bytes, it's compacted (and grown if need be) when full.
+        // Compacting copies the live toasts to a new file and waits for it to be written back, holding up toasts and
+        // their events meanwhile. The worker thread compacts it ahead of time while idle, otherwise the ShowToast
+        // finding it full does. It's at least twice the live toasts' size afterwards, so this is rare.
+        // An existing file that isn't a journal is never overwritten, Initialize fails with Error::JournalFailed instead.
+        // Writes failing later on are recorded as failures at Stage::Journal.
+        std::string JournalPath;
+        size_t JournalSize = 1 << 20;
+    };
+
+    struct BufferStats {
+        size_t Live;
+        size_t LiveBytes;
+        // Removed because the toast was activated, dismissed or failed
+        uint64_t Finished;
+        // Removed because Template::Expiration passed
+        uint64_t Expired;
+        // Removed to stay within MaxBufferSize/MaxBufferBytes
+        uint64_t Evicted;
+        // Dropped within a tag's Template::CoalesceWindow
+        uint64_t Suppressed;
+        // Removed because a newer toast with the same tag and group took its place
+        uint64_t Replaced;
+    };
+
+    struct WorkerStats {
+        uint64_t QueueDepth;
+        uint64_t Submitted;
+        uint64_t Completed;
+        // Time from being queued to finishing on the worker
+        uint64_t AverageLatencyNs;
+        uint64_t MaxLatencyNs;
+    };
+
+    struct UpdateStats {
+        // UpdateToast calls that were accepted
+        uint64_t Received;
+        // Updates sent to the platform, the rest were merged into them
+        uint64_t Sent;
+        // Dropped for having an older SequenceNumber than an update already received
+        uint64_t Stale;
+    };
+
+    struct AdmissionStats {
+        // Toasts that got a slot under Options.MaxInFlight
+        uint64_t Admitted;
+        // Toasts that had to wait for one, whether they got it or not
+        uint64_t Queued;
+        // Refused with Error::Overloaded
+        uint64_t Shed;
+        // Displayed toasts hidden to make room for new ones
+        uint64_t Displaced;
+        // Currently waiting for a slot
+        uint64_t Waiting;
+    };
+
+    struct Stats {
+        // Indexed by Stage
+        LatencyStats Stages[StageCount];
+        BufferStats Buffer;
+        WorkerStats Worker;
+        FailureStats Failures;
+        UpdateStats Updates;
+        AdmissionStats Admission;
+    };
+
+    // A toast left displayed by a previous run, see Options.JournalPath
+    struct RecoveredToast {
+        int64_t Id;
+        std::string Tag;
+        std::string Group;
+        std::chrono::system_clock::time_point ShownAt;
+    };
+
+    struct ToastClicked {
+        int ActionIdx;
+    };
+
+    // Showing the toast failed, or the platform failed it afterwards (Error::NotDisplayed)
+    struct ToastFailed {
+        WinToastLib::Error Error;
+    };
+
+    // How a toast shown with ShowToastAsync ended
+    using ToastOutcome = std::variant<ToastClicked, DismissalReason, ToastFailed>;
 
     class WinToast {
     public:
-        WinToast(const std::string& Aumi);
+        // Returned by ShowToastAsync, to be co_awaited once. It lives in the awaiting coroutine's frame and the
+        // toast's handler only points back to it, so awaiting doesn't allocate on its own.
+        class ShowAwaiter {
+        public:
+            ShowAwaiter(WinToast* Owner, const Template& Toast, Executor&& Scheduler, std::stop_token StopToken);
+
+            ShowAwaiter(const ShowAwaiter&) = delete;
+            ShowAwaiter& operator=(const ShowAwaiter&) = delete;
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            bool await_suspend(std::coroutine_handle<> Handle);
+            ToastOutcome await_resume();
+
+        private:
+            struct Canceller {
+                ShowAwaiter* Awaiter;
+
+                void operator()() noexcept;
+            };
+
+            void Complete(ToastOutcome&& Result);
+            void Resume();
+
+            WinToast* Owner;
+            const Template* Toast;
+            // Toast without its CoalesceWindow, if it had one
+            std::optional<Template> Uncoalesced;
+            Executor Scheduler;
+            std::stop_token StopToken;
+            std::optional<std::stop_callback<Canceller>> StopCallback;
+            std::coroutine_handle<> Handle;
+            int64_t Id;
+            ToastOutcome Outcome;
+            // 0 while the toast is being shown, 1 once suspended, 2 once complete. Whichever of await_suspend
+            // and Complete gets to it second resumes the coroutine.
+            std::atomic<uint8_t> Progress;
+        };
+
+        WinToast(const std::string& Aumi, const Options& Options = {});
+        WinToast(const std::string& Aumi, std::unique_ptr<Backend> Backend, const Options& Options = {});
         ~WinToast();
 
         static bool IsCompatible();
@@ -139,13 +365,314 @@ namespace WinToastLib {
         bool IsInitialized() const;
 
         Error ShowToast(const Template& Toast, const Handler& Handler, int64_t* Id = nullptr);
+        // Same as above, but also reports where it failed
+        Error ShowToast(const Template& Toast, const Handler& Handler, ToastResult& Result);
+        // Shows a batch of toasts, writing each one's id and error to Results.
+        // Handlers holds either one handler for every toast or one per toast.
+        Error ShowToasts(std::span<const Template> Toasts, const Handler& Handler, std::span<ToastResult> Results);
+        Error ShowToasts(std::span<const Template> Toasts, std::span<const Handler> Handlers, std::span<ToastResult> Results);
+        // Shows the toast when co_awaited, and resumes the coroutine with how it ended. Toast is read then, so it has to
+        // outlive the co_await expression (temporaries in it do). The coroutine is resumed through Scheduler
+        // if there is one, otherwise on whichever thread the outcome arrived. Requesting a stop on StopToken hides the
+        // toast and ends it with DismissalReason::ApplicationHidden, unless it already ended or was forgotten
+        // (e.g. evicted, or replaced by a toast with the same tag), in which case it keeps waiting.
+        // Template::CoalesceWindow doesn't apply (the toast is copied to drop it), as a toast dropped that way would never end.
+        // The awaiting coroutine mustn't be destroyed while it's suspended.
+        ShowAwaiter ShowToastAsync(const Template& Toast, Executor Scheduler = {}, std::stop_token StopToken = {});
         Error HideToast(int64_t Id);
         Error ClearToasts();
+        // Removes the application's toasts in Group (or all of them) from the notification center in one platform call,
+        // rather than hiding them one by one like ClearToasts. This includes toasts this instance doesn't know about,
+        // e.g. ones from an earlier run, and the ones it does know about are forgotten.
+        Error ClearGroup(const std::string& Group);
+        Error ClearAll();
+
+        // Changes bound values of a displayed data-bound toast in place, keys not in Values keep theirs.
+        // Updates are numbered in call order, or by SequenceNumber if it's non-zero, and ones older than
+        // an update already received are dropped. Within Options.MinUpdateInterval of the toast's last
+        // update, values are only stored to be sent later, so calling this in a tight loop costs little.
+        // With a worker thread it never waits for the platform. Without one, an update that is due is sent
+        // to the platform on the calling thread before this returns.
+        Error UpdateToast(int64_t Id, std::span<const DataValue> Values, uint32_t SequenceNumber = 0);
+        Error UpdateToast(int64_t Id, std::initializer_list<DataValue> Values, uint32_t SequenceNumber = 0);
+        // Shows the toast at DeliveryTime (as read from Options.TimeSource), only building it then.
+        // Id is the schedule's, for RescheduleToast and CancelScheduledToast; once shown, the toast gets its own id
+        // like any other. If showing it fails, Handler.OnFailed is called.
+        // The worker thread shows scheduled toasts when they're due; without it, call DeliverScheduled periodically.
+        Error ScheduleToast(Template Toast, Handler Handler, std::chrono::system_clock::time_point DeliveryTime, int64_t* Id = nullptr);
+        Error RescheduleToast(int64_t Id, std::chrono::system_clock::time_point DeliveryTime);
+        Error CancelScheduledToast(int64_t Id);
+        // Shows the scheduled toasts that are due now, and returns how many were shown
+        size_t DeliverScheduled();
+        // Hides the toasts whose Template::Expiration has passed (by Options.TimeSource) and calls their
+        // Handler.OnDismissed(TimedOut), instead of whatever the platform reports for them afterwards.
+        // Returns how many were hidden. The worker thread does this when they're due; without it, ShowToast
+        // sweeps when it's past due, or call this periodically.
+        size_t SweepExpired();
+
+        // Sends updates held back by Options.MinUpdateInterval right away. The worker thread sends them
+        // when they're due on its own; without it, call this after the last update so it isn't held back.
+        Error FlushUpdates();
+
+        // Queues the toast for the worker thread and returns immediately.
+        // If showing it fails later on, Handler.OnFailed is called.
+        // Without a worker thread, this is the same as ShowToast.
+        // Pass rvalues to hand the toast over without copying it; once the queue has warmed up,
+        // submitting doesn't allocate.
+        Error SubmitToast(Template Toast, Handler Handler);
+        // Moves up to Events.size() recorded events into Events and returns how many.
+        // Only one thread may poll at a time. Requires Options.EventQueueSize.
+        size_t PollEvents(std::span<Event> Events);
+        // Events lost because the ring was full
+        uint64_t GetDroppedEventCount() const;
+
+        WorkerStats GetWorkerStats() const;
+        BufferStats GetBufferStats() const;
+        // Latencies and failures are always recorded, this is cheap enough to poll periodically
+        Stats GetStats() const;
+        // Copies up to the last 64 failures into Records, oldest first, and returns how many
+        size_t GetRecentFailures(std::span<FailureRecord> Records) const;
+        // Copies up to Toasts.size() of the toasts Initialize recovered into Toasts, oldest first, and returns how many.
+        // They can be hidden like any other toast, but raise no events. Other ids from the previous run may be handed out again.
+        size_t GetRecoveredToasts(std::span<RecoveredToast> Toasts) const;
 
     protected:
-        bool Initialized;
-        bool Coinitialized;
+        // Handlers outlive the instance, so they reach it through this.
+        // Owner is cleared on destruction, Mutex also guards Buffer.
+        // The executor and event ring are used without the lock.
+        struct SharedState {
+            std::mutex Mutex;
+            WinToast* Owner;
+            Executor CallbackExecutor;
+            std::unique_ptr<Detail::MpscRing<Event>> Events;
+            std::atomic<uint64_t> DroppedEvents = 0;
+            std::shared_ptr<Tracer> Trace;
+        };
+
+        // Created on a toast's first UpdateToast
+        struct UpdateEntry {
+            // Values not sent yet, merged by key
+            Detail::FixedVector<DataField, MaxDataFields> Pending;
+            uint32_t SequenceNumber;
+            std::chrono::steady_clock::time_point SentAt;
+            // Whether the toast is in DueUpdates
+            bool Due;
+        };
+
+        // Shared by the callbacks registered for one toast.
+        // Finished is set by the first event delivered, later ones are dropped.
+        struct TrackedHandler {
+            std::shared_ptr<SharedState> State;
+            int64_t Id;
+            WinToastLib::Handler User;
+            std::atomic<bool> Finished;
+        };
+
+        // Ids of the toasts in Buffer by group, in no particular order
+        using GroupMap = std::unordered_map<std::string, std::vector<int64_t>>;
+
+        struct BufferEntry {
+            std::unique_ptr<Backend::Notification> Notification;
+            // Tick (see GetTick) when Template::Expiration passes, 0 if it doesn't expire
+            uint64_t ExpiresAt;
+            // Its id in Expiries, 0 if none
+            int64_t ExpiryTimer;
+            WinToastLib::Priority Priority;
+            size_t Bytes;
+            // Group and tag, empty if the toast has neither
+            std::string TagKey;
+            // Its group in GroupIndex and its position there, null if it has no group
+            GroupMap::value_type* GroupMembers;
+            size_t GroupSlot;
+            std::unique_ptr<UpdateEntry> Update;
+            // So SweepExpired can raise the toast's dismissal itself. Weak, as entries are destroyed
+            // under the lock and the handler shouldn't be.
+            std::weak_ptr<TrackedHandler> Tracking;
+        };
+
+        struct TagEntry {
+            int64_t Id;
+            std::chrono::steady_clock::time_point ShownAt;
+        };
+
+        // Clock is when the first stage started, and is moved along as each one finishes.
+        // On failure, Failed says where.
+        Error CreateToast(const Template& Toast, BufferEntry& Entry, std::chrono::steady_clock::time_point& Clock, Failure& Failed);
+        Error PostToast(BufferEntry&& Entry, const Handler& Handler, int64_t& Id, std::chrono::steady_clock::time_point& Clock, Failure& Failed);
+
+        // ShowToast, once a slot has been taken for AdmissionPolicy::Block if needed.
+        // The dropping policies are applied in here, on the thread that shows toasts.
+        Error ShowAdmitted(const Template& Toast, const Handler& Handler, ToastResult& Result);
+        // Takes a slot under Options.MaxInFlight for a toast of priority Level, hiding another toast or waiting
+        // for one to finish as the policy says. Returns Error::Overloaded if there's none to be had.
+        Error Admit(Priority Level, bool CanWait);
+        // Gives back Admit's slot, once the toast is either in Buffer (where it's counted from then on) or not shown
+        void ReleaseAdmission(size_t Count = 1);
+        // These expect State->Mutex to be held
+        bool HasSlot(Priority Level) const;
+        int64_t FindDisplaced(Priority Level);
+
+        // Reads back Options.JournalPath and puts the toasts still displayed into Buffer
+        Error RecoverToasts();
+        // Compacts the journal if it's filling up, for the worker to call while idle
+        void CompactJournal();
+
+        // HideToast that raises OnDismissed(ApplicationHidden) itself, instead of whatever the platform reports.
+        // With a worker thread, calls from other threads are only queued, as they come from stop callbacks that
+        // the awaiting coroutine can be waiting on.
+        Error CancelToast(int64_t Id);
+
+        // Counts and logs a failure, then returns Result
+        Error RecordFailure(Error Result, const Failure& Failed);
+
+        // Returns the id of the displayed toast Toast should be merged into, or 0
+        int64_t FindCoalesced(const Template& Toast);
+
+        // These expect State->Mutex to be held, and hand back what should be released after unlocking
+        std::unique_ptr<Backend::Notification> RemoveEntry(int64_t Id);
+        void ReleaseEntry(int64_t Id, BufferEntry& Entry);
+        // Adds an entry just put into Buffer to GroupIndex
+        void IndexGroup(int64_t Id, BufferEntry& Entry);
+        // Forgets every toast, whether or not it's been hidden
+        void ForgetToasts(std::vector<std::unique_ptr<Backend::Notification>>& Forgotten);
+        void EvictEntries(std::vector<std::unique_ptr<Backend::Notification>>& Evicted);
+        static std::unique_ptr<Backend::Notification> OnToastFinished(const std::shared_ptr<SharedState>& State, int64_t Id);
+        static void OnToastEvent(const std::shared_ptr<TrackedHandler>& Tracking, const Event& Raised);
+        // OnToastEvent once Tracking->Finished has been claimed
+        static void DeliverEvent(const std::shared_ptr<TrackedHandler>& Tracking, const Event& Raised);
+
+        // Sends the merged values of toasts whose update interval has passed, or all of them if Force.
+        // Calls into the platform, so it runs on the worker if there is one.
+        Error SendUpdates(bool Force);
+
+        struct ScheduledToast {
+            Template Toast;
+            WinToastLib::Handler Handler;
+        };
+
+        // Wheel ticks are milliseconds of Options.TimeSource since the epoch, rounded up for due times
+        static uint64_t GetTick(std::chrono::system_clock::time_point Time, bool RoundUp);
+        // When the worker should wake up for a wheel whose next due tick is Due
+        std::chrono::steady_clock::time_point GetWakeTime(uint64_t Due) const;
+        // Expects ScheduleMutex to be held. Sets NextScheduledAt from the wheel, returns whether it moved closer.
+        bool UpdateNextScheduled();
+
+        // Either runs Task, or shows Toast if Task is empty. Submitted toasts are carried
+        // inline so they don't need a closure allocated for them.
+        struct WorkItem {
+            std::function<void()> Task;
+            Template Toast;
+            WinToastLib::Handler Handler;
+            std::chrono::steady_clock::time_point Queued;
+            // Whether SubmitToast already took a slot for it
+            bool Admitted;
+        };
+
+        // Records the time since Since for Timed and returns the current time.
+        // Id is only used for tracing, 0 if there's no toast (yet).
+        std::chrono::steady_clock::time_point RecordLatency(Stage Timed, std::chrono::steady_clock::time_point Since, int64_t Id = 0);
+        void RecordLatency(Stage Timed, std::chrono::steady_clock::time_point Since, std::chrono::steady_clock::time_point Until, int64_t Id = 0);
+
+        bool IsOnWorker() const;
+        void QueueWork(std::function<void()>&& Task);
+        void QueueWork(WorkItem&& Item);
+        // Wakes the worker if it's sleeping, after work was queued or NextUpdateAt/NextScheduledAt moved closer
+        void WakeWorker();
+        // Sleeps until work is queued past Queued, or the next update, scheduled toast or expiry is due
+        void WaitForWork(uint64_t Queued);
+        template<class F>
+        Error RunOnWorker(F&& Task);
+        void RunWorker();
+
+        std::atomic<bool> Initialized;
         std::string Aumi;
-        std::unordered_map<int64_t, ComPtr<IToastNotification>> Buffer;
+        WinToastLib::Options Options;
+        std::unique_ptr<Backend> Platform;
+        std::shared_ptr<SharedState> State;
+        Detail::SlotMap<BufferEntry> Buffer;
+        size_t BufferBytes;
+        uint64_t FinishedCount;
+        uint64_t ExpiredCount;
+        uint64_t EvictedCount;
+        std::unordered_map<std::string, TagEntry> TagIndex;
+        std::string TagKeyScratch;
+        GroupMap GroupIndex;
+        std::string GroupKeyScratch;
+        uint64_t SuppressedCount;
+        uint64_t ReplacedCount;
+        // Mirrors the tagged toasts in Buffer, guarded by State->Mutex. Closed if Options.JournalPath isn't set.
+        Detail::ToastJournal Journal;
+        std::vector<RecoveredToast> Recovered;
+        Detail::PayloadBuilder Payload;
+        std::unique_ptr<Detail::LatencyHistogram[]> Latencies;
+        // Options.Trace, kept alive by State. Null when tracing is off.
+        Tracer* Trace;
+
+        // Keys are the HRESULT's bits with bit 32 set, 0 marks a free slot
+        struct HResultSlot {
+            std::atomic<uint64_t> Key;
+            std::atomic<uint64_t> Count;
+        };
+
+        std::atomic<uint64_t> FailuresByStage[StageCount];
+        HResultSlot FailuresByHResult[MaxTrackedHResults];
+        std::atomic<uint64_t> OtherHResultFailures;
+        mutable std::mutex FailureMutex;
+        std::array<FailureRecord, 64> RecentFailures;
+        uint64_t FailureCount;
+
+        // Ids of toasts with values waiting to be sent, guarded by State->Mutex.
+        // NextUpdateAt is when the first of them is due, read by the worker without the lock.
+        std::vector<int64_t> DueUpdates;
+        std::atomic<std::chrono::steady_clock::time_point> NextUpdateAt;
+        uint64_t UpdatesReceived;
+        uint64_t UpdatesSent;
+        uint64_t UpdatesStale;
+        // Only used by SendUpdates
+        Detail::FixedVector<DataField, MaxDataFields> UpdateScratch;
+        std::string UpdateTagKey;
+
+        // Scheduled toasts, keyed by GetTick. NextScheduledAt is when the worker should next look at the wheel,
+        // on the steady clock so it can sleep until then.
+        mutable std::mutex ScheduleMutex;
+        Detail::TimingWheel<ScheduledToast> Scheduled;
+        std::atomic<std::chrono::steady_clock::time_point> NextScheduledAt;
+        // Only used by DeliverScheduled
+        std::vector<ScheduledToast> DueToasts;
+
+        struct ExpiredToast {
+            int64_t Id;
+            std::unique_ptr<Backend::Notification> Notification;
+            std::shared_ptr<TrackedHandler> Tracking;
+        };
+
+        // Buffer ids keyed by their BufferEntry::ExpiresAt, guarded by State->Mutex. Only whoever shows toasts
+        // adds to it, which is the worker itself if there is one, so NextExpiryAt never needs to wake it.
+        Detail::TimingWheel<int64_t> Expiries;
+        std::atomic<std::chrono::steady_clock::time_point> NextExpiryAt;
+        // Only used by SweepExpired
+        std::vector<ExpiredToast> ExpiredToasts;
+
+        // Slots taken by Admit and not released yet, guarded by State->Mutex like Buffer.
+        // Toasts in flight are Buffer.Size() + AdmissionsPending.
+        size_t AdmissionsPending;
+        std::array<size_t, PriorityCount> AdmissionWaiters;
+        size_t AdmissionWaiting;
+        std::condition_variable AdmissionCondition;
+        uint64_t AdmittedCount;
+        uint64_t QueuedCount;
+        uint64_t ShedCount;
+        uint64_t DisplacedCount;
+
+        std::thread Worker;
+        bool StopWorker;
+        std::mutex WakeMutex;
+        std::condition_variable WakeCondition;
+        std::atomic<bool> WorkerSleeping;
+        Detail::MpscQueue<WorkItem> WorkQueue;
+        std::atomic<uint64_t> WorkQueued;
+        std::atomic<uint64_t> WorkCompleted;
+        std::atomic<uint64_t> WorkLatencyTotal;
+        std::atomic<uint64_t> WorkLatencyMax;
     };
-}
+}
\ No newline at end of file